@@ -11,12 +11,16 @@ use nx::ipc::sf::nfp;
 
 use crate::fsext;
 use crate::miiext;
+use crate::index;
+
+// Size of the UUIDs amiibos report, the only size of uuid in amiibo.json which is used as is
+pub const UUID_SIZE: usize = 10;
 
 #[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
 #[repr(C)]
 pub struct VirtualAmiiboUuidInfo {
     use_random_uuid: bool,
-    uuid: [u8; 10]
+    uuid: [u8; UUID_SIZE]
 }
 
 #[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
@@ -29,7 +33,39 @@ pub struct VirtualAmiiboData {
     mii_charinfo: mii::CharInfo
 }
 
-#[derive(Serialize, Deserialize, Debug)]
+// Everything the overlay needs to list a virtual amiibo, without loading its Mii
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+#[repr(C)]
+pub struct VirtualAmiiboLiteData {
+    uuid_info: VirtualAmiiboUuidInfo,
+    name: util::CString<41>,
+    first_write_date: nfp::Date,
+    last_write_date: nfp::Date
+}
+
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+#[repr(u32)]
+pub enum VirtualAmiiboListEntryKind {
+    Amiibo,
+    Folder
+}
+
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct VirtualAmiiboListEntry {
+    pub kind: VirtualAmiiboListEntryKind,
+    pub name: util::CString<0x301>,
+    pub data: VirtualAmiiboLiteData
+}
+
+#[derive(Copy, Clone, Default)]
+#[repr(C)]
+pub struct VirtualAmiiboListPage {
+    pub entry_count: u32,
+    pub next_cursor: u32
+}
+
+#[derive(Serialize, Deserialize, Debug, Clone)]
 pub struct VirtualAmiiboId {
     pub game_character_id: u16,
     pub character_variant: u8,
@@ -44,7 +80,7 @@ impl VirtualAmiiboId {
     }
 }
 
-#[derive(Serialize, Deserialize, Debug)]
+#[derive(Serialize, Deserialize, Debug, Clone)]
 pub struct VirtualAmiiboDate {
     pub y: u16,
     pub m: u8,
@@ -61,16 +97,16 @@ impl VirtualAmiiboDate {
     }
 }
 
-#[derive(Serialize, Deserialize, Debug)]
+#[derive(Serialize, Deserialize, Debug, Clone)]
 pub struct VirtualAmiiboInfo {
-    first_write_date: VirtualAmiiboDate,
-    id: VirtualAmiiboId,
-    last_write_date: VirtualAmiiboDate,
-    mii_charinfo_file: String,
-    name: String,
-    uuid: Option<Vec<u8>>,
-    version: u16,
-    write_counter: u16
+    pub first_write_date: VirtualAmiiboDate,
+    pub id: VirtualAmiiboId,
+    pub last_write_date: VirtualAmiiboDate,
+    pub mii_charinfo_file: String,
+    pub name: String,
+    pub uuid: Option<Vec<u8>>,
+    pub version: u16,
+    pub write_counter: u16
 }
 
 impl VirtualAmiiboInfo {
@@ -86,6 +122,25 @@ impl VirtualAmiiboInfo {
             write_counter: 0
         }
     }
+
+    pub fn produce_uuid_info(&self) -> VirtualAmiiboUuidInfo {
+        let mut uuid_info: VirtualAmiiboUuidInfo = Default::default();
+        match self.uuid.as_ref() {
+            Some(uuid) if uuid.len() == UUID_SIZE => uuid_info.uuid.copy_from_slice(uuid.as_slice()),
+            _ => uuid_info.use_random_uuid = true
+        };
+        uuid_info
+    }
+
+    pub fn produce_lite_data(&self) -> Result<VirtualAmiiboLiteData> {
+        let mut data: VirtualAmiiboLiteData = Default::default();
+        data.uuid_info = self.produce_uuid_info();
+        // Listings show the amiibo anyway if its name is too long, the full name is still used once it is activated
+        data.name.set_string(truncate_string(&self.name, 41 - 1))?;
+        data.first_write_date = self.first_write_date.to_date();
+        data.last_write_date = self.last_write_date.to_date();
+        Ok(data)
+    }
 }
 
 // No easier way of having a constant way of creating the struct below :P
@@ -188,15 +243,7 @@ impl VirtualAmiibo {
 
     pub fn produce_data(&self) -> Result<VirtualAmiiboData> {
         let mut data: VirtualAmiiboData = Default::default();
-        match self.info.uuid.as_ref() {
-            Some(uuid) => {
-                for i in 0..data.uuid_info.uuid.len() {
-                    data.uuid_info.uuid[i] = uuid[i];
-                }
-            },
-            None => data.uuid_info.use_random_uuid = true
-        };
-
+        data.uuid_info = self.info.produce_uuid_info();
         data.name.set_string(self.info.name.clone())?;
         data.first_write_date = self.info.first_write_date.to_date();
         data.last_write_date = self.info.last_write_date.to_date();
@@ -209,8 +256,8 @@ impl VirtualAmiibo {
         tag_info.uuid_length = tag_info.uuid.len() as u8;
         unsafe {
             match self.info.uuid.as_ref() {
-                Some(uuid) => core::ptr::copy(uuid.as_ptr(), tag_info.uuid.as_mut_ptr(), tag_info.uuid.len()),
-                None => {
+                Some(uuid) if uuid.len() == tag_info.uuid.len() => core::ptr::copy(uuid.as_ptr(), tag_info.uuid.as_mut_ptr(), tag_info.uuid.len()),
+                _ => {
                     let mut rng = rand::SplCsrngGenerator::new()?;
                     rng.random_bytes(tag_info.uuid.as_mut_ptr(), tag_info.uuid.len())?;
                 }
@@ -268,19 +315,129 @@ impl VirtualAmiibo {
 }
 
 pub fn try_load_virtual_amiibo(path: String) -> Result<VirtualAmiibo> {
+    let virtual_amiibo_info = try_load_virtual_amiibo_info(path.clone())?;
+    VirtualAmiibo::new(virtual_amiibo_info, path)
+}
+
+pub fn try_load_virtual_amiibo_info(path: String) -> Result<VirtualAmiiboInfo> {
     let amiibo_flag_file = format!("{}/amiibo.flag", path);
     result_return_unless!(fsext::exists_file(amiibo_flag_file), 0xBEBE);
 
     let amiibo_json_file = format!("{}/amiibo.json", path);
     result_return_unless!(fsext::exists_file(amiibo_json_file.clone()), 0xBEBE);
 
+    let amiibo_json_data = read_virtual_amiibo_json(&path)?;
+    parse_virtual_amiibo_info(amiibo_json_data.as_slice())
+}
+
+// The raw contents of amiibo.json, which fails to open if it does not exist
+pub fn read_virtual_amiibo_json(path: &String) -> Result<Vec<u8>> {
+    let amiibo_json_file = format!("{}/amiibo.json", path);
     let mut amiibo_json = fs::open_file(amiibo_json_file, fs::FileOpenOption::Read())?;
     let mut amiibo_json_data: Vec<u8> = vec![0; amiibo_json.get_size()?];
     amiibo_json.read(amiibo_json_data.as_mut_ptr(), amiibo_json_data.len())?;
-    if let Ok(amiibo_json_str) = core::str::from_utf8(amiibo_json_data.as_slice()) {
+    Ok(amiibo_json_data)
+}
+
+pub fn parse_virtual_amiibo_info(amiibo_json_data: &[u8]) -> Result<VirtualAmiiboInfo> {
+    if let Ok(amiibo_json_str) = core::str::from_utf8(amiibo_json_data) {
         if let Ok(virtual_amiibo_info) = serde_json::from_str::<VirtualAmiiboInfo>(amiibo_json_str) {
-            return VirtualAmiibo::new(virtual_amiibo_info, path.clone());
+            return Ok(virtual_amiibo_info);
         }
     }
     Err(ResultCode::new(0xBEBE))
-}
\ No newline at end of file
+}
+
+// The longest prefix of string that fits in max_len bytes without splitting a character
+fn truncate_string(string: &String, max_len: usize) -> String {
+    let mut len = core::cmp::min(string.len(), max_len);
+    while !string.is_char_boundary(len) {
+        len -= 1;
+    }
+    String::from(&string[..len])
+}
+
+// A directory listing in progress, kept by the IPC session between pages so that each page carries on from the open directory
+// pending_name is the entry which was read but did not fit in the last page, pass is the index pass of a listing which started at the first entry (0 otherwise)
+pub struct VirtualAmiiboDirectoryListing {
+    path: String,
+    dir: fs::DirectoryAccessor,
+    next_cursor: u32,
+    pending_name: Option<String>,
+    pass: u32
+}
+
+impl VirtualAmiiboDirectoryListing {
+    // Only a client which is not resuming the last listing of its session pays for skipping the first cursor entries
+    fn open(path: String, cursor: u32) -> Result<Self> {
+        let mut dir = fs::open_directory(path.clone(), fs::DirectoryOpenMode::ReadDirectories())?;
+        for _ in 0..cursor {
+            if dir.read_next()?.is_none() {
+                break;
+            }
+        }
+        let pass = if cursor == 0 { index::begin_folder_pass() } else { 0 };
+        Ok(Self { path: path, dir: dir, next_cursor: cursor, pending_name: None, pass: pass })
+    }
+
+    // Entries whose name can't be read are skipped, but still counted by the cursor
+    fn read_next_name(&mut self) -> Result<Option<String>> {
+        if let Some(name) = self.pending_name.take() {
+            return Ok(Some(name));
+        }
+        while let Some(dir_entry) = self.dir.read_next()? {
+            match dir_entry.name.get_string() {
+                Ok(name) => return Ok(Some(name)),
+                Err(_) => self.next_cursor += 1
+            };
+        }
+        Ok(None)
+    }
+}
+
+// Fills out_entries with the subdirectories of path, starting at cursor
+// Entries are written straight into the caller's buffer (the heap is way too small to hold a whole listing), next_cursor is 0 once the directory is done
+// listing holds the directory between calls: it is resumed when path and cursor match where it stopped, and dropped once done or on any error
+// A bad entry never fails the page: an amiibo which can't be loaded is listed as a folder, like any other subdirectory
+pub fn list_virtual_amiibo_directory(listing: &mut Option<VirtualAmiiboDirectoryListing>, path: String, cursor: u32, out_entries: &mut [VirtualAmiiboListEntry]) -> Result<VirtualAmiiboListPage> {
+    let mut page: VirtualAmiiboListPage = Default::default();
+    if out_entries.is_empty() {
+        return Ok(page);
+    }
+
+    let resumes = listing.as_ref().map_or(false, |state| (cursor != 0) && (state.next_cursor == cursor) && (state.path == path));
+    let mut state = match listing.take() {
+        Some(state) => if resumes { state } else { VirtualAmiiboDirectoryListing::open(path.clone(), cursor)? },
+        None => VirtualAmiiboDirectoryListing::open(path.clone(), cursor)?
+    };
+    while let Some(name) = state.read_next_name()? {
+        if page.entry_count as usize == out_entries.len() {
+            state.pending_name = Some(name);
+            page.next_cursor = state.next_cursor;
+            *listing = Some(state);
+            return Ok(page);
+        }
+
+        let entry = &mut out_entries[page.entry_count as usize];
+        if entry.name.set_string(truncate_string(&name, 0x301 - 1)).is_err() {
+            state.next_cursor += 1;
+            continue;
+        }
+        match index::get_virtual_amiibo_lite_data(&path, &name, state.pass) {
+            Ok(data) => {
+                entry.kind = VirtualAmiiboListEntryKind::Amiibo;
+                entry.data = data;
+            },
+            Err(_) => {
+                entry.kind = VirtualAmiiboListEntryKind::Folder;
+                entry.data = Default::default();
+            }
+        };
+        page.entry_count += 1;
+        state.next_cursor += 1;
+    }
+    if state.pass != 0 {
+        index::end_folder_pass(&path, state.pass);
+    }
+    Ok(page)
+}
@@ -1,4 +1,7 @@
+use nx::result::*;
+use nx::svc;
 use nx::sync;
+use nx::wait;
 use alloc::vec::Vec;
 
 use crate::amiibo;
@@ -34,12 +37,44 @@ pub enum VirtualAmiiboStatus {
     Disconnected
 }
 
+// Everything the overlay shows every frame, so that it only needs a single request per frame
+#[derive(Copy, Clone)]
+#[repr(C)]
+pub struct StatusSnapshot {
+    pub emulation_status: EmulationStatus,
+    pub active_virtual_amiibo_status: VirtualAmiiboStatus,
+    pub active_virtual_amiibo_generation: u32,
+    pub is_application_id_intercepted: bool
+}
+
 pub const CURRENT_VERSION: Version = Version::from(0, 6, 1, false);
 
 static mut G_EMULATION_STATUS: sync::Locked<EmulationStatus> = sync::Locked::new(false, EmulationStatus::Off);
 static mut G_ACTIVE_VIRTUAL_AMIIBO_STATUS: sync::Locked<VirtualAmiiboStatus> = sync::Locked::new(false, VirtualAmiiboStatus::Invalid);
 static mut G_INTERCEPTED_APPLICATION_IDS: sync::Locked<Vec<u64>> = sync::Locked::new(false, Vec::new());
 static mut G_ACTIVE_VIRTUAL_AMIIBO: sync::Locked<amiibo::VirtualAmiibo> = sync::Locked::new(false, amiibo::VirtualAmiibo::empty());
+static mut G_ACTIVE_VIRTUAL_AMIIBO_GENERATION: sync::Locked<u32> = sync::Locked::new(false, 0);
+static mut G_STATE_CHANGE_EVENT: sync::Locked<Option<wait::SystemEvent>> = sync::Locked::new(false, None);
+
+// Created when the first client asks for it, every client gets a copy of the same event
+pub fn get_state_change_event_handle() -> Result<svc::Handle> {
+    unsafe {
+        let event = G_STATE_CHANGE_EVENT.get();
+        if event.is_none() {
+            *event = Some(wait::SystemEvent::new()?);
+        }
+        Ok(event.as_ref().unwrap().client_handle)
+    }
+}
+
+// Signalled on every change to the statuses, the active amiibo or the intercepted applications, so that clients don't need to poll them
+fn notify_state_changed() {
+    unsafe {
+        if let Some(event) = G_STATE_CHANGE_EVENT.get().as_ref() {
+            let _ = event.signal();
+        }
+    }
+}
 
 pub fn get_emulation_status() -> EmulationStatus {
     unsafe {
@@ -50,6 +85,7 @@ pub fn get_emulation_status() -> EmulationStatus {
 pub fn set_emulation_status(status: EmulationStatus) {
     unsafe {
         G_EMULATION_STATUS.set(status);
+        notify_state_changed();
     }
 }
 
@@ -62,18 +98,21 @@ pub fn get_active_virtual_amiibo_status() -> VirtualAmiiboStatus {
 pub fn set_active_virtual_amiibo_status(status: VirtualAmiiboStatus) {
     unsafe {
         G_ACTIVE_VIRTUAL_AMIIBO_STATUS.set(status);
+        notify_state_changed();
     }
 }
 
 pub fn register_intercepted_application_id(application_id: u64) {
     unsafe {
         G_INTERCEPTED_APPLICATION_IDS.get().push(application_id);
+        notify_state_changed();
     }
 }
 
 pub fn unregister_intercepted_application_id(application_id: u64) {
     unsafe {
         G_INTERCEPTED_APPLICATION_IDS.get().retain(|&id| id != application_id);
+        notify_state_changed();
     }
 }
 
@@ -93,5 +132,24 @@ pub fn set_active_virtual_amiibo(virtual_amiibo: amiibo::VirtualAmiibo) {
     unsafe {
         G_ACTIVE_VIRTUAL_AMIIBO.set(virtual_amiibo);
         set_active_virtual_amiibo_status(VirtualAmiiboStatus::Connected);
+        let generation = G_ACTIVE_VIRTUAL_AMIIBO_GENERATION.get_val();
+        G_ACTIVE_VIRTUAL_AMIIBO_GENERATION.set(generation.wrapping_add(1));
+        notify_state_changed();
+    }
+}
+
+// Bumped every time the active virtual amiibo is replaced, so clients know when to reload it
+pub fn get_active_virtual_amiibo_generation() -> u32 {
+    unsafe {
+        G_ACTIVE_VIRTUAL_AMIIBO_GENERATION.get_val()
+    }
+}
+
+pub fn get_status_snapshot(application_id: u64) -> StatusSnapshot {
+    StatusSnapshot {
+        emulation_status: get_emulation_status(),
+        active_virtual_amiibo_status: get_active_virtual_amiibo_status(),
+        active_virtual_amiibo_generation: get_active_virtual_amiibo_generation(),
+        is_application_id_intercepted: is_application_id_intercepted(application_id)
     }
 }
\ No newline at end of file
@@ -28,6 +28,7 @@ pub fn recreate_directory(path: String) {
 pub const BASE_DIR: &'static str = "sdmc:/emuiibo";
 pub const VIRTUAL_AMIIBO_DIR: &'static str = "sdmc:/emuiibo/amiibo";
 pub const EXPORTED_MIIS_DIR: &'static str = "sdmc:/emuiibo/miis";
+pub const AMIIBO_INDEX_FILE: &'static str = "sdmc:/emuiibo/amiibo_index.bin";
 
 pub fn ensure_directories() {
     let _ = fs::create_directory(String::from(BASE_DIR));
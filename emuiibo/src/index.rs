@@ -0,0 +1,202 @@
+use nx::result::*;
+use nx::sync;
+use nx::fs;
+use alloc::string::String;
+use alloc::vec::Vec;
+
+use crate::amiibo;
+use crate::fsext;
+
+// What folder listings show of every virtual amiibo listed so far, keyed by the hash of its path and revalidated against the hash of its amiibo.json
+// It is kept on the SD card between boots, so that listing folders rarely needs to parse any JSON
+
+const INDEX_MAGIC: u32 = 0x58444945; // "EIDX"
+const INDEX_VERSION: u32 = 2;
+
+// 88 bytes each, the whole index takes 0x16000 of heap: libraries up to this size are indexed whole,
+// past it new amiibos are parsed every time they are listed, without touching the index
+const MAX_INDEX_RECORDS: usize = 1024;
+
+#[derive(Copy, Clone, Default)]
+#[repr(C)]
+struct IndexRecord {
+    path_hash: u64,
+    folder_hash: u64,
+    json_hash: u64,
+    // Listing pass which last saw the amiibo, only meaningful while the sysmodule runs
+    last_pass: u32,
+    data: amiibo::VirtualAmiiboLiteData
+}
+
+// FNV-1a, good enough to tell paths and amiibo.json contents apart
+fn hash_bytes(bytes: &[u8]) -> u64 {
+    let mut hash: u64 = 0xCBF29CE484222325;
+    for byte in bytes {
+        hash ^= *byte as u64;
+        hash = hash.wrapping_mul(0x100000001B3);
+    }
+    hash
+}
+
+struct Index {
+    records: Vec<IndexRecord>,
+    pass_counter: u32,
+    loaded: bool,
+    dirty: bool
+}
+
+impl Index {
+    const fn new() -> Self {
+        Self { records: Vec::new(), pass_counter: 0, loaded: false, dirty: false }
+    }
+
+    fn find(&self, path_hash: u64) -> core::result::Result<usize, usize> {
+        self.records.binary_search_by_key(&path_hash, |record| record.path_hash)
+    }
+
+    // A full index is left as it is, so that listing a larger library does not churn it (nor rewrite it every time)
+    fn insert(&mut self, record: IndexRecord) {
+        match self.find(record.path_hash) {
+            Ok(idx) => self.records[idx] = record,
+            Err(idx) => {
+                if self.records.len() >= MAX_INDEX_RECORDS {
+                    return;
+                }
+                self.records.insert(idx, record);
+            }
+        };
+        self.dirty = true;
+    }
+
+    fn remove(&mut self, path_hash: u64) {
+        if let Ok(idx) = self.find(path_hash) {
+            self.records.remove(idx);
+            self.dirty = true;
+        }
+    }
+
+    // Amiibos of the folder which the pass did not see were deleted or moved
+    fn sweep(&mut self, folder_hash: u64, pass: u32) {
+        let count = self.records.len();
+        self.records.retain(|record| (record.folder_hash != folder_hash) || (record.last_pass == pass));
+        if self.records.len() != count {
+            self.dirty = true;
+        }
+    }
+
+    fn load(&mut self) {
+        self.loaded = true;
+        // All at once, growing it would briefly need the old vector next to the new one
+        self.records.reserve_exact(MAX_INDEX_RECORDS);
+        if let Ok(mut file) = fs::open_file(String::from(fsext::AMIIBO_INDEX_FILE), fs::FileOpenOption::Read()) {
+            if self.read_records(&mut file).is_err() {
+                self.records.clear();
+            }
+        }
+    }
+
+    fn records_bytes(&self) -> &[u8] {
+        unsafe {
+            core::slice::from_raw_parts(self.records.as_ptr() as *const u8, self.records.len() * core::mem::size_of::<IndexRecord>())
+        }
+    }
+
+    fn read_records(&mut self, file: &mut fs::FileAccessor) -> Result<()> {
+        let magic: u32 = file.read_val()?;
+        let version: u32 = file.read_val()?;
+        let record_size: u32 = file.read_val()?;
+        let count: u32 = file.read_val()?;
+        let records_hash: u64 = file.read_val()?;
+        result_return_unless!(magic == INDEX_MAGIC && version == INDEX_VERSION, 0xBEBE);
+        result_return_unless!(record_size as usize == core::mem::size_of::<IndexRecord>() && count as usize <= MAX_INDEX_RECORDS, 0xBEBE);
+
+        self.records.resize(count as usize, Default::default());
+        file.read(self.records.as_mut_ptr() as *mut u8, self.records.len() * core::mem::size_of::<IndexRecord>())?;
+        // Checked on the raw bytes, before anything reads the records: a damaged file could hold invalid values
+        result_return_unless!(hash_bytes(self.records_bytes()) == records_hash, 0xBEBE);
+        result_return_unless!(self.records.windows(2).all(|pair| pair[0].path_hash < pair[1].path_hash), 0xBEBE);
+        for record in self.records.iter_mut() {
+            record.last_pass = 0;
+        }
+        Ok(())
+    }
+
+    fn save(&mut self) -> Result<()> {
+        if !self.dirty {
+            return Ok(());
+        }
+        let index_file = String::from(fsext::AMIIBO_INDEX_FILE);
+        let _ = fs::delete_file(index_file.clone());
+        let mut file = fs::open_file(index_file, fs::FileOpenOption::Create() | fs::FileOpenOption::Write() | fs::FileOpenOption::Append())?;
+        file.write_val(INDEX_MAGIC)?;
+        file.write_val(INDEX_VERSION)?;
+        file.write_val(core::mem::size_of::<IndexRecord>() as u32)?;
+        file.write_val(self.records.len() as u32)?;
+        file.write_val(hash_bytes(self.records_bytes()))?;
+        let records_bytes = self.records_bytes();
+        file.write(records_bytes.as_ptr(), records_bytes.len())?;
+        self.dirty = false;
+        Ok(())
+    }
+}
+
+static mut G_INDEX: sync::Locked<Index> = sync::Locked::new(false, Index::new());
+
+fn get_index() -> &'static mut Index {
+    unsafe {
+        let index = G_INDEX.get();
+        if !index.loaded {
+            index.load();
+        }
+        index
+    }
+}
+
+// Starts a listing of folder from its first entry, the pass it returns marks the amiibos the listing sees
+pub fn begin_folder_pass() -> u32 {
+    let index = get_index();
+    index.pass_counter = index.pass_counter.wrapping_add(1).max(1);
+    index.pass_counter
+}
+
+// Once a listing has seen every entry of folder, the amiibos it did not see are dropped
+pub fn end_folder_pass(folder: &String, pass: u32) {
+    get_index().sweep(hash_bytes(folder.as_bytes()), pass);
+}
+
+// What the listing of folder shows for its subdirectory name, pass 0 being a listing which did not start at the first entry
+pub fn get_virtual_amiibo_lite_data(folder: &String, name: &String, pass: u32) -> Result<amiibo::VirtualAmiiboLiteData> {
+    let path = format!("{}/{}", folder, name);
+    result_return_unless!(fsext::exists_file(format!("{}/amiibo.flag", path)), 0xBEBE);
+    // Read every time, since the index is only as good as the amiibo.json it was made from
+    let json = amiibo::read_virtual_amiibo_json(&path)?;
+
+    let index = get_index();
+    let path_hash = hash_bytes(path.as_bytes());
+    let json_hash = hash_bytes(json.as_slice());
+    if let Ok(idx) = index.find(path_hash) {
+        let record = &mut index.records[idx];
+        if record.json_hash == json_hash {
+            if pass != 0 {
+                record.last_pass = pass;
+            }
+            return Ok(record.data);
+        }
+    }
+
+    match amiibo::parse_virtual_amiibo_info(json.as_slice()).and_then(|info| info.produce_lite_data()) {
+        Ok(data) => {
+            index.insert(IndexRecord { path_hash: path_hash, folder_hash: hash_bytes(folder.as_bytes()), json_hash: json_hash, last_pass: pass, data: data });
+            Ok(data)
+        },
+        Err(rc) => {
+            index.remove(path_hash);
+            Err(rc)
+        }
+    }
+}
+
+// Writes the index back to the SD card if anything changed since it was last saved
+pub fn flush() {
+    let _ = get_index().save();
+}
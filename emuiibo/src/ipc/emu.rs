@@ -6,6 +6,7 @@ use alloc::string::String;
 use crate::resultsext;
 use crate::emu;
 use crate::amiibo;
+use crate::index;
 use crate::fsext;
 
 pub trait IEmulationService {
@@ -20,10 +21,14 @@ pub trait IEmulationService {
     ipc_interface_define_command!(set_active_virtual_amiibo_status: (status: emu::VirtualAmiiboStatus) => ());
     ipc_interface_define_command!(is_application_id_intercepted: (application_id: u64) => (is_intercepted: bool));
     ipc_interface_define_command!(try_parse_virtual_amiibo: (path: sf::InMapAliasBuffer) => (virtual_amiibo: amiibo::VirtualAmiiboData));
+    ipc_interface_define_command!(list_virtual_amiibo_directory: (cursor: u32, path: sf::InMapAliasBuffer, out_entries: sf::OutMapAliasBuffer) => (page: amiibo::VirtualAmiiboListPage));
+    ipc_interface_define_command!(get_status_snapshot: (application_id: u64) => (snapshot: emu::StatusSnapshot));
+    ipc_interface_define_command!(attach_state_change_event: () => (event: sf::CopyHandle));
 }
 
 pub struct EmulationService {
-    session: sf::Session
+    session: sf::Session,
+    listing: Option<amiibo::VirtualAmiiboDirectoryListing>
 }
 
 impl sf::IObject for EmulationService {
@@ -43,14 +48,17 @@ impl sf::IObject for EmulationService {
             ipc_interface_make_command_meta!(get_active_virtual_amiibo_status: 7),
             ipc_interface_make_command_meta!(set_active_virtual_amiibo_status: 8),
             ipc_interface_make_command_meta!(is_application_id_intercepted: 9),
-            ipc_interface_make_command_meta!(try_parse_virtual_amiibo: 10)
+            ipc_interface_make_command_meta!(try_parse_virtual_amiibo: 10),
+            ipc_interface_make_command_meta!(list_virtual_amiibo_directory: 11),
+            ipc_interface_make_command_meta!(get_status_snapshot: 12),
+            ipc_interface_make_command_meta!(attach_state_change_event: 13)
         ]
     }
 }
 
 impl server::IServerObject for EmulationService {
     fn new() -> Self {
-        Self { session: sf::Session::new() }
+        Self { session: sf::Session::new(), listing: None }
     }
 }
 
@@ -119,6 +127,26 @@ impl IEmulationService for EmulationService {
         let data = amiibo.produce_data()?;
         Ok(data)
     }
+
+    fn list_virtual_amiibo_directory(&mut self, cursor: u32, path: sf::InMapAliasBuffer, out_entries: sf::OutMapAliasBuffer) -> Result<amiibo::VirtualAmiiboListPage> {
+        let path_str = path.get_string();
+        let entry_count = out_entries.size / core::mem::size_of::<amiibo::VirtualAmiiboListEntry>();
+        let entries = unsafe { core::slice::from_raw_parts_mut(out_entries.buf as *mut amiibo::VirtualAmiiboListEntry, entry_count) };
+        let page = amiibo::list_virtual_amiibo_directory(&mut self.listing, path_str, cursor, entries)?;
+        if page.next_cursor == 0 {
+            index::flush();
+        }
+        Ok(page)
+    }
+
+    fn get_status_snapshot(&mut self, application_id: u64) -> Result<emu::StatusSnapshot> {
+        Ok(emu::get_status_snapshot(application_id))
+    }
+
+    fn attach_state_change_event(&mut self) -> Result<sf::CopyHandle> {
+        let event_handle = emu::get_state_change_event_handle()?;
+        Ok(sf::Handle::from(event_handle))
+    }
 }
 
 impl server::IService for EmulationService {
@@ -26,9 +26,11 @@ mod miiext;
 mod ipc;
 mod emu;
 mod amiibo;
+mod index;
 mod area;
 
-const STACK_HEAP_SIZE: usize = 0x4000;
+// The IPC servers and amiibo parsing used to fit in 0x4000, the amiibo index takes 0x16000 more (see index.rs), the rest is slack for fragmentation
+const STACK_HEAP_SIZE: usize = 0x20000;
 static mut STACK_HEAP: [u8; STACK_HEAP_SIZE] = [0; STACK_HEAP_SIZE];
 
 #[no_mangle]
@@ -0,0 +1,56 @@
+#include <png_writer.hpp>
+#include <upng.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+// Decode throughput of upng, in MB of decoded pixels per second, on synthetic images and on any PNG files given as arguments
+// (e.g. a folder of real amiibo icons: build/bench/inflate /path/to/amiibo/*/amiibo.png)
+
+namespace {
+
+    constexpr double MinSeconds = 0.5;
+
+    double Now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void Run(const char *name, const std::vector<u8>& png_data) {
+        double bytes = 0;
+        u32 decodes = 0;
+        const double start = Now();
+        double elapsed = 0;
+        do {
+            upng_t *upng = upng_new_from_bytes(png_data.data(), png_data.size());
+            if(upng_decode(upng) != UPNG_EOK) {
+                std::printf("%-32s error %d\n", name, upng_get_error(upng));
+                upng_free(upng);
+                return;
+            }
+            bytes += upng_get_size(upng);
+            upng_free(upng);
+            decodes++;
+            elapsed = Now() - start;
+        } while(elapsed < MinSeconds);
+        std::printf("%-32s %8.1f MB/s %9.3f ms/decode\n", name, bytes / elapsed / 1e6, elapsed * 1e3 / decodes);
+    }
+
+}
+
+int main(int argc, char **argv) {
+    Run("icon 256x256 rgba", png::Encode(png::MakeImage(256, 256, png::RGBA, 8, png::Content::Smooth)));
+    Run("art 1024x1024 rgba", png::Encode(png::MakeImage(1024, 1024, png::RGBA, 8, png::Content::Smooth)));
+    Run("noise 512x512 rgb", png::Encode(png::MakeImage(512, 512, png::RGB, 8, png::Content::Noise)));
+
+    png::Options fixed;
+    fixed.strategy = Z_FIXED;
+    Run("icon 256x256 rgba, fixed codes", png::Encode(png::MakeImage(256, 256, png::RGBA, 8, png::Content::Smooth), fixed));
+
+    for(int i = 1; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ifstream::in | std::ifstream::binary);
+        const std::vector<u8> png_data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        Run(argv[i], png_data);
+    }
+    return 0;
+}
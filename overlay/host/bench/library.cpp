@@ -0,0 +1,187 @@
+#include <emuiibo_mock.hpp>
+#include <png_writer.hpp>
+#include <state.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+// Times what browsing a library costs the overlay: opening a folder, scrolling it to its end, decoding the icons of the rows it shows and loading the favorites
+// Synthetic libraries of 10, 1k and 10k amiibos are generated under the given directory (a temporary one by default), then reused by later runs
+
+namespace {
+
+    constexpr u32 LibrarySizes[] = { 10, 1000, 10000 };
+
+    // What the overlay layout asks for, see Main.cpp
+    constexpr int IconMaxHeight = 120;
+    constexpr int IconMaxWidth = 214;
+
+    // Rows a folder shows at once
+    constexpr u32 VisibleIcons = 16;
+
+    // Distinct icons, hard linked into every amiibo folder to keep the libraries small
+    constexpr u32 IconVariants = 8;
+    constexpr u32 IconSize = 256;
+
+    constexpr u32 Runs = 5;
+
+    double Now() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Median of a few runs, in milliseconds
+    template<typename F>
+    double Measure(F&& fn) {
+        std::vector<double> times;
+        for(u32 i = 0; i != Runs; ++i) {
+            const double start = Now();
+            fn();
+            times.push_back(Now() - start);
+        }
+        std::sort(times.begin(), times.end());
+        return times[Runs / 2];
+    }
+
+    std::string AmiiboName(const u32 index) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "amiibo-%05u", index);
+        return name;
+    }
+
+    void WriteFile(const std::filesystem::path& path, const void *data, const size_t size) {
+        std::ofstream file(path, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+        file.write(static_cast<const char*>(data), size);
+    }
+
+    void GenerateIcons(const std::filesystem::path& dir) {
+        std::filesystem::create_directories(dir);
+        for(u32 i = 0; i != IconVariants; ++i) {
+            const auto png = png::Encode(png::MakeImage(IconSize, IconSize, png::RGBA, 8, png::Content::Smooth, i + 1));
+            WriteFile(dir / (std::to_string(i) + ".png"), png.data(), png.size());
+        }
+    }
+
+    // A folder of amiibo_count amiibos, each with its amiibo.json and icon, and a favorites journal holding all of them
+    void GenerateLibrary(const std::filesystem::path& icons_dir, const std::filesystem::path& dir, const u32 amiibo_count) {
+        if(std::filesystem::exists(dir / "favorites.bin")) {
+            return;
+        }
+        std::filesystem::create_directories(dir);
+        FavoritesStore favorites;
+        favorites.load(dir, dir / "favorites.bin", dir / "favorites.txt");
+        for(u32 i = 0; i != amiibo_count; ++i) {
+            const auto amiibo_dir = dir / AmiiboName(i);
+            std::filesystem::create_directories(amiibo_dir);
+            WriteFile(amiibo_dir / "amiibo.flag", "", 0);
+            const auto json = "{\"name\": \"Amiibo " + std::to_string(i) + "\"}";
+            WriteFile(amiibo_dir / "amiibo.json", json.data(), json.size());
+            std::error_code ec;
+            std::filesystem::create_hard_link(icons_dir / (std::to_string(i % IconVariants) + ".png"), amiibo_dir / "amiibo.png", ec);
+            if(ec) {
+                std::filesystem::copy_file(icons_dir / (std::to_string(i % IconVariants) + ".png"), amiibo_dir / "amiibo.png");
+            }
+            favorites.add(amiibo_dir);
+        }
+        favorites.flush(dir / "favorites.bin");
+    }
+
+    // What the overlay does to open a folder, see AmiiboGui: the rows it shows and a page past them
+    std::shared_ptr<AmiiboListModel> OpenFolder(const EmuiiboState& state, const std::filesystem::path& dir) {
+        auto model = std::make_shared<AmiiboListModel>(dir);
+        state.fetchVirtualAmiiboDirectory(*model, VisibleIcons + EmuiiboState::VirtualAmiiboListPageSize);
+        return model;
+    }
+
+    // The pages the overlay fetches as the list scrolls down to the last entry, after opening the folder
+    size_t ScrollFolder(const EmuiiboState& state, AmiiboListModel& model) {
+        while (!model.isComplete()) {
+            if (!state.fetchVirtualAmiiboDirectoryPage(model)) {
+                break;
+            }
+        }
+        return model.size();
+    }
+
+    void RemoveThumbnails(const std::filesystem::path& dir, const u32 count) {
+        for(u32 i = 0; i != count; ++i) {
+            std::error_code ec;
+            std::filesystem::remove(dir / AmiiboName(i) / ".thumb.rgba", ec);
+        }
+    }
+
+    // Decodes the icons of the first rows, from the images or from the thumbnails cached next to them
+    void DecodeIcons(const std::filesystem::path& dir, const u32 count, PngImage::DecodeScratch& scratch, const bool cold) {
+        if(cold) {
+            RemoveThumbnails(dir, count);
+        }
+        for(u32 i = 0; i != count; ++i) {
+            PngImage image;
+            image.openFile(dir / AmiiboName(i) / "amiibo.png", IconMaxHeight, IconMaxWidth, scratch);
+            if(image.isError()) {
+                std::fprintf(stderr, "%s: %s\n", image.getPath().c_str(), image.getError().c_str());
+            }
+        }
+    }
+
+}
+
+int main(int argc, char **argv) {
+    const std::filesystem::path root = (argc > 1) ? std::filesystem::path{argv[1]} : std::filesystem::temp_directory_path() / "emuiibo-bench";
+    const auto icons_dir = root / "icons";
+    if(!std::filesystem::exists(icons_dir)) {
+        GenerateIcons(icons_dir);
+    }
+
+    std::printf("%-8s %14s %10s %14s %10s %16s %16s %16s\n", "amiibos", "folder open", "requests", "scroll to end", "requests", "icon decode", "icon thumbnail", "favorites load");
+    for(const u32 amiibo_count: LibrarySizes) {
+        const auto dir = root / ("library-" + std::to_string(amiibo_count));
+        GenerateLibrary(icons_dir, dir, amiibo_count);
+
+        emu::mock::SetVirtualAmiiboDirectory(dir.string());
+        EmuiiboState state;
+        state.initEmuiibo();
+
+        size_t requests = 0;
+        const double folder_ms = Measure([&] {
+            const auto start_requests = emu::mock::GetRequestCount();
+            OpenFolder(state, dir);
+            requests = emu::mock::GetRequestCount() - start_requests;
+        });
+
+        size_t scroll_requests = 0;
+        size_t listed_count = 0;
+        const double scroll_ms = Measure([&] {
+            const auto start_requests = emu::mock::GetRequestCount();
+            auto model = OpenFolder(state, dir);
+            listed_count = ScrollFolder(state, *model);
+            scroll_requests = emu::mock::GetRequestCount() - start_requests;
+        });
+        if(listed_count != amiibo_count) {
+            std::fprintf(stderr, "%zu amiibos listed out of %u\n", listed_count, amiibo_count);
+            return 1;
+        }
+
+        const u32 icon_count = std::min(amiibo_count, VisibleIcons);
+        PngImage::DecodeScratch scratch;
+        const double cold_ms = Measure([&] {
+            DecodeIcons(dir, icon_count, scratch, true);
+        });
+        const double warm_ms = Measure([&] {
+            DecodeIcons(dir, icon_count, scratch, false);
+        });
+
+        size_t favorite_count = 0;
+        const double favorites_ms = Measure([&] {
+            state.loadFavorites();
+            favorite_count = state.getFavorites().size();
+        });
+        if(favorite_count != amiibo_count) {
+            std::fprintf(stderr, "%zu favorites loaded out of %u\n", favorite_count, amiibo_count);
+            return 1;
+        }
+
+        std::printf("%-8u %11.2f ms %10zu %11.2f ms %10zu %10.3f ms/ea %10.3f ms/ea %13.2f ms\n", amiibo_count, folder_ms, requests, scroll_ms, scroll_requests, cold_ms / icon_count, warm_ms / icon_count, favorites_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <parallel_for.hpp>
+#include <png_writer.hpp>
+#include <chrono>
+#include <cstdio>
+
+// How the decode of large images scales from 1 to 4 threads, for images which were written with full flush points and None/Sub filters,
+// and for images which only allow the unfilter to go parallel
+
+namespace {
+
+    constexpr double MinSeconds = 0.5;
+
+    double Now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double MsPerDecode(const std::vector<u8>& png_data, const unsigned threads) {
+        host::ParallelFor parallel_for{threads};
+        u32 decodes = 0;
+        const double start = Now();
+        double elapsed = 0;
+        do {
+            upng_t *upng = upng_new_from_bytes(png_data.data(), png_data.size());
+            if(threads > 1) {
+                parallel_for.attach(upng);
+            }
+            upng_decode(upng);
+            upng_free(upng);
+            decodes++;
+            elapsed = Now() - start;
+        } while(elapsed < MinSeconds);
+        return elapsed * 1e3 / decodes;
+    }
+
+}
+
+int main() {
+    struct {
+        const char *name;
+        u32 size;
+        size_t flush_interval;
+    } cases[] = {
+        { "1024x1024 rgba, flushed", 1024, 65536 },
+        { "2048x2048 rgba, flushed", 2048, 262144 },
+        { "1024x1024 rgba, not flushed", 1024, 0 },
+    };
+    std::printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    std::printf("%-30s %10s %10s %10s %10s\n", "", "1 thread", "2 threads", "3 threads", "4 threads");
+    for(const auto& bench_case: cases) {
+        png::Options options;
+        options.filter = png::Filter::NoneSub;
+        options.flush_interval = bench_case.flush_interval;
+        const auto png_data = png::Encode(png::MakeImage(bench_case.size, bench_case.size, png::RGBA, 8, png::Content::Smooth), options);
+        std::printf("%-30s", bench_case.name);
+        for(unsigned threads = 1; threads <= 4; ++threads) {
+            std::printf(" %7.2f ms", MsPerDecode(png_data, threads));
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <pixel.hpp>
+#include <chrono>
+#include <cstdio>
+
+// Throughput of the expansion of each format to RGBA8888, and of the area-averaging scaler on icon sized images
+
+namespace {
+
+    constexpr u32 Width = 1024;
+    constexpr u32 Rows = 20000;
+
+    double Now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Format {
+        const char *name;
+        upng_format format;
+    };
+
+    constexpr Format Formats[] = {
+        { "rgb8", UPNG_RGB8 },
+        { "rgba8", UPNG_RGBA8 },
+        { "rgb16", UPNG_RGB16 },
+        { "rgba16", UPNG_RGBA16 },
+        { "luminance8", UPNG_LUMINANCE8 },
+        { "luminance_alpha8", UPNG_LUMINANCE_ALPHA8 },
+        { "luminance4", UPNG_LUMINANCE4 },
+        { "luminance1", UPNG_LUMINANCE1 },
+    };
+
+}
+
+int main() {
+    std::vector<u8> src(Width * 8);
+    std::vector<u8> dst(Width * 4);
+    for(size_t i = 0; i != src.size(); ++i) {
+        src[i] = i * 7;
+    }
+    for(const auto& format: Formats) {
+        const double start = Now();
+        for(u32 row = 0; row != Rows; ++row) {
+            pixel::ExpandToRGBA8(format.format, src.data(), dst.data(), Width);
+        }
+        std::printf("expand %-18s %8.0f Mpx/s\n", format.name, (double)Width * Rows / (Now() - start) / 1e6);
+    }
+
+    constexpr u32 Icons = 200;
+    const u32 sizes[][4] = {
+        { 256, 256, 120, 120 },
+        { 1024, 1024, 120, 120 },
+    };
+    for(const auto& size: sizes) {
+        std::vector<u8> rgba(size[0] * 4, 0x77);
+        std::vector<u8> icon(size[2] * size[3] * 4);
+        const double start = Now();
+        for(u32 i = 0; i != Icons; ++i) {
+            pixel::AreaScaler scaler(size[0], size[1], size[2], size[3]);
+            for(u32 y = 0; y != size[1]; ++y) {
+                scaler.PushRow(rgba.data(), icon.data());
+            }
+        }
+        std::printf("scale %ux%u to %ux%u %10.3f ms/icon\n", size[0], size[1], size[2], size[3], (Now() - start) * 1e3 / Icons);
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <emuiibo.hpp>
+#include <string>
+
+namespace emu::mock {
+
+    // Host-side controls of the in-process emuiibo service which replaces emuiibo.cpp
+
+    // Virtual amiibos are read from this directory on the host filesystem, laid out like sdmc:/emuiibo/amiibo
+    void SetVirtualAmiiboDirectory(const std::string& path);
+
+    // process_id 0 means no application is running
+    void SetCurrentApplication(u64 process_id, u64 program_id);
+
+    void SetApplicationIdIntercepted(u64 app_id, bool intercepted);
+
+    // Number of service requests made so far, pm:dmnt and pm:info included
+    size_t GetRequestCount();
+
+}
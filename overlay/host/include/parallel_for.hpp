@@ -0,0 +1,44 @@
+#pragma once
+#include <upng.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// upng_parallel_for for the host tests and benchmarks: the tasks are shared out between up to thread_count threads, the calling one included
+
+namespace host {
+
+    struct ParallelFor {
+        unsigned thread_count;
+        // Calls which had more than one task to run, i.e. decodes which did go parallel
+        std::atomic<unsigned> parallel_calls{0};
+
+        ParallelFor(const unsigned threads) : thread_count{threads} {}
+
+        static void Run(void *user, unsigned count, upng_task task, void *task_user) {
+            auto& self = *static_cast<ParallelFor*>(user);
+            if(count > 1) {
+                self.parallel_calls++;
+            }
+            std::atomic<unsigned> next{0};
+            const auto work = [&] {
+                for(unsigned index = next++; index < count; index = next++) {
+                    task(task_user, index);
+                }
+            };
+            std::vector<std::thread> threads;
+            for(unsigned i = 1; i < self.thread_count && i < count; ++i) {
+                threads.emplace_back(work);
+            }
+            work();
+            for(auto& thread: threads) {
+                thread.join();
+            }
+        }
+
+        void attach(upng_t *upng) {
+            upng_set_parallel(upng, &ParallelFor::Run, this);
+        }
+    };
+
+}
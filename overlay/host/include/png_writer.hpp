@@ -0,0 +1,350 @@
+#pragma once
+#include <switch.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// Minimal PNG encoder for the host tests and benchmarks, covering what upng has to decode: every color type and bit depth it supports,
+// each filter type, Adam7 interlacing, image data split over several IDAT chunks and deflate streams with full flush points
+// zlib does the compression, so that upng is checked against the streams real encoders write
+
+namespace png {
+
+    enum ColorType : u8 {
+        Grey = 0,
+        RGB = 2,
+        GreyAlpha = 4,
+        RGBA = 6,
+    };
+
+    // height scanlines of stride() bytes, packed as they are in a PNG, with the unused trailing bits of a row zero
+    struct Image {
+        u32 width{0};
+        u32 height{0};
+        ColorType color_type{RGBA};
+        u8 bit_depth{8};
+        std::vector<u8> pixels;
+
+        u32 channels() const {
+            switch(color_type) {
+                case Grey: {
+                    return 1;
+                }
+                case GreyAlpha: {
+                    return 2;
+                }
+                case RGB: {
+                    return 3;
+                }
+                default: {
+                    return 4;
+                }
+            }
+        }
+
+        u32 bpp() const {
+            return channels() * bit_depth;
+        }
+
+        size_t stride() const {
+            return ((size_t)width * bpp() + 7) / 8;
+        }
+
+        u8* row(const u32 y) {
+            return pixels.data() + y * stride();
+        }
+
+        const u8* row(const u32 y) const {
+            return pixels.data() + y * stride();
+        }
+    };
+
+    enum class Filter {
+        None = 0,
+        Sub = 1,
+        Up = 2,
+        Average = 3,
+        Paeth = 4,
+        // Every type in turn, one per scanline
+        Cycle,
+        // The types which do not depend on the scanline above
+        NoneSub,
+    };
+
+    struct Options {
+        Filter filter{Filter::Cycle};
+        bool interlace{false};
+        int level{Z_DEFAULT_COMPRESSION};
+        int strategy{Z_DEFAULT_STRATEGY};
+        // Largest IDAT chunk, 0 for a single one
+        size_t idat_size{0};
+        // A full flush every this many bytes of filtered data, 0 for none
+        size_t flush_interval{0};
+    };
+
+    // Gradients with some noise, roughly as compressible as artwork; noise alone barely compresses, which stresses the literal codes
+    enum class Content {
+        Smooth,
+        Noise,
+    };
+
+    namespace impl {
+
+        constexpr u32 Adam7StartX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+        constexpr u32 Adam7StartY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+        constexpr u32 Adam7StepX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+        constexpr u32 Adam7StepY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+        inline u32 GetBits(const u8 *data, const size_t bit, const u32 count) {
+            u32 value = 0;
+            for(u32 i = 0; i != count; ++i) {
+                value = (value << 1) | ((data[(bit + i) / 8] >> (7 - (bit + i) % 8)) & 1);
+            }
+            return value;
+        }
+
+        inline void SetBits(u8 *data, const size_t bit, const u32 count, const u32 value) {
+            for(u32 i = 0; i != count; ++i) {
+                const u8 mask = 0x80 >> ((bit + i) % 8);
+                if((value >> (count - 1 - i)) & 1) {
+                    data[(bit + i) / 8] |= mask;
+                }
+                else {
+                    data[(bit + i) / 8] &= ~mask;
+                }
+            }
+        }
+
+        inline u8 Paeth(const int a, const int b, const int c) {
+            const int p = a + b - c;
+            const int pa = std::abs(p - a);
+            const int pb = std::abs(p - b);
+            const int pc = std::abs(p - c);
+            if((pa <= pb) && (pa <= pc)) {
+                return a;
+            }
+            return (pb <= pc) ? b : c;
+        }
+
+        inline Filter RowFilter(const Filter filter, const u32 y, std::mt19937& rng) {
+            switch(filter) {
+                case Filter::Cycle: {
+                    return static_cast<Filter>(y % 5);
+                }
+                case Filter::NoneSub: {
+                    return static_cast<Filter>(rng() % 2);
+                }
+                default: {
+                    return filter;
+                }
+            }
+        }
+
+        // Appends the filter type byte and the filtered scanlines of image to out, prior being reset at the start of it
+        inline void FilterImage(const Image& image, const Filter filter, std::vector<u8>& out) {
+            const size_t stride = image.stride();
+            const size_t bytewidth = std::max<size_t>(1, image.bpp() / 8);
+            std::mt19937 rng(image.width * 31 + image.height);
+            std::vector<u8> zero(stride, 0);
+            for(u32 y = 0; y != image.height; ++y) {
+                const u8 *cur = image.row(y);
+                const u8 *prev = (y == 0) ? zero.data() : image.row(y - 1);
+                const auto type = RowFilter(filter, y, rng);
+                out.push_back(static_cast<u8>(type));
+                for(size_t i = 0; i != stride; ++i) {
+                    const int a = (i >= bytewidth) ? cur[i - bytewidth] : 0;
+                    const int b = prev[i];
+                    const int c = (i >= bytewidth) ? prev[i - bytewidth] : 0;
+                    int predicted = 0;
+                    switch(type) {
+                        case Filter::Sub: {
+                            predicted = a;
+                            break;
+                        }
+                        case Filter::Up: {
+                            predicted = b;
+                            break;
+                        }
+                        case Filter::Average: {
+                            predicted = (a + b) / 2;
+                            break;
+                        }
+                        case Filter::Paeth: {
+                            predicted = Paeth(a, b, c);
+                            break;
+                        }
+                        default: {
+                            break;
+                        }
+                    }
+                    out.push_back(static_cast<u8>(cur[i] - predicted));
+                }
+            }
+        }
+
+        // The pixels of an Adam7 pass, as an image of its own
+        inline Image Adam7Pass(const Image& image, const u32 pass) {
+            Image sub;
+            sub.color_type = image.color_type;
+            sub.bit_depth = image.bit_depth;
+            sub.width = (image.width > Adam7StartX[pass]) ? (image.width - Adam7StartX[pass] + Adam7StepX[pass] - 1) / Adam7StepX[pass] : 0;
+            sub.height = (image.height > Adam7StartY[pass]) ? (image.height - Adam7StartY[pass] + Adam7StepY[pass] - 1) / Adam7StepY[pass] : 0;
+            sub.pixels.assign(sub.stride() * sub.height, 0);
+            const u32 bpp = image.bpp();
+            for(u32 y = 0; y != sub.height; ++y) {
+                for(u32 x = 0; x != sub.width; ++x) {
+                    const u32 src_x = Adam7StartX[pass] + x * Adam7StepX[pass];
+                    const u32 src_y = Adam7StartY[pass] + y * Adam7StepY[pass];
+                    for(u32 bit = 0; bit < bpp; bit += 8) {
+                        const u32 count = std::min<u32>(8, bpp - bit);
+                        SetBits(sub.row(y), (size_t)x * bpp + bit, count, GetBits(image.row(src_y), (size_t)src_x * bpp + bit, count));
+                    }
+                }
+            }
+            return sub;
+        }
+
+        inline void PutU32(std::vector<u8>& out, const u32 value) {
+            out.push_back(value >> 24);
+            out.push_back(value >> 16);
+            out.push_back(value >> 8);
+            out.push_back(value);
+        }
+
+        inline void PutChunk(std::vector<u8>& out, const char *type, const u8 *data, const size_t size) {
+            PutU32(out, size);
+            const size_t type_offset = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data, data + size);
+            PutU32(out, crc32(0, out.data() + type_offset, size + 4));
+        }
+
+        inline std::vector<u8> Compress(const std::vector<u8>& data, const Options& options) {
+            z_stream stream = {};
+            deflateInit2(&stream, options.level, Z_DEFLATED, 15, 8, options.strategy);
+            std::vector<u8> out(deflateBound(&stream, data.size()) + 64 + (options.flush_interval ? data.size() / options.flush_interval * 8 : 0));
+            stream.next_out = out.data();
+            stream.avail_out = out.size();
+            const size_t step = options.flush_interval ? options.flush_interval : data.size();
+            size_t offset = 0;
+            do {
+                const size_t size = std::min(step, data.size() - offset);
+                stream.next_in = const_cast<u8*>(data.data() + offset);
+                stream.avail_in = size;
+                offset += size;
+                deflate(&stream, (offset == data.size()) ? Z_FINISH : Z_FULL_FLUSH);
+            } while(offset != data.size());
+            out.resize(stream.total_out);
+            deflateEnd(&stream);
+            return out;
+        }
+
+    }
+
+    inline std::vector<u8> Encode(const Image& image, const Options& options = {}) {
+        std::vector<u8> filtered;
+        if(options.interlace) {
+            for(u32 pass = 0; pass != 7; ++pass) {
+                const auto sub = impl::Adam7Pass(image, pass);
+                if((sub.width != 0) && (sub.height != 0)) {
+                    impl::FilterImage(sub, options.filter, filtered);
+                }
+            }
+        }
+        else {
+            impl::FilterImage(image, options.filter, filtered);
+        }
+        const auto compressed = impl::Compress(filtered, options);
+
+        static const u8 Signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        std::vector<u8> png(Signature, Signature + 8);
+        std::vector<u8> ihdr;
+        impl::PutU32(ihdr, image.width);
+        impl::PutU32(ihdr, image.height);
+        ihdr.push_back(image.bit_depth);
+        ihdr.push_back(image.color_type);
+        ihdr.push_back(0);
+        ihdr.push_back(0);
+        ihdr.push_back(options.interlace ? 1 : 0);
+        impl::PutChunk(png, "IHDR", ihdr.data(), ihdr.size());
+        const size_t idat_size = options.idat_size ? options.idat_size : compressed.size();
+        for(size_t offset = 0; offset < compressed.size(); offset += idat_size) {
+            impl::PutChunk(png, "IDAT", compressed.data() + offset, std::min(idat_size, compressed.size() - offset));
+        }
+        impl::PutChunk(png, "IEND", nullptr, 0);
+        return png;
+    }
+
+    inline Image MakeImage(const u32 width, const u32 height, const ColorType color_type, const u8 bit_depth, const Content content, const u32 seed = 1) {
+        Image image;
+        image.width = width;
+        image.height = height;
+        image.color_type = color_type;
+        image.bit_depth = bit_depth;
+        image.pixels.assign(image.stride() * height, 0);
+        std::mt19937 rng(seed);
+        const u32 max_value = (bit_depth == 16) ? 0xFFFF : (1u << bit_depth) - 1;
+        for(u32 y = 0; y != height; ++y) {
+            for(u32 x = 0; x != width; ++x) {
+                for(u32 c = 0; c != image.channels(); ++c) {
+                    u32 value = rng() & max_value;
+                    if(content == Content::Smooth) {
+                        const u32 gradient = ((x * (c + 1) + y * (3 - c % 3)) * max_value) / (width + height) / 2;
+                        value = std::min<u32>(max_value, gradient + (value & (max_value >> 5)));
+                    }
+                    impl::SetBits(image.row(y), ((size_t)x * image.channels() + c) * bit_depth, bit_depth, value);
+                }
+            }
+        }
+        return image;
+    }
+
+    // The scanlines back to back, without the padding bits which end each of them: how upng_decode lays out images of less than 8 bits per pixel
+    inline std::vector<u8> PackRows(const Image& image) {
+        const size_t row_bits = (size_t)image.width * image.bpp();
+        std::vector<u8> out((row_bits * image.height + 7) / 8, 0);
+        for(u32 y = 0; y != image.height; ++y) {
+            for(size_t bit = 0; bit < row_bits; bit += 8) {
+                const u32 count = std::min<size_t>(8, row_bits - bit);
+                impl::SetBits(out.data(), y * row_bits + bit, count, impl::GetBits(image.row(y), bit, count));
+            }
+        }
+        return out;
+    }
+
+    // Compares the first bit_count bits of both buffers, whatever the bits after them
+    inline bool SameBits(const u8 *a, const u8 *b, const size_t bit_count) {
+        if(std::memcmp(a, b, bit_count / 8) != 0) {
+            return false;
+        }
+        const u32 rest = bit_count % 8;
+        return (rest == 0) || (((a[bit_count / 8] ^ b[bit_count / 8]) >> (8 - rest)) == 0);
+    }
+
+    // Offset of the index-th chunk of the given type, 0 if there is none
+    inline size_t FindChunk(const std::vector<u8>& png, const char *type, const u32 index = 0) {
+        u32 found = 0;
+        for(size_t offset = 8; offset + 12 <= png.size();) {
+            const u32 length = (png[offset] << 24) | (png[offset + 1] << 16) | (png[offset + 2] << 8) | png[offset + 3];
+            if(std::memcmp(png.data() + offset + 4, type, 4) == 0 && found++ == index) {
+                return offset;
+            }
+            offset += (size_t)length + 12;
+        }
+        return 0;
+    }
+
+    // Recomputes the CRC of the chunk at offset, after its data was modified
+    inline void FixChunkCrc(std::vector<u8>& png, const size_t offset) {
+        const u32 length = (png[offset] << 24) | (png[offset + 1] << 16) | (png[offset + 2] << 8) | png[offset + 3];
+        const u32 crc = crc32(0, png.data() + offset + 4, length + 4);
+        for(u32 i = 0; i != 4; ++i) {
+            png[offset + 8 + length + i] = crc >> (24 - 8 * i);
+        }
+    }
+
+}
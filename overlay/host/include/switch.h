@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The few libnx definitions the overlay core uses, for host builds
+// Services are provided by source/emuiibo_mock.cpp
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef u32 Result;
+typedef u32 Handle;
+
+#define INVALID_HANDLE ((Handle)0)
+
+#define R_SUCCEEDED(res) ((res) == 0)
+#define R_FAILED(res) ((res) != 0)
+#define MAKERESULT(module, description) ((((module) & 0x1FF)) | ((description) & 0x1FFF) << 9)
+
+#define FS_MAX_PATH 0x301
+
+// Only the size matters to the core, the fields are never read
+typedef struct {
+    u8 raw[0x58];
+} MiiCharInfo;
+
+// Host stand-in for a kernel event, signalled by the mock service
+typedef struct {
+    u64 last_signal;
+    bool autoclear;
+} Event;
+
+Result eventWait(Event *event, u64 timeout);
+void eventClose(Event *event);
+
+Result pmdmntInitialize();
+void pmdmntExit();
+Result pmdmntGetApplicationProcessId(u64 *out_pid);
+
+Result pminfoInitialize();
+void pminfoExit();
+Result pminfoGetProgramId(u64 *program_id_out, u64 pid);
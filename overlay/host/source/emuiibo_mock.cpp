@@ -0,0 +1,390 @@
+#include <emuiibo_mock.hpp>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+
+// In-process stand-in for the emuiibo sysmodule (and the pm services), so the overlay core runs on the host
+// Virtual amiibos are read from a regular directory tree, everything else lives in memory
+
+namespace emu {
+
+    namespace {
+
+        constexpr Result ResultInvalidVirtualAmiibo = MAKERESULT(352, 1);
+        constexpr Result ResultNoApplication = MAKERESULT(352, 2);
+
+        std::mutex g_lock;
+        std::string g_virtual_amiibo_dir = "emuiibo/amiibo";
+        EmulationStatus g_emulation_status = EmulationStatus::Off;
+        VirtualAmiiboStatus g_active_virtual_amiibo_status = VirtualAmiiboStatus::Invalid;
+        VirtualAmiiboData g_active_virtual_amiibo_data = {};
+        std::string g_active_virtual_amiibo_path;
+        u32 g_active_virtual_amiibo_generation = 0;
+        std::set<u64> g_intercepted_app_ids;
+        u64 g_current_process_id = 0;
+        u64 g_current_program_id = 0;
+        u64 g_state_changes = 0;
+        size_t g_request_count = 0;
+
+        // Like the sysmodule's session, keeps the directory open between the pages of a listing
+        struct DirectoryListing {
+            std::string path;
+            std::filesystem::directory_iterator it;
+            u32 next_cursor;
+        };
+
+        std::optional<DirectoryListing> g_listing;
+
+        void CountRequest() {
+            g_request_count++;
+        }
+
+        void NotifyStateChanged() {
+            g_state_changes++;
+        }
+
+        void CopyString(const std::string& str, char *out, size_t out_size) {
+            if(out_size == 0) {
+                return;
+            }
+            const auto size = std::min(str.size(), out_size - 1);
+            str.copy(out, size);
+            out[size] = '\0';
+        }
+
+        // Good enough for amiibo.json files: the value of the first "name" key
+        std::string ReadJsonName(const std::string& json) {
+            const auto key = json.find("\"name\"");
+            if(key == std::string::npos) {
+                return {};
+            }
+            const auto start = json.find('"', json.find(':', key));
+            if(start == std::string::npos) {
+                return {};
+            }
+            const auto end = json.find('"', start + 1);
+            if(end == std::string::npos) {
+                return {};
+            }
+            return json.substr(start + 1, end - start - 1);
+        }
+
+        bool ParseVirtualAmiibo(const std::filesystem::path& path, VirtualAmiiboData& out_data) {
+            std::error_code ec;
+            if(!std::filesystem::exists(path / "amiibo.flag", ec) || !std::filesystem::exists(path / "amiibo.json", ec)) {
+                return false;
+            }
+            std::ifstream file(path / "amiibo.json");
+            std::stringstream json;
+            json << file.rdbuf();
+            const auto name = ReadJsonName(json.str());
+            if(name.empty()) {
+                return false;
+            }
+            out_data = {};
+            out_data.uuid.random_uuid = true;
+            CopyString(name, out_data.name, sizeof(out_data.name));
+            return true;
+        }
+
+    }
+
+    namespace mock {
+
+        void SetVirtualAmiiboDirectory(const std::string& path) {
+            std::lock_guard<std::mutex> lock(g_lock);
+            g_virtual_amiibo_dir = path;
+        }
+
+        void SetCurrentApplication(u64 process_id, u64 program_id) {
+            std::lock_guard<std::mutex> lock(g_lock);
+            g_current_process_id = process_id;
+            g_current_program_id = program_id;
+        }
+
+        void SetApplicationIdIntercepted(u64 app_id, bool intercepted) {
+            std::lock_guard<std::mutex> lock(g_lock);
+            if(intercepted) {
+                g_intercepted_app_ids.insert(app_id);
+            }
+            else {
+                g_intercepted_app_ids.erase(app_id);
+            }
+            NotifyStateChanged();
+        }
+
+        size_t GetRequestCount() {
+            std::lock_guard<std::mutex> lock(g_lock);
+            return g_request_count;
+        }
+
+    }
+
+    bool IsAvailable() {
+        return true;
+    }
+
+    Result Initialize() {
+        return 0;
+    }
+
+    void Exit() {
+    }
+
+    Version GetVersion() {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        return { 0, 6, 1, true };
+    }
+
+    void GetVirtualAmiiboDirectory(char *out_path, size_t out_path_size) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        CopyString(g_virtual_amiibo_dir, out_path, out_path_size);
+    }
+
+    EmulationStatus GetEmulationStatus() {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        return g_emulation_status;
+    }
+
+    void SetEmulationStatus(EmulationStatus status) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        g_emulation_status = status;
+        NotifyStateChanged();
+    }
+
+    Result GetActiveVirtualAmiibo(VirtualAmiiboData *out_amiibo_data, char *out_path, size_t out_path_size) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        if(g_active_virtual_amiibo_path.empty()) {
+            return ResultInvalidVirtualAmiibo;
+        }
+        *out_amiibo_data = g_active_virtual_amiibo_data;
+        CopyString(g_active_virtual_amiibo_path, out_path, out_path_size);
+        return 0;
+    }
+
+    Result SetActiveVirtualAmiibo(char *path, size_t path_size) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        const std::string path_str(path, strnlen(path, path_size));
+        VirtualAmiiboData data = {};
+        if(!ParseVirtualAmiibo(path_str, data)) {
+            return ResultInvalidVirtualAmiibo;
+        }
+        g_active_virtual_amiibo_data = data;
+        g_active_virtual_amiibo_path = path_str;
+        g_active_virtual_amiibo_status = VirtualAmiiboStatus::Connected;
+        g_active_virtual_amiibo_generation++;
+        NotifyStateChanged();
+        return 0;
+    }
+
+    void ResetActiveVirtualAmiibo() {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        g_active_virtual_amiibo_data = {};
+        g_active_virtual_amiibo_path.clear();
+        g_active_virtual_amiibo_status = VirtualAmiiboStatus::Connected;
+        g_active_virtual_amiibo_generation++;
+        NotifyStateChanged();
+    }
+
+    VirtualAmiiboStatus GetActiveVirtualAmiiboStatus() {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        return g_active_virtual_amiibo_status;
+    }
+
+    void SetActiveVirtualAmiiboStatus(VirtualAmiiboStatus status) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        g_active_virtual_amiibo_status = status;
+        NotifyStateChanged();
+    }
+
+    Result IsApplicationIdIntercepted(u64 app_id, bool *out_intercepted) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        *out_intercepted = g_intercepted_app_ids.count(app_id) != 0;
+        return 0;
+    }
+
+    // pm lookups cost nothing here, so there is nothing to cache
+    u64 GetCurrentApplicationId() {
+        u64 process_id = 0;
+        u64 program_id = 0;
+        if(R_SUCCEEDED(pmdmntGetApplicationProcessId(&process_id))) {
+            pminfoGetProgramId(&program_id, process_id);
+        }
+        return program_id;
+    }
+
+    bool IsCurrentApplicationIdIntercepted() {
+        bool intercepted = false;
+        const auto program_id = GetCurrentApplicationId();
+        if(program_id != 0) {
+            if(R_FAILED(IsApplicationIdIntercepted(program_id, &intercepted))) {
+                return false;
+            }
+        }
+        return intercepted;
+    }
+
+    void InvalidateInterceptedApplicationCache() {
+    }
+
+    Result TryParseVirtualAmiibo(char *path, size_t path_size, VirtualAmiiboData *out_amiibo_data) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        if(!ParseVirtualAmiibo(std::string(path, strnlen(path, path_size)), *out_amiibo_data)) {
+            return ResultInvalidVirtualAmiibo;
+        }
+        return 0;
+    }
+
+    Result ListVirtualAmiiboDirectory(char *path, size_t path_size, u32 cursor, VirtualAmiiboListEntry *out_entries, size_t out_entry_count, VirtualAmiiboListPage *out_page) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        *out_page = {};
+        if(out_entry_count == 0) {
+            return 0;
+        }
+        const std::string path_str(path, strnlen(path, path_size));
+        std::error_code ec;
+        auto listing = std::move(g_listing);
+        g_listing.reset();
+        if(!listing || (cursor == 0) || (listing->next_cursor != cursor) || (listing->path != path_str)) {
+            listing = DirectoryListing{ path_str, std::filesystem::directory_iterator(path_str, ec), 0 };
+            if(ec) {
+                return ResultInvalidVirtualAmiibo;
+            }
+        }
+        auto& it = listing->it;
+        for(; it != std::filesystem::directory_iterator(); it.increment(ec)) {
+            if(ec) {
+                return ResultInvalidVirtualAmiibo;
+            }
+            if(!it->is_directory(ec)) {
+                continue;
+            }
+            // Only reached by a listing which is not resumed
+            if(listing->next_cursor < cursor) {
+                listing->next_cursor++;
+                continue;
+            }
+            if(out_page->entry_count == out_entry_count) {
+                out_page->next_cursor = listing->next_cursor;
+                g_listing = std::move(listing);
+                return 0;
+            }
+            auto& entry = out_entries[out_page->entry_count];
+            entry = {};
+            CopyString(it->path().filename().string(), entry.name, sizeof(entry.name));
+            VirtualAmiiboData data = {};
+            if(ParseVirtualAmiibo(it->path(), data)) {
+                entry.kind = VirtualAmiiboListEntryKind::Amiibo;
+                entry.data.uuid = data.uuid;
+                std::memcpy(entry.data.name, data.name, sizeof(entry.data.name));
+                entry.data.first_write_date = data.first_write_date;
+                entry.data.last_write_date = data.last_write_date;
+            }
+            else {
+                entry.kind = VirtualAmiiboListEntryKind::Folder;
+            }
+            out_page->entry_count++;
+            listing->next_cursor++;
+        }
+        return 0;
+    }
+
+    Result GetStatusSnapshot(u64 app_id, StatusSnapshot *out_snapshot) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        out_snapshot->emulation_status = g_emulation_status;
+        out_snapshot->active_virtual_amiibo_status = g_active_virtual_amiibo_status;
+        out_snapshot->active_virtual_amiibo_generation = g_active_virtual_amiibo_generation;
+        out_snapshot->is_application_id_intercepted = g_intercepted_app_ids.count(app_id) != 0;
+        return 0;
+    }
+
+    Result AttachStateChangeEvent(Event *out_event) {
+        std::lock_guard<std::mutex> lock(g_lock);
+        CountRequest();
+        out_event->last_signal = g_state_changes;
+        out_event->autoclear = true;
+        return 0;
+    }
+
+    // Nothing to time in-process
+    const char *GetCommandName(u32 command_id) {
+        return "Mock";
+    }
+
+    std::vector<CommandStats> GetCommandStats() {
+        return {};
+    }
+
+    void ResetCommandStats() {
+    }
+
+    bool DumpCommandStats(const char *path) {
+        return false;
+    }
+
+}
+
+Result eventWait(Event *event, u64 timeout) {
+    std::lock_guard<std::mutex> lock(emu::g_lock);
+    if(event->last_signal == emu::g_state_changes) {
+        return MAKERESULT(1, 117); // KernelError_TimedOut, there is nobody else to signal it while waiting
+    }
+    if(event->autoclear) {
+        event->last_signal = emu::g_state_changes;
+    }
+    return 0;
+}
+
+void eventClose(Event *event) {
+    *event = {};
+}
+
+Result pmdmntInitialize() {
+    return 0;
+}
+
+void pmdmntExit() {
+}
+
+Result pmdmntGetApplicationProcessId(u64 *out_pid) {
+    std::lock_guard<std::mutex> lock(emu::g_lock);
+    emu::CountRequest();
+    if(emu::g_current_process_id == 0) {
+        return emu::ResultNoApplication;
+    }
+    *out_pid = emu::g_current_process_id;
+    return 0;
+}
+
+Result pminfoInitialize() {
+    return 0;
+}
+
+void pminfoExit() {
+}
+
+Result pminfoGetProgramId(u64 *program_id_out, u64 pid) {
+    std::lock_guard<std::mutex> lock(emu::g_lock);
+    emu::CountRequest();
+    if((pid == 0) || (pid != emu::g_current_process_id)) {
+        return emu::ResultNoApplication;
+    }
+    *program_id_out = emu::g_current_program_id;
+    return 0;
+}
@@ -0,0 +1,17 @@
+#include <platform.hpp>
+#include <mutex>
+
+namespace platform {
+
+    // The host filesystem needs no mounting, but the core still expects calls from different threads to be serialised
+    void DoWithSDCard(const std::function<void()>& fn) {
+        static std::mutex sd_card_mutex;
+        std::lock_guard<std::mutex> lock(sd_card_mutex);
+        fn();
+    }
+
+    void DoWithSmSession(const std::function<void()>& fn) {
+        fn();
+    }
+
+}
@@ -0,0 +1,265 @@
+#include "test.hpp"
+#include <favorites.hpp>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <unistd.h>
+
+// FavoritesStore as a set: lookups right after erasing from clusters which wrap around the end of the table
+// As a journal: what a store writes is what the next one loads, however the journal was cut short, and it is only rewritten past the compaction threshold
+
+namespace {
+
+    const std::filesystem::path BasePath = "/amiibo";
+
+    // The hash FavoritesStore uses for its slots
+    u64 HashPath(const std::string& path) {
+        u64 hash = 0xCBF29CE484222325;
+        for (const char c: path) {
+            hash = (hash ^ static_cast<u8>(c)) * 0x100000001B3;
+        }
+        return hash;
+    }
+
+    // count paths whose home is slot home of the smallest table (16 slots)
+    std::vector<std::string> PathsWithHome(const size_t home, const size_t count, const char *prefix) {
+        std::vector<std::string> paths;
+        for (u32 i = 0; paths.size() != count; ++i) {
+            const auto path = (BasePath / (prefix + std::to_string(i))).string();
+            if ((HashPath(path) & 15) == home) {
+                paths.push_back(path);
+            }
+        }
+        return paths;
+    }
+
+    class TempDir {
+        public:
+            std::filesystem::path path;
+
+            TempDir() : path{std::filesystem::temp_directory_path() / ("emuiibo-favorites-test-" + std::to_string(getpid()))} {
+                std::filesystem::remove_all(path);
+                std::filesystem::create_directories(path);
+            }
+
+            ~TempDir() {
+                std::filesystem::remove_all(path);
+            }
+    };
+
+    std::vector<u8> ReadFile(const std::filesystem::path& path) {
+        std::ifstream file(path, std::ifstream::binary);
+        return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void WriteFile(const std::filesystem::path& path, const std::vector<u8>& data) {
+        std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    }
+
+    std::vector<std::filesystem::path> Sorted(const std::set<std::string>& paths) {
+        return std::vector<std::filesystem::path>(paths.begin(), paths.end());
+    }
+
+    FavoritesStore Load(const TempDir& dir) {
+        FavoritesStore store;
+        store.load(BasePath, dir.path / "favorites.bin", dir.path / "favorites.txt");
+        return store;
+    }
+
+    // Seven paths (the most the 16 slot table holds before growing) crowded around its last slot, so that every cluster wraps
+    // Every order of inserting them is erased in every rotation, the rest has to stay reachable after each erase
+    void TestWrappedClusterErase() {
+        std::vector<std::string> paths;
+        for (const auto& [home, count]: { std::pair<size_t, size_t>{ 14, 2 }, { 15, 3 }, { 0, 1 }, { 1, 1 } }) {
+            const auto home_paths = PathsWithHome(home, count, ("h" + std::to_string(home) + "-").c_str());
+            paths.insert(paths.end(), home_paths.begin(), home_paths.end());
+        }
+        std::sort(paths.begin(), paths.end());
+        size_t orders = 0;
+        do {
+            for (size_t rotation = 0; rotation != paths.size(); ++rotation) {
+                FavoritesStore store;
+                for (const auto& path: paths) {
+                    TEST_CHECK(store.add(path));
+                }
+                std::set<std::string> expected(paths.begin(), paths.end());
+                for (size_t i = 0; i != paths.size(); ++i) {
+                    const auto& erased = paths[(rotation + i) % paths.size()];
+                    TEST_CHECK(store.remove(erased));
+                    TEST_CHECK(!store.remove(erased));
+                    expected.erase(erased);
+                    for (const auto& path: paths) {
+                        TEST_CHECK_MSG(store.contains(path) == (expected.count(path) != 0), "order %zu, rotation %zu, %zu erased: %s", orders, rotation, i + 1, path.c_str());
+                    }
+                    TEST_CHECK(store.size() == expected.size());
+                }
+            }
+            orders++;
+        } while (std::next_permutation(paths.begin(), paths.end()) && !test::g_failures);
+    }
+
+    // Random adds and removes across table growths, against std::set
+    void TestRandomOperations() {
+        std::mt19937 rng(1234);
+        FavoritesStore store;
+        std::set<std::string> expected;
+        for (u32 i = 0; i != 20000; ++i) {
+            const auto path = (BasePath / ("r" + std::to_string(rng() % 300))).string();
+            if (rng() % 3 != 0) {
+                TEST_CHECK(store.add(path) == expected.insert(path).second);
+            }
+            else {
+                TEST_CHECK(store.remove(path) == (expected.erase(path) != 0));
+            }
+        }
+        TEST_CHECK(store.size() == expected.size());
+        TEST_CHECK(store.getAll() == Sorted(expected));
+        for (u32 i = 0; i != 300; ++i) {
+            const auto path = (BasePath / ("r" + std::to_string(i))).string();
+            TEST_CHECK(store.contains(path) == (expected.count(path) != 0));
+        }
+    }
+
+    // Changes flushed one at a time, some of them undone, are what the next load replays
+    void TestJournalReplay() {
+        const TempDir dir;
+        std::set<std::string> expected;
+        {
+            auto store = Load(dir);
+            TEST_CHECK(store.size() == 0);
+            for (u32 i = 0; i != 40; ++i) {
+                const auto path = (BasePath / "series" / ("amiibo" + std::to_string(i))).string();
+                TEST_CHECK(store.add(path));
+                expected.insert(path);
+                TEST_CHECK(store.flush(dir.path / "favorites.bin"));
+            }
+            for (u32 i = 0; i < 40; i += 3) {
+                const auto path = (BasePath / "series" / ("amiibo" + std::to_string(i))).string();
+                TEST_CHECK(store.remove(path));
+                expected.erase(path);
+            }
+            // Added back, after it was removed in the same flush
+            TEST_CHECK(store.add(BasePath / "series" / "amiibo3"));
+            expected.insert((BasePath / "series" / "amiibo3").string());
+            TEST_CHECK(!store.add(BasePath / "series" / "amiibo4"));
+            TEST_CHECK(store.isDirty());
+            TEST_CHECK(store.flush(dir.path / "favorites.bin"));
+            TEST_CHECK(!store.isDirty());
+        }
+        const auto store = Load(dir);
+        TEST_CHECK(!store.isDirty());
+        TEST_CHECK(store.getAll() == Sorted(expected));
+    }
+
+    // An append cut short anywhere in its last record loses that record only, and the next flush rewrites the journal whole
+    void TestTruncatedRecord() {
+        const TempDir dir;
+        const auto journal_path = dir.path / "favorites.bin";
+        const auto first = BasePath / "first";
+        const auto last = BasePath / "last-amiibo";
+        {
+            auto store = Load(dir);
+            store.add(first);
+            TEST_CHECK(store.flush(journal_path));
+            store.add(last);
+            TEST_CHECK(store.flush(journal_path));
+        }
+        const auto journal = ReadFile(journal_path);
+        const size_t last_record_size = 3 + std::string{"last-amiibo"}.size();
+        for (size_t cut = 1; cut != last_record_size; ++cut) {
+            WriteFile(journal_path, std::vector<u8>(journal.begin(), journal.end() - cut));
+            auto store = Load(dir);
+            TEST_CHECK_MSG(store.contains(first) && !store.contains(last) && (store.size() == 1), "%zu bytes cut", cut);
+            TEST_CHECK_MSG(store.isDirty(), "%zu bytes cut", cut);
+
+            // Appending after the partial record would make it swallow the first bytes of the new one
+            store.add(BasePath / "new");
+            TEST_CHECK(store.flush(journal_path));
+            const auto reloaded = Load(dir);
+            TEST_CHECK_MSG(!reloaded.isDirty(), "%zu bytes cut", cut);
+            TEST_CHECK_MSG(reloaded.getAll() == (std::vector<std::filesystem::path>{ first, BasePath / "new" }), "%zu bytes cut", cut);
+        }
+
+        // A journal cut inside its header is not a journal at all
+        WriteFile(journal_path, std::vector<u8>(journal.begin(), journal.begin() + 5));
+        TEST_CHECK(Load(dir).size() == 0);
+    }
+
+    // Records are appended until they outnumber twice the favorites by more than the slack (32), then the journal shrinks back to one record per favorite
+    void TestCompaction() {
+        const TempDir dir;
+        const auto journal_path = dir.path / "favorites.bin";
+        // Every relative path is two characters long, so every record takes 5 bytes after the 8 byte header
+        const auto JournalSize = [](const size_t records) { return 8 + records * 5; };
+        auto store = Load(dir);
+        store.add(BasePath / "a0");
+        TEST_CHECK(store.flush(journal_path));
+        TEST_CHECK(std::filesystem::file_size(journal_path) == JournalSize(1));
+
+        size_t journal_records = 1;
+        size_t compactions = 0;
+        for (u32 i = 0; i != 200; ++i) {
+            if (i % 2 == 0) {
+                TEST_CHECK(store.add(BasePath / "b0"));
+            }
+            else {
+                TEST_CHECK(store.remove(BasePath / "b0"));
+            }
+            const size_t count = store.size();
+            if (journal_records + 1 > 2 * count + 32) {
+                journal_records = count;
+                compactions++;
+            }
+            else {
+                journal_records++;
+            }
+            TEST_CHECK(store.flush(journal_path));
+            TEST_CHECK_MSG(std::filesystem::file_size(journal_path) == JournalSize(journal_records), "change %u: %zu bytes, %zu records expected", i, (size_t)std::filesystem::file_size(journal_path), journal_records);
+        }
+        TEST_CHECK(compactions > 1);
+
+        // Nothing changed, nothing written
+        const auto size = std::filesystem::file_size(journal_path);
+        TEST_CHECK(store.flush(journal_path));
+        TEST_CHECK(std::filesystem::file_size(journal_path) == size);
+        TEST_CHECK(Load(dir).getAll() == store.getAll());
+    }
+
+    // favorites.txt is only read while there is no journal, and the first flush writes its contents to one
+    void TestLegacyImport() {
+        const TempDir dir;
+        {
+            std::ofstream legacy_file(dir.path / "favorites.txt");
+            legacy_file << "mario/amiibo\n\nlink\nmario/amiibo\nseries/zelda/wolf link\n";
+        }
+        const std::vector<std::filesystem::path> expected = { BasePath / "link", BasePath / "mario/amiibo", BasePath / "series/zelda/wolf link" };
+        auto store = Load(dir);
+        TEST_CHECK(store.getAll() == expected);
+        TEST_CHECK(store.isDirty());
+        TEST_CHECK(store.flush(dir.path / "favorites.bin"));
+
+        // The old file is left alone, but the journal is what counts from now on
+        {
+            std::ofstream legacy_file(dir.path / "favorites.txt", std::ofstream::app);
+            legacy_file << "added/later\n";
+        }
+        const auto imported = Load(dir);
+        TEST_CHECK(!imported.isDirty());
+        TEST_CHECK(imported.getAll() == expected);
+
+        std::filesystem::remove(dir.path / "favorites.bin");
+        TEST_CHECK(Load(dir).size() == expected.size() + 1);
+    }
+
+}
+
+int main() {
+    TestWrappedClusterErase();
+    TestRandomOperations();
+    TestJournalReplay();
+    TestTruncatedRecord();
+    TestCompaction();
+    TestLegacyImport();
+    return test::Finish("favorites");
+}
@@ -0,0 +1,102 @@
+#include "upng_test.hpp"
+
+// The table-driven inflate against streams zlib writes with every block type and strategy, and malformed ones
+
+namespace {
+
+    struct Compression {
+        const char *name;
+        int level;
+        int strategy;
+    };
+
+    // Stored, fixed Huffman and dynamic Huffman blocks, with and without matches
+    constexpr Compression Compressions[] = {
+        { "stored", 0, Z_DEFAULT_STRATEGY },
+        { "fast", 1, Z_DEFAULT_STRATEGY },
+        { "default", 6, Z_DEFAULT_STRATEGY },
+        { "best", 9, Z_DEFAULT_STRATEGY },
+        { "fixed", 6, Z_FIXED },
+        { "huffman-only", 6, Z_HUFFMAN_ONLY },
+        { "rle", 6, Z_RLE },
+        { "filtered", 6, Z_FILTERED },
+    };
+
+    // Byte values with a geometric distribution, whose codes run from 1 bit up to the longest ones, past the primary lookup table
+    png::Image MakeSkewedImage(const u32 width, const u32 height) {
+        png::Image image;
+        image.width = width;
+        image.height = height;
+        image.color_type = png::Grey;
+        image.bit_depth = 8;
+        image.pixels.resize(image.stride() * height);
+        std::mt19937 rng(7);
+        for(auto& value: image.pixels) {
+            const u32 bits = rng() | 0x10000;
+            value = __builtin_ctz(bits) * 13;
+        }
+        return image;
+    }
+
+    // Rows repeating 4 rows below, more than 32000 bytes back, near the largest deflate distance
+    png::Image MakeFarRepeatImage() {
+        auto image = png::MakeImage(8000, 12, png::Grey, 8, png::Content::Noise, 3);
+        for(u32 y = 4; y != image.height; ++y) {
+            std::memcpy(image.row(y), image.row(y - 4), image.stride());
+        }
+        return image;
+    }
+
+    void CheckCompressions(const char *name, const png::Image& image, const png::Filter filter) {
+        for(const auto& compression: Compressions) {
+            png::Options options;
+            options.filter = filter;
+            options.level = compression.level;
+            options.strategy = compression.strategy;
+            const auto png_data = png::Encode(image, options);
+            TEST_CHECK_MSG(test::Matches(test::Decode(png_data), image), "%s, %s", name, compression.name);
+            TEST_CHECK_MSG(test::RowsMatch(test::DecodeRows(png_data), image), "%s, %s, by rows", name, compression.name);
+        }
+    }
+
+    void TestStreams() {
+        CheckCompressions("smooth rgba", png::MakeImage(256, 256, png::RGBA, 8, png::Content::Smooth), png::Filter::Cycle);
+        CheckCompressions("noise rgb", png::MakeImage(97, 61, png::RGB, 8, png::Content::Noise), png::Filter::None);
+        CheckCompressions("smooth rgb 16", png::MakeImage(33, 40, png::RGB, 16, png::Content::Smooth), png::Filter::Paeth);
+        CheckCompressions("skewed", MakeSkewedImage(509, 131), png::Filter::None);
+        CheckCompressions("far repeat", MakeFarRepeatImage(), png::Filter::None);
+        CheckCompressions("single pixel", png::MakeImage(1, 1, png::RGBA, 8, png::Content::Noise), png::Filter::None);
+    }
+
+    // Streams which end early or hold a reserved block type must fail, and only read what they were given
+    void TestMalformedStreams() {
+        const auto image = png::MakeImage(64, 64, png::RGBA, 8, png::Content::Smooth);
+        const auto png_data = png::Encode(image);
+        const size_t idat = png::FindChunk(png_data, "IDAT");
+        const u32 idat_size = (png_data[idat] << 24) | (png_data[idat + 1] << 16) | (png_data[idat + 2] << 8) | png_data[idat + 3];
+
+        for(const u32 kept: { 2u, 3u, idat_size / 2, idat_size - 5 }) {
+            auto truncated = png_data;
+            truncated.erase(truncated.begin() + idat + 8 + kept, truncated.begin() + idat + 8 + idat_size);
+            truncated[idat] = kept >> 24;
+            truncated[idat + 1] = kept >> 16;
+            truncated[idat + 2] = kept >> 8;
+            truncated[idat + 3] = kept;
+            png::FixChunkCrc(truncated, idat);
+            TEST_CHECK_MSG(test::Decode(truncated).error == UPNG_EMALFORMED, "stream cut to %u bytes", kept);
+        }
+
+        // BTYPE is the 2 bits after BFINAL, in the first byte after the zlib header
+        auto reserved = png_data;
+        reserved[idat + 10] |= 0x06;
+        png::FixChunkCrc(reserved, idat);
+        TEST_CHECK(test::Decode(reserved).error == UPNG_EMALFORMED);
+    }
+
+}
+
+int main() {
+    TestStreams();
+    TestMalformedStreams();
+    return test::Finish("inflate");
+}
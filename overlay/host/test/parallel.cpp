@@ -0,0 +1,94 @@
+#include "upng_test.hpp"
+#include <parallel_for.hpp>
+
+// A parallel decode gives the same pixels, and the same errors, as a decode on one thread
+
+namespace {
+
+    struct Case {
+        const char *name;
+        u32 width;
+        u32 height;
+        png::ColorType color_type;
+        u8 bit_depth;
+        png::Options options;
+        // Whether the decode has to have split any work
+        bool expect_parallel;
+    };
+
+    png::Options MakeOptions(const png::Filter filter, const size_t flush_interval, const size_t idat_size = 0, const bool interlace = false) {
+        png::Options options;
+        options.filter = filter;
+        options.flush_interval = flush_interval;
+        options.idat_size = idat_size;
+        options.interlace = interlace;
+        return options;
+    }
+
+    const Case Cases[] = {
+        { "flushed, none/sub", 700, 600, png::RGBA, 8, MakeOptions(png::Filter::NoneSub, 65536), true },
+        { "flushed, every filter", 700, 600, png::RGBA, 8, MakeOptions(png::Filter::Cycle, 65536), true },
+        { "flushed, small idat chunks", 640, 480, png::RGB, 8, MakeOptions(png::Filter::NoneSub, 50000, 8191), true },
+        { "flushed, interlaced", 640, 640, png::RGBA, 8, MakeOptions(png::Filter::Cycle, 65536, 0, true), true },
+        { "flushed, 16 bit", 400, 400, png::RGBA, 16, MakeOptions(png::Filter::Paeth, 100000), true },
+        { "flushed, 2 bit", 2500, 1200, png::Grey, 2, MakeOptions(png::Filter::NoneSub, 40000), true },
+        { "no flush, none/sub", 700, 600, png::RGBA, 8, MakeOptions(png::Filter::NoneSub, 0), true },
+        { "no flush, up", 700, 600, png::RGBA, 8, MakeOptions(png::Filter::Up, 0), false },
+        { "small", 64, 64, png::RGBA, 8, MakeOptions(png::Filter::NoneSub, 1024), false },
+    };
+
+    void TestSamePixels() {
+        for(const auto& test_case: Cases) {
+            const auto image = png::MakeImage(test_case.width, test_case.height, test_case.color_type, test_case.bit_depth, png::Content::Smooth);
+            const auto png_data = png::Encode(image, test_case.options);
+            for(const int verify: { 1, 0 }) {
+                host::ParallelFor parallel_for{4};
+                const auto serial = test::Decode(png_data, [&](upng_t *upng) {
+                    upng_set_verify(upng, verify);
+                });
+                const auto parallel = test::Decode(png_data, [&](upng_t *upng) {
+                    upng_set_verify(upng, verify);
+                    parallel_for.attach(upng);
+                });
+                TEST_CHECK_MSG(test::Matches(serial, image), "%s, verify %d, serial", test_case.name, verify);
+                TEST_CHECK_MSG(test::Matches(parallel, image), "%s, verify %d, parallel", test_case.name, verify);
+                TEST_CHECK_MSG((parallel_for.parallel_calls != 0) == test_case.expect_parallel, "%s, verify %d, %u parallel calls", test_case.name, verify, parallel_for.parallel_calls.load());
+            }
+        }
+    }
+
+    // Damage in any segment fails the parallel decode the way it fails the serial one
+    void TestSameErrors() {
+        const auto image = png::MakeImage(700, 600, png::RGBA, 8, png::Content::Smooth);
+        const auto png_data = png::Encode(image, MakeOptions(png::Filter::NoneSub, 65536));
+        const size_t idat = png::FindChunk(png_data, "IDAT");
+        const u32 idat_size = (png_data[idat] << 24) | (png_data[idat + 1] << 16) | (png_data[idat + 2] << 8) | png_data[idat + 3];
+        for(u32 i = 1; i != 16; ++i) {
+            auto damaged = png_data;
+            damaged[idat + 8 + idat_size * i / 16] ^= 0x10;
+            png::FixChunkCrc(damaged, idat);
+            for(const int verify: { 1, 0 }) {
+                host::ParallelFor parallel_for{4};
+                const auto serial = test::Decode(damaged, [&](upng_t *upng) {
+                    upng_set_verify(upng, verify);
+                });
+                const auto parallel = test::Decode(damaged, [&](upng_t *upng) {
+                    upng_set_verify(upng, verify);
+                    parallel_for.attach(upng);
+                });
+                TEST_CHECK_MSG(serial.error == parallel.error, "damage at %u/16, verify %d: %d serial, %d parallel", i, verify, serial.error, parallel.error);
+                TEST_CHECK_MSG(!verify || (serial.error != UPNG_EOK), "damage at %u/16 not caught", i);
+                if((serial.error == UPNG_EOK) && (parallel.error == UPNG_EOK)) {
+                    TEST_CHECK_MSG(serial.pixels == parallel.pixels, "damage at %u/16, verify %d", i, verify);
+                }
+            }
+        }
+    }
+
+}
+
+int main() {
+    TestSamePixels();
+    TestSameErrors();
+    return test::Finish("parallel");
+}
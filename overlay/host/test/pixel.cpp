@@ -0,0 +1,251 @@
+#include "upng_test.hpp"
+#include <pixel.hpp>
+
+// Pixel expansion of every upng format and the area-averaging scaler, bit for bit against straightforward reference code,
+// so that the vector kernels and the scalar loops are held to the same output
+
+namespace {
+
+    constexpr u32 WeightBits = 14;
+
+    struct Format {
+        const char *name;
+        png::ColorType color_type;
+        u8 bit_depth;
+        upng_format format;
+    };
+
+    constexpr Format Formats[] = {
+        { "rgb8", png::RGB, 8, UPNG_RGB8 },
+        { "rgb16", png::RGB, 16, UPNG_RGB16 },
+        { "rgba8", png::RGBA, 8, UPNG_RGBA8 },
+        { "rgba16", png::RGBA, 16, UPNG_RGBA16 },
+        { "luminance1", png::Grey, 1, UPNG_LUMINANCE1 },
+        { "luminance2", png::Grey, 2, UPNG_LUMINANCE2 },
+        { "luminance4", png::Grey, 4, UPNG_LUMINANCE4 },
+        { "luminance8", png::Grey, 8, UPNG_LUMINANCE8 },
+        { "luminance_alpha1", png::GreyAlpha, 1, UPNG_LUMINANCE_ALPHA1 },
+        { "luminance_alpha2", png::GreyAlpha, 2, UPNG_LUMINANCE_ALPHA2 },
+        { "luminance_alpha4", png::GreyAlpha, 4, UPNG_LUMINANCE_ALPHA4 },
+        { "luminance_alpha8", png::GreyAlpha, 8, UPNG_LUMINANCE_ALPHA8 },
+    };
+
+    // 16-bit samples keep their high byte, lower depths are scaled up to the full 0-255 range
+    u8 ReferenceSample(const u8 *row, const u32 sample, const u32 bit_depth) {
+        const u32 value = png::impl::GetBits(row, (size_t)sample * bit_depth, bit_depth);
+        if(bit_depth == 16) {
+            return value >> 8;
+        }
+        return value * 255 / ((1u << bit_depth) - 1);
+    }
+
+    void ReferenceExpand(const png::Image& image, const u32 y, u8 *dst) {
+        const u32 channels = image.channels();
+        for(u32 x = 0; x != image.width; ++x) {
+            u8 samples[4];
+            for(u32 c = 0; c != channels; ++c) {
+                samples[c] = ReferenceSample(image.row(y), x * channels + c, image.bit_depth);
+            }
+            u8 *px = dst + x * 4;
+            if(channels <= 2) {
+                px[0] = px[1] = px[2] = samples[0];
+                px[3] = (channels == 2) ? samples[1] : 0xFF;
+            }
+            else {
+                px[0] = samples[0];
+                px[1] = samples[1];
+                px[2] = samples[2];
+                px[3] = (channels == 4) ? samples[3] : 0xFF;
+            }
+        }
+    }
+
+    // Widths around the vector block sizes, so that both the kernels and the scalar tails run
+    void TestExpand() {
+        for(const auto& format: Formats) {
+            for(const u32 width: { 1u, 7u, 8u, 15u, 16u, 17u, 33u, 100u }) {
+                const auto image = png::MakeImage(width, 3, format.color_type, format.bit_depth, png::Content::Noise, width);
+                std::vector<u8> expected(width * 4);
+                std::vector<u8> actual(width * 4 + 1, 0xA5);
+                for(u32 y = 0; y != image.height; ++y) {
+                    ReferenceExpand(image, y, expected.data());
+                    pixel::ExpandToRGBA8(format.format, image.row(y), actual.data(), width);
+                    TEST_CHECK_MSG(std::memcmp(expected.data(), actual.data(), expected.size()) == 0, "%s, %u pixels", format.name, width);
+                    TEST_CHECK_MSG(actual[width * 4] == 0xA5, "%s, %u pixels, written past the row", format.name, width);
+                }
+            }
+        }
+    }
+
+    // upng hands out scanlines in the layout ExpandToRGBA8 reads, for every format it reports
+    void TestDecodedFormats() {
+        for(const auto& format: Formats) {
+            const auto image = png::MakeImage(45, 9, format.color_type, format.bit_depth, png::Content::Noise, 5);
+            const auto png_data = png::Encode(image);
+            upng_t *upng = upng_new_from_bytes(png_data.data(), png_data.size());
+            TEST_CHECK_MSG((upng_header(upng) == UPNG_EOK) && (upng_get_format(upng) == format.format), "%s", format.name);
+            upng_free(upng);
+            TEST_CHECK_MSG(test::RowsMatch(test::DecodeRows(png_data), image), "%s", format.name);
+        }
+    }
+
+    // Weights computed the way pixel.hpp documents them: the overlap of each source pixel, rounded, the leftover going to the heaviest
+    std::vector<std::vector<std::pair<u32, u32>>> ReferenceWeights(const u32 src_size, const u32 dst_size) {
+        std::vector<std::vector<std::pair<u32, u32>>> taps(dst_size);
+        for(u32 i = 0; i != dst_size; ++i) {
+            const u64 start = (u64)i * src_size;
+            const u64 end = start + src_size;
+            u32 sum = 0;
+            for(u32 j = 0; j != src_size; ++j) {
+                const u64 lo = std::max<u64>(start, (u64)j * dst_size);
+                const u64 hi = std::min<u64>(end, (u64)(j + 1) * dst_size);
+                if(hi > lo) {
+                    const u32 weight = (((hi - lo) << WeightBits) + src_size / 2) / src_size;
+                    taps[i].push_back({ j, weight });
+                    sum += weight;
+                }
+            }
+            auto heaviest = std::max_element(taps[i].begin(), taps[i].end(), [](const auto& a, const auto& b) {
+                return a.second < b.second;
+            });
+            heaviest->second += (1u << WeightBits) - sum;
+        }
+        return taps;
+    }
+
+    // Both passes over the whole image at once: alpha weighted colors rounded to 16 bits horizontally, then summed vertically and unpremultiplied
+    std::vector<u8> ReferenceScale(const std::vector<u8>& src, const u32 src_width, const u32 src_height, const u32 dst_width, const u32 dst_height) {
+        const auto horizontal = ReferenceWeights(src_width, dst_width);
+        const auto vertical = ReferenceWeights(src_height, dst_height);
+        std::vector<u32> rows(src_height * dst_width * 4);
+        for(u32 y = 0; y != src_height; ++y) {
+            for(u32 x = 0; x != dst_width; ++x) {
+                u32 sums[4] = {};
+                for(const auto& [j, weight]: horizontal[x]) {
+                    const u8 *px = &src[(y * src_width + j) * 4];
+                    for(u32 c = 0; c != 3; ++c) {
+                        sums[c] += weight * px[3] * px[c];
+                    }
+                    sums[3] += weight * px[3];
+                }
+                u32 *out = &rows[(y * dst_width + x) * 4];
+                for(u32 c = 0; c != 3; ++c) {
+                    out[c] = (sums[c] + (1 << (WeightBits - 1))) >> WeightBits;
+                }
+                out[3] = (sums[3] + (1 << (WeightBits - 9))) >> (WeightBits - 8);
+            }
+        }
+        std::vector<u8> dst(dst_width * dst_height * 4);
+        for(u32 y = 0; y != dst_height; ++y) {
+            for(u32 x = 0; x != dst_width; ++x) {
+                u32 sums[4] = {};
+                for(const auto& [j, weight]: vertical[y]) {
+                    for(u32 c = 0; c != 4; ++c) {
+                        sums[c] += weight * rows[(j * dst_width + x) * 4 + c];
+                    }
+                }
+                const u32 alpha = (sums[3] + (1 << (WeightBits - 1))) >> WeightBits;
+                u8 *px = &dst[(y * dst_width + x) * 4];
+                for(u32 c = 0; c != 3; ++c) {
+                    const u32 color = (sums[c] + (1 << (WeightBits - 1))) >> WeightBits;
+                    px[c] = alpha ? std::min<u32>((color * 0x100 + alpha / 2) / alpha, 0xFF) : 0;
+                }
+                px[3] = std::min<u32>((alpha + 0x80) >> 8, 0xFF);
+            }
+        }
+        return dst;
+    }
+
+    std::vector<u8> Scale(const std::vector<u8>& src, const u32 src_width, const u32 src_height, const u32 dst_width, const u32 dst_height) {
+        std::vector<u8> dst(dst_width * dst_height * 4, 0xA5);
+        pixel::AreaScaler scaler(src_width, src_height, dst_width, dst_height);
+        for(u32 y = 0; y != src_height; ++y) {
+            scaler.PushRow(&src[y * src_width * 4], dst.data());
+        }
+        return dst;
+    }
+
+    // Noise with fully transparent and fully opaque pixels mixed in, the cases where premultiplication matters most
+    std::vector<u8> MakeRGBA(const u32 width, const u32 height, const u32 seed) {
+        std::mt19937 rng(seed);
+        std::vector<u8> rgba(width * height * 4);
+        for(auto& value: rgba) {
+            value = rng();
+        }
+        for(u32 i = 0; i != width * height; ++i) {
+            switch(rng() % 4) {
+                case 0: {
+                    rgba[i * 4 + 3] = 0;
+                    break;
+                }
+                case 1: {
+                    rgba[i * 4 + 3] = 0xFF;
+                    break;
+                }
+            }
+        }
+        return rgba;
+    }
+
+    void TestScaler() {
+        const u32 sizes[][4] = {
+            { 256, 256, 120, 120 },
+            { 256, 256, 214, 120 },
+            { 640, 480, 200, 150 },
+            { 13, 7, 5, 3 },
+            { 300, 300, 299, 299 },
+            { 1000, 10, 120, 1 },
+            { 7, 1000, 1, 120 },
+            { 1, 1, 1, 1 },
+        };
+        for(const auto& size: sizes) {
+            const auto src = MakeRGBA(size[0], size[1], size[0] * size[1]);
+            TEST_CHECK_MSG(Scale(src, size[0], size[1], size[2], size[3]) == ReferenceScale(src, size[0], size[1], size[2], size[3]), "%ux%u to %ux%u", size[0], size[1], size[2], size[3]);
+        }
+
+        // Every destination pixel has a total weight of exactly 1
+        for(const auto& size: sizes) {
+            const auto weights = pixel::GetAxisWeights(size[0], size[2]);
+            for(u32 i = 0; i != size[2]; ++i) {
+                u32 sum = 0;
+                for(u32 k = 0; k != weights->count[i]; ++k) {
+                    sum += weights->weights[weights->offset[i] + k];
+                }
+                TEST_CHECK_MSG(sum == (1u << WeightBits), "%u to %u, pixel %u", size[0], size[2], i);
+            }
+        }
+
+        // Same size keeps every visible pixel as it was, and transparent ones become transparent black
+        auto src = MakeRGBA(37, 23, 1);
+        auto expected = src;
+        for(u32 i = 0; i != 37 * 23; ++i) {
+            if(expected[i * 4 + 3] == 0) {
+                std::memset(&expected[i * 4], 0, 4);
+            }
+        }
+        TEST_CHECK(Scale(src, 37, 23, 37, 23) == expected);
+
+        // A flat opaque color stays that color whatever the scale
+        std::vector<u8> flat(300 * 200 * 4);
+        for(u32 i = 0; i != 300 * 200; ++i) {
+            flat[i * 4] = 12;
+            flat[i * 4 + 1] = 200;
+            flat[i * 4 + 2] = 99;
+            flat[i * 4 + 3] = 0xFF;
+        }
+        const auto scaled = Scale(flat, 300, 200, 120, 77);
+        bool flat_ok = true;
+        for(u32 i = 0; i != 120 * 77; ++i) {
+            flat_ok = flat_ok && (std::memcmp(&scaled[i * 4], &flat[0], 4) == 0);
+        }
+        TEST_CHECK(flat_ok);
+    }
+
+}
+
+int main() {
+    TestExpand();
+    TestDecodedFormats();
+    TestScaler();
+    return test::Finish("pixel");
+}
@@ -0,0 +1,124 @@
+#include "upng_test.hpp"
+
+// upng_probe on the UPNG_HEADER_SIZE bytes PngImage::readFile reads ahead: the same answers upng_header gives on the whole file,
+// and nothing read past the bytes it was given, however short or damaged they are
+// Every header is copied to a buffer of exactly its size first, so that a sanitized build catches any read past it
+
+namespace {
+
+    void WriteU32(std::vector<u8>& data, const size_t offset, const u32 value) {
+        data[offset] = value >> 24;
+        data[offset + 1] = value >> 16;
+        data[offset + 2] = value >> 8;
+        data[offset + 3] = value;
+    }
+
+    upng_error Probe(const std::vector<u8>& png_data, const size_t size, upng_info *info = nullptr) {
+        const std::vector<u8> header(png_data.begin(), png_data.begin() + std::min(size, png_data.size()));
+        upng_info probed = {};
+        const auto error = upng_probe(header.data(), header.size(), &probed);
+        if(info != nullptr) {
+            *info = probed;
+        }
+        return error;
+    }
+
+    upng_error HeaderError(const std::vector<u8>& png_data) {
+        upng_t *upng = upng_new_from_bytes(png_data.data(), png_data.size());
+        const auto error = upng_header(upng);
+        upng_free(upng);
+        return error;
+    }
+
+    void TestInfo() {
+        struct {
+            u32 width;
+            u32 height;
+            png::ColorType color_type;
+            u8 bit_depth;
+            bool interlace;
+            upng_format format;
+            u32 bpp;
+        } cases[] = {
+            { 256, 256, png::RGBA, 8, false, UPNG_RGBA8, 32 },
+            { 1920, 1080, png::RGB, 8, true, UPNG_RGB8, 24 },
+            { 3, 700, png::GreyAlpha, 8, false, UPNG_LUMINANCE_ALPHA8, 16 },
+            { 65, 1, png::Grey, 1, true, UPNG_LUMINANCE1, 1 },
+            { 17, 9, png::RGBA, 16, false, UPNG_RGBA16, 64 },
+        };
+        for(const auto& probe_case: cases) {
+            png::Options options;
+            options.interlace = probe_case.interlace;
+            const auto png_data = png::Encode(png::MakeImage(probe_case.width, probe_case.height, probe_case.color_type, probe_case.bit_depth, png::Content::Smooth), options);
+            // Short files and whole ones alike, only the header is looked at
+            for(const size_t size: { (size_t)UPNG_HEADER_SIZE, png_data.size() }) {
+                upng_info info;
+                TEST_CHECK_MSG(Probe(png_data, size, &info) == UPNG_EOK, "%ux%u, %zu bytes", probe_case.width, probe_case.height, size);
+                TEST_CHECK(info.width == probe_case.width);
+                TEST_CHECK(info.height == probe_case.height);
+                TEST_CHECK(info.format == probe_case.format);
+                TEST_CHECK(info.bpp == probe_case.bpp);
+                TEST_CHECK(info.interlaced == (probe_case.interlace ? 1u : 0u));
+            }
+        }
+    }
+
+    // Fewer bytes than the signature and the IHDR chunk with its CRC is never a valid header
+    void TestTruncated() {
+        const auto png_data = png::Encode(png::MakeImage(32, 32, png::RGBA, 8, png::Content::Smooth));
+        for(size_t size = 0; size != UPNG_HEADER_SIZE; ++size) {
+            const auto error = Probe(png_data, size);
+            TEST_CHECK_MSG((error == UPNG_ENOTPNG) || (error == UPNG_EMALFORMED), "%zu bytes: error %d", size, error);
+        }
+        TEST_CHECK(Probe(png_data, UPNG_HEADER_SIZE) == UPNG_EOK);
+    }
+
+    // Damage to the header is reported by the probe as upng_header reports it on the whole file
+    void TestCorrupted() {
+        const auto png_data = png::Encode(png::MakeImage(32, 32, png::RGBA, 8, png::Content::Smooth));
+        std::vector<std::pair<const char*, std::vector<u8>>> corrupted;
+
+        auto bad_signature = png_data;
+        bad_signature[1] = 'B';
+        corrupted.emplace_back("signature", bad_signature);
+
+        auto not_ihdr = png_data;
+        std::memcpy(not_ihdr.data() + 12, "IDAT", 4);
+        corrupted.emplace_back("first chunk not IHDR", not_ihdr);
+
+        // The length the CRC check used to trust, up to 4 GiB past the 33 bytes readFile reads ahead
+        for(const u32 length: { 0u, 12u, 14u, 20u, 0x7FFFFFFFu, 0xFFFFFFFFu }) {
+            auto bad_length = png_data;
+            WriteU32(bad_length, 8, length);
+            corrupted.emplace_back("IHDR length", bad_length);
+        }
+
+        auto bad_crc = png_data;
+        bad_crc[32] ^= 0x01;
+        corrupted.emplace_back("IHDR CRC", bad_crc);
+
+        auto no_pixels = png_data;
+        WriteU32(no_pixels, 16, 0);
+        png::FixChunkCrc(no_pixels, 8);
+        corrupted.emplace_back("zero width", no_pixels);
+
+        auto bad_format = png_data;
+        bad_format[24] = 5;
+        png::FixChunkCrc(bad_format, 8);
+        corrupted.emplace_back("bit depth", bad_format);
+
+        for(const auto& [name, damaged]: corrupted) {
+            const auto error = Probe(damaged, UPNG_HEADER_SIZE);
+            TEST_CHECK_MSG(error != UPNG_EOK, "%s", name);
+            TEST_CHECK_MSG(error == HeaderError(damaged), "%s: error %d, %d on the whole file", name, error, HeaderError(damaged));
+        }
+    }
+
+}
+
+int main() {
+    TestInfo();
+    TestTruncated();
+    TestCorrupted();
+    return test::Finish("probe");
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdio>
+
+// Checks report every failure and let the test carry on, Finish() turns the count into the exit status
+
+namespace test {
+
+    inline int g_failures = 0;
+
+    // The scalar builds of the tests are linked against upng built without its vector kernels
+#ifdef UPNG_NO_SIMD
+    constexpr const char *Variant = " (scalar)";
+#else
+    constexpr const char *Variant = "";
+#endif
+
+    inline int Finish(const char *name) {
+        if(g_failures != 0) {
+            std::fprintf(stderr, "%s%s: %d checks failed\n", name, Variant, g_failures);
+            return 1;
+        }
+        std::printf("%s%s: ok\n", name, Variant);
+        return 0;
+    }
+
+}
+
+#define TEST_CHECK(cond) do { \
+        if(!(cond)) { \
+            std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            test::g_failures++; \
+        } \
+    } while(0)
+
+// Like TEST_CHECK, with what was being tested when it failed
+#define TEST_CHECK_MSG(cond, ...) do { \
+        if(!(cond)) { \
+            std::fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+            std::fprintf(stderr, __VA_ARGS__); \
+            std::fprintf(stderr, "\n"); \
+            test::g_failures++; \
+        } \
+    } while(0)
@@ -0,0 +1,94 @@
+#include "upng_test.hpp"
+
+// Every filter type at every pixel size against the pixels the image was encoded from
+// The Makefile builds this (like every test) once more against upng built with UPNG_NO_SIMD, so the vector unfilter and the scalar one are held to the same output
+
+namespace {
+
+    struct Format {
+        const char *name;
+        png::ColorType color_type;
+        u8 bit_depth;
+    };
+
+    // 1 to 8 bytes per pixel, and less than a byte
+    constexpr Format Formats[] = {
+        { "luminance8", png::Grey, 8 },
+        { "luminance_alpha8", png::GreyAlpha, 8 },
+        { "rgb8", png::RGB, 8 },
+        { "rgba8", png::RGBA, 8 },
+        { "rgb16", png::RGB, 16 },
+        { "rgba16", png::RGBA, 16 },
+        { "luminance4", png::Grey, 4 },
+        { "luminance1", png::Grey, 1 },
+    };
+
+    constexpr png::Filter Filters[] = {
+        png::Filter::None,
+        png::Filter::Sub,
+        png::Filter::Up,
+        png::Filter::Average,
+        png::Filter::Paeth,
+        png::Filter::Cycle,
+    };
+
+    constexpr const char *FilterNames[] = { "none", "sub", "up", "average", "paeth", "cycle" };
+
+    // Only a few distinct values, so that the Paeth predictor keeps hitting ties between its candidates
+    png::Image MakeTiesImage(const u32 width, const u32 height, const png::ColorType color_type, const u8 bit_depth) {
+        auto image = png::MakeImage(width, height, color_type, bit_depth, png::Content::Noise, width + height);
+        std::mt19937 rng(width);
+        for(auto& value: image.pixels) {
+            value = (rng() % 3) * 0x7F;
+        }
+        for(u32 y = 0; y != height; ++y) {
+            const size_t row_bits = (size_t)width * image.bpp();
+            if(row_bits % 8 != 0) {
+                image.row(y)[image.stride() - 1] &= 0xFF << (8 - row_bits % 8);
+            }
+        }
+        return image;
+    }
+
+    void Check(const png::Image& image, const png::Filter filter, const char *format_name, const char *content_name) {
+        png::Options options;
+        options.filter = filter;
+        const auto png_data = png::Encode(image, options);
+        const auto filter_name = FilterNames[static_cast<int>(filter)];
+        TEST_CHECK_MSG(test::Matches(test::Decode(png_data), image), "%s %s, %s, %u pixels wide", content_name, format_name, filter_name, image.width);
+        TEST_CHECK_MSG(test::RowsMatch(test::DecodeRows(png_data), image), "%s %s, %s, %u pixels wide, by rows", content_name, format_name, filter_name, image.width);
+    }
+
+    // Widths around the 16 byte vectors and the 4 and 3 byte pixel steps
+    void TestFilters() {
+        for(const auto& format: Formats) {
+            for(const auto filter: Filters) {
+                for(const u32 width: { 1u, 2u, 3u, 5u, 6u, 15u, 16u, 17u, 21u, 32u, 33u, 64u, 255u, 256u, 257u }) {
+                    Check(png::MakeImage(width, 9, format.color_type, format.bit_depth, png::Content::Noise, width), filter, format.name, "noise");
+                    Check(png::MakeImage(width, 9, format.color_type, format.bit_depth, png::Content::Smooth, width), filter, format.name, "smooth");
+                    Check(MakeTiesImage(width, 9, format.color_type, format.bit_depth), filter, format.name, "ties");
+                }
+            }
+        }
+    }
+
+    // The passes of an interlaced image are unfiltered on their own, each with a first scanline which has nothing above it
+    void TestInterlaced() {
+        for(const auto& format: Formats) {
+            for(const auto filter: Filters) {
+                png::Options options;
+                options.filter = filter;
+                options.interlace = true;
+                const auto image = png::MakeImage(37, 29, format.color_type, format.bit_depth, png::Content::Noise, 11);
+                TEST_CHECK_MSG(test::Matches(test::Decode(png::Encode(image, options)), image), "interlaced %s, %s", format.name, FilterNames[static_cast<int>(filter)]);
+            }
+        }
+    }
+
+}
+
+int main() {
+    TestFilters();
+    TestInterlaced();
+    return test::Finish("unfilter");
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "test.hpp"
+#include <png_writer.hpp>
+#include <upng.h>
+#include <functional>
+#include <vector>
+
+// Decoding helpers shared by the upng tests, the expected pixels being those the images were encoded from
+
+namespace test {
+
+    struct Decoded {
+        upng_error error;
+        u32 width;
+        u32 height;
+        u32 bpp;
+        std::vector<u8> pixels;
+    };
+
+    // setup runs before the header is read, to change the decode options
+    inline Decoded Decode(const std::vector<u8>& png_data, const std::function<void(upng_t*)>& setup = {}) {
+        Decoded decoded = {};
+        upng_t *upng = upng_new_from_bytes(png_data.data(), png_data.size());
+        if(setup) {
+            setup(upng);
+        }
+        decoded.error = upng_decode(upng);
+        if(decoded.error == UPNG_EOK) {
+            decoded.width = upng_get_width(upng);
+            decoded.height = upng_get_height(upng);
+            decoded.bpp = upng_get_bpp(upng);
+            decoded.pixels.assign(upng_get_buffer(upng), upng_get_buffer(upng) + upng_get_size(upng));
+        }
+        upng_free(upng);
+        return decoded;
+    }
+
+    // The scanlines as upng_decode_rows hands them out, back to back
+    inline Decoded DecodeRows(const std::vector<u8>& png_data, const std::function<void(upng_t*)>& setup = {}) {
+        Decoded decoded = {};
+        upng_t *upng = upng_new_from_bytes(png_data.data(), png_data.size());
+        if(setup) {
+            setup(upng);
+        }
+        if(upng_header(upng) == UPNG_EOK) {
+            decoded.width = upng_get_width(upng);
+            decoded.height = upng_get_height(upng);
+            decoded.bpp = upng_get_bpp(upng);
+            upng_decode_rows(upng, [](void *user, unsigned y, const unsigned char *row) {
+                auto& decoded = *static_cast<Decoded*>(user);
+                const size_t stride = ((size_t)decoded.width * decoded.bpp + 7) / 8;
+                if(decoded.pixels.size() == y * stride) {
+                    decoded.pixels.insert(decoded.pixels.end(), row, row + stride);
+                }
+            }, &decoded);
+        }
+        decoded.error = upng_get_error(upng);
+        upng_free(upng);
+        return decoded;
+    }
+
+    // upng_decode leaves no padding between the scanlines of images of less than 8 bits per pixel
+    inline bool Matches(const Decoded& decoded, const png::Image& image) {
+        if((decoded.error != UPNG_EOK) || (decoded.width != image.width) || (decoded.height != image.height) || (decoded.bpp != image.bpp())) {
+            return false;
+        }
+        const auto expected = png::PackRows(image);
+        const size_t bit_count = (size_t)image.width * image.bpp() * image.height;
+        return (decoded.pixels.size() >= expected.size()) && png::SameBits(decoded.pixels.data(), expected.data(), bit_count);
+    }
+
+    inline bool RowsMatch(const Decoded& decoded, const png::Image& image) {
+        if((decoded.error != UPNG_EOK) || (decoded.width != image.width) || (decoded.height != image.height) || (decoded.pixels.size() != image.pixels.size())) {
+            return false;
+        }
+        const size_t row_bits = (size_t)image.width * image.bpp();
+        for(u32 y = 0; y != image.height; ++y) {
+            if(!png::SameBits(decoded.pixels.data() + y * image.stride(), image.row(y), row_bits)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
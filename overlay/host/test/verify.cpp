@@ -0,0 +1,180 @@
+#include "upng_test.hpp"
+
+// Chunk CRCs and the zlib adler32: damaged images fail with UPNG_ECHECKSUM (or UPNG_EMALFORMED when the damage breaks their structure first),
+// never decode to something else, and never make upng read past the data it was given
+
+namespace {
+
+    u32 ReadU32(const std::vector<u8>& data, const size_t offset) {
+        return (data[offset] << 24) | (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+    }
+
+    void WriteU32(std::vector<u8>& data, const size_t offset, const u32 value) {
+        data[offset] = value >> 24;
+        data[offset + 1] = value >> 16;
+        data[offset + 2] = value >> 8;
+        data[offset + 3] = value;
+    }
+
+    void SetVerify(upng_t *upng, const int verify) {
+        upng_set_verify(upng, verify);
+    }
+
+    upng_error DecodeError(const std::vector<u8>& png_data, const int verify) {
+        return test::Decode(png_data, [&](upng_t *upng) {
+            SetVerify(upng, verify);
+        }).error;
+    }
+
+    upng_error DecodeRowsError(const std::vector<u8>& png_data, const int verify) {
+        return test::DecodeRows(png_data, [&](upng_t *upng) {
+            SetVerify(upng, verify);
+        }).error;
+    }
+
+    const png::Image& TestImage() {
+        static const auto image = png::MakeImage(90, 70, png::RGBA, 8, png::Content::Smooth);
+        return image;
+    }
+
+    void TestIntact() {
+        png::Options options;
+        options.idat_size = 1000;
+        const auto png_data = png::Encode(TestImage(), options);
+        for(const int verify: { 1, 0 }) {
+            TEST_CHECK(test::Matches(test::Decode(png_data, [&](upng_t *upng) { SetVerify(upng, verify); }), TestImage()));
+            TEST_CHECK(test::RowsMatch(test::DecodeRows(png_data, [&](upng_t *upng) { SetVerify(upng, verify); }), TestImage()));
+        }
+    }
+
+    // A wrong CRC on a critical chunk only matters when verifying, one on an ancillary chunk never does
+    void TestChunkCrcs() {
+        const auto png_data = png::Encode(TestImage());
+
+        auto bad_ihdr = png_data;
+        bad_ihdr[8 + 8 + 13] ^= 0x01;
+        TEST_CHECK(DecodeError(bad_ihdr, 1) == UPNG_ECHECKSUM);
+        TEST_CHECK(DecodeError(bad_ihdr, 0) == UPNG_EOK);
+
+        const size_t idat = png::FindChunk(png_data, "IDAT");
+        auto bad_idat = png_data;
+        bad_idat[idat + 8 + ReadU32(png_data, idat)] ^= 0x80;
+        TEST_CHECK(DecodeError(bad_idat, 1) == UPNG_ECHECKSUM);
+        TEST_CHECK(DecodeRowsError(bad_idat, 1) == UPNG_ECHECKSUM);
+        TEST_CHECK(test::Matches(test::Decode(bad_idat, [](upng_t *upng) { SetVerify(upng, 0); }), TestImage()));
+
+        // A tEXt chunk with a wrong CRC, right before the image data
+        static const u8 Text[] = { 't', 'E', 'X', 't', 'k', 'e', 'y', 0, 'v', 'a', 'l', 'u', 'e' };
+        std::vector<u8> text_chunk;
+        png::impl::PutChunk(text_chunk, "tEXt", Text + 4, sizeof(Text) - 4);
+        text_chunk.back() ^= 0xFF;
+        auto bad_text = png_data;
+        bad_text.insert(bad_text.begin() + idat, text_chunk.begin(), text_chunk.end());
+        TEST_CHECK(test::Matches(test::Decode(bad_text), TestImage()));
+    }
+
+    // The adler32 follows the last deflate block, at the end of the last IDAT chunk
+    void TestAdler() {
+        png::Options options;
+        options.idat_size = 777;
+        const auto png_data = png::Encode(TestImage(), options);
+        const size_t iend = png::FindChunk(png_data, "IEND");
+        size_t last_idat = 0;
+        for(u32 i = 0; png::FindChunk(png_data, "IDAT", i) != 0; ++i) {
+            last_idat = png::FindChunk(png_data, "IDAT", i);
+        }
+        TEST_CHECK(last_idat + 12 + ReadU32(png_data, last_idat) == iend);
+
+        for(u32 byte = 0; byte != 4; ++byte) {
+            auto bad_adler = png_data;
+            bad_adler[iend - 4 - 1 - byte] ^= 0x04;
+            png::FixChunkCrc(bad_adler, last_idat);
+            TEST_CHECK_MSG(DecodeError(bad_adler, 1) == UPNG_ECHECKSUM, "adler32 byte %u", byte);
+            TEST_CHECK_MSG(DecodeRowsError(bad_adler, 1) == UPNG_ECHECKSUM, "adler32 byte %u, by rows", byte);
+            TEST_CHECK_MSG(DecodeError(bad_adler, 0) == UPNG_EOK, "adler32 byte %u, not verified", byte);
+        }
+    }
+
+    // Stored blocks inflate whatever their bytes are, so only the adler32 can tell that the pixels were damaged
+    void TestDamagedPixels() {
+        png::Options options;
+        options.level = 0;
+        const auto png_data = png::Encode(TestImage(), options);
+        const size_t idat = png::FindChunk(png_data, "IDAT");
+        const u32 length = ReadU32(png_data, idat);
+        for(u32 offset = 7; offset < length - 4; offset += 97) {
+            auto damaged = png_data;
+            damaged[idat + 8 + offset] ^= 0x20;
+            png::FixChunkCrc(damaged, idat);
+            const auto error = DecodeError(damaged, 1);
+            TEST_CHECK_MSG((error == UPNG_ECHECKSUM) || (error == UPNG_EMALFORMED), "byte %u of the image data: error %d", offset, error);
+        }
+
+        // A flipped bit anywhere in compressed data is caught too, one way or another, unless it was one of the padding bits after the final block
+        const auto compressed = png::Encode(TestImage());
+        const size_t compressed_idat = png::FindChunk(compressed, "IDAT");
+        const u32 compressed_length = ReadU32(compressed, compressed_idat);
+        for(u32 bit = 16; bit < compressed_length * 8; bit += 13) {
+            auto damaged = compressed;
+            damaged[compressed_idat + 8 + bit / 8] ^= 1 << (bit % 8);
+            png::FixChunkCrc(damaged, compressed_idat);
+            const auto decoded = test::Decode(damaged);
+            TEST_CHECK_MSG((decoded.error != UPNG_EOK) || test::Matches(decoded, TestImage()), "bit %u of the image data", bit);
+        }
+    }
+
+    // A corrupted IHDR length used to be trusted by the CRC check, which then read up to 4 GiB past the data
+    void TestChunkLengths() {
+        const auto png_data = png::Encode(TestImage());
+        for(const u32 length: { 0u, 12u, 14u, 0x7FFFFFFFu, 0xFFFFFFF0u }) {
+            auto bad_length = png_data;
+            WriteU32(bad_length, 8, length);
+            for(const int verify: { 1, 0 }) {
+                TEST_CHECK_MSG(DecodeError(bad_length, verify) == UPNG_EMALFORMED, "IHDR length %08X, verify %d", length, verify);
+                TEST_CHECK_MSG(DecodeRowsError(bad_length, verify) == UPNG_EMALFORMED, "IHDR length %08X, verify %d, by rows", length, verify);
+            }
+        }
+
+        // An IDAT chunk which claims more data than the file has
+        const size_t idat = png::FindChunk(png_data, "IDAT");
+        for(const u32 length: { ReadU32(png_data, idat) + 13, 0x7FFFFFFFu, 0xFFFFFFF0u }) {
+            auto bad_length = png_data;
+            WriteU32(bad_length, idat, length);
+            for(const int verify: { 1, 0 }) {
+                TEST_CHECK_MSG(DecodeError(bad_length, verify) == UPNG_EMALFORMED, "IDAT length %08X, verify %d", length, verify);
+            }
+        }
+    }
+
+    // Every possible truncation: an error, or the whole image when exactly the IEND chunk went missing, and nothing read past the end
+    void TestTruncated() {
+        const auto image = png::MakeImage(20, 10, png::RGB, 8, png::Content::Smooth);
+        const auto png_data = png::Encode(image);
+        const size_t iend = png::FindChunk(png_data, "IEND");
+        for(size_t size = 0; size != png_data.size(); ++size) {
+            const std::vector<u8> truncated(png_data.begin(), png_data.begin() + size);
+            for(const int verify: { 1, 0 }) {
+                const auto decoded = test::Decode(truncated, [&](upng_t *upng) {
+                    SetVerify(upng, verify);
+                });
+                if(size == iend) {
+                    TEST_CHECK_MSG(test::Matches(decoded, image), "%zu bytes, verify %d", size, verify);
+                }
+                else {
+                    TEST_CHECK_MSG(decoded.error != UPNG_EOK, "%zu bytes, verify %d", size, verify);
+                }
+            }
+        }
+    }
+
+}
+
+int main() {
+    TestIntact();
+    TestChunkCrcs();
+    TestAdler();
+    TestDamagedPixels();
+    TestChunkLengths();
+    TestTruncated();
+    return test::Finish("verify");
+}
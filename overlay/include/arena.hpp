@@ -0,0 +1,86 @@
+#pragma once
+#include <switch.h>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+#include <upng.h>
+
+// Bump allocator for scratch memory which is released all at once, like the buffers of a single PNG decode
+// Requests which do not fit in the block are served by the heap, and the next reset() grows the block to what was asked for,
+// so that after the first large image, decoding one of the same size takes nothing from the heap
+class BumpArena {
+
+    private:
+        static constexpr size_t Alignment = 16;
+
+        std::unique_ptr<u8[]> block;
+        size_t capacity{0};
+        size_t used{0};
+        // Everything asked for since the last reset, whether it fit in the block or not
+        size_t requested{0};
+        std::vector<void*> overflow;
+
+        static void* upngAlloc(void* user, unsigned long size) {
+            return static_cast<BumpArena*>(user)->allocate(size);
+        }
+
+        void releaseOverflow() {
+            for (auto ptr: overflow) {
+                std::free(ptr);
+            }
+            overflow.clear();
+        }
+
+        void grow(const size_t new_capacity) {
+            block.reset(new (std::nothrow) u8[new_capacity]);
+            capacity = (block != nullptr) ? new_capacity : 0;
+        }
+
+    public:
+        BumpArena(const size_t initial_capacity) {
+            grow(initial_capacity);
+        }
+
+        ~BumpArena() {
+            releaseOverflow();
+        }
+
+        BumpArena(const BumpArena&) = delete;
+        BumpArena& operator=(const BumpArena&) = delete;
+
+        void* allocate(const size_t size) {
+            const size_t aligned_size = (size + Alignment - 1) & ~(Alignment - 1);
+            requested += aligned_size;
+            if (aligned_size <= capacity - used) {
+                void* ptr = block.get() + used;
+                used += aligned_size;
+                return ptr;
+            }
+            void* ptr = std::malloc(size);
+            if (ptr != nullptr) {
+                overflow.push_back(ptr);
+            }
+            return ptr;
+        }
+
+        // Invalidates everything allocated so far
+        void reset() {
+            releaseOverflow();
+            if (requested > capacity) {
+                grow(requested);
+            }
+            used = 0;
+            requested = 0;
+        }
+
+        size_t getCapacity() const {
+            return capacity;
+        }
+
+        // Nothing is freed through it: the arena is meant to be reset once upng_free() was called
+        upng_allocator getUpngAllocator() {
+            return upng_allocator{ &BumpArena::upngAlloc, nullptr, this };
+        }
+
+};
@@ -0,0 +1,198 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#ifdef __SWITCH__
+#include <switch.h>
+#else
+#include <condition_variable>
+#include <thread>
+#endif
+
+namespace async {
+
+    // Minimal threading primitives: libnx objects on the console, the standard library on host builds
+
+    class Mutex {
+
+        private:
+#ifdef __SWITCH__
+            ::Mutex mutex;
+#else
+            std::mutex mutex;
+#endif
+
+        public:
+            Mutex() {
+#ifdef __SWITCH__
+                mutexInit(&mutex);
+#endif
+            }
+
+            Mutex(const Mutex&) = delete;
+            Mutex& operator=(const Mutex&) = delete;
+
+            void lock() {
+#ifdef __SWITCH__
+                mutexLock(&mutex);
+#else
+                mutex.lock();
+#endif
+            }
+
+            void unlock() {
+#ifdef __SWITCH__
+                mutexUnlock(&mutex);
+#else
+                mutex.unlock();
+#endif
+            }
+
+    };
+
+    // Counting semaphore, only used to wake up a sleeping worker
+    class Signal {
+
+        private:
+#ifdef __SWITCH__
+            Semaphore semaphore;
+#else
+            std::mutex mutex;
+            std::condition_variable condition;
+            size_t count{0};
+#endif
+
+        public:
+            Signal() {
+#ifdef __SWITCH__
+                semaphoreInit(&semaphore, 0);
+#endif
+            }
+
+            Signal(const Signal&) = delete;
+            Signal& operator=(const Signal&) = delete;
+
+            void post() {
+#ifdef __SWITCH__
+                semaphoreSignal(&semaphore);
+#else
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++count;
+                }
+                condition.notify_one();
+#endif
+            }
+
+            void wait() {
+#ifdef __SWITCH__
+                semaphoreWait(&semaphore);
+#else
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return count != 0; });
+                --count;
+#endif
+            }
+
+    };
+
+    class Thread {
+
+        private:
+            std::function<void()> entry;
+            bool running{false};
+#ifdef __SWITCH__
+            ::Thread thread;
+
+            static void threadMain(void* arg) {
+                static_cast<Thread*>(arg)->entry();
+            }
+#else
+            std::thread thread;
+#endif
+
+        public:
+            Thread() {}
+
+            Thread(const Thread&) = delete;
+            Thread& operator=(const Thread&) = delete;
+
+            ~Thread() {
+                join();
+            }
+
+            bool start(std::function<void()> fn, const size_t stack_size) {
+                if (running) {
+                    return false;
+                }
+                entry = std::move(fn);
+#ifdef __SWITCH__
+                if (R_FAILED(threadCreate(&thread, &Thread::threadMain, this, nullptr, stack_size, 0x2C, -2))) {
+                    return false;
+                }
+                if (R_FAILED(threadStart(&thread))) {
+                    threadClose(&thread);
+                    return false;
+                }
+#else
+                (void)stack_size;
+                thread = std::thread(entry);
+#endif
+                running = true;
+                return true;
+            }
+
+            void join() {
+                if (!running) {
+                    return;
+                }
+#ifdef __SWITCH__
+                threadWaitForExit(&thread);
+                threadClose(&thread);
+#else
+                thread.join();
+#endif
+                running = false;
+            }
+
+    };
+
+    // Lock-free ring for exactly one producer thread and one consumer thread
+    template<typename T, size_t Capacity>
+    class SpscQueue {
+
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        private:
+            std::array<T, Capacity> slots;
+            std::atomic<size_t> head{0};
+            std::atomic<size_t> tail{0};
+
+        public:
+            bool push(T item) {
+                const auto cur_tail = tail.load(std::memory_order_relaxed);
+                if (cur_tail - head.load(std::memory_order_acquire) == Capacity) {
+                    return false;
+                }
+                slots[cur_tail % Capacity] = std::move(item);
+                tail.store(cur_tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            bool pop(T& item) {
+                const auto cur_head = head.load(std::memory_order_relaxed);
+                if (cur_head == tail.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                item = std::move(slots[cur_head % Capacity]);
+                slots[cur_head % Capacity] = T{};
+                head.store(cur_head + 1, std::memory_order_release);
+                return true;
+            }
+
+    };
+
+}
@@ -31,6 +31,30 @@ namespace emu {
 
     };
 
+    struct VirtualAmiiboLiteData {
+        VirtualAmiiboUuidInfo uuid;
+        char name[40 + 1];
+        VirtualAmiiboDate first_write_date;
+        VirtualAmiiboDate last_write_date;
+    };
+
+    enum class VirtualAmiiboListEntryKind : u32 {
+        Amiibo,
+        Folder,
+    };
+
+    struct VirtualAmiiboListEntry {
+        VirtualAmiiboListEntryKind kind;
+        char name[FS_MAX_PATH];
+        VirtualAmiiboLiteData data;
+    };
+    static_assert(sizeof(VirtualAmiiboListEntry) == 0x344, "VirtualAmiiboListEntry must match the sysmodule layout");
+
+    struct VirtualAmiiboListPage {
+        u32 entry_count;
+        u32 next_cursor;
+    };
+
     enum class EmulationStatus : u32 {
         On,
         Off,
@@ -42,6 +66,13 @@ namespace emu {
         Disconnected
     };
 
+    struct StatusSnapshot {
+        EmulationStatus emulation_status;
+        VirtualAmiiboStatus active_virtual_amiibo_status;
+        u32 active_virtual_amiibo_generation;
+        bool is_application_id_intercepted;
+    };
+
     struct Version {
         u8 major;
         u8 minor;
@@ -49,6 +80,18 @@ namespace emu {
         bool dev_build;
     };
 
+    // Latency of the requests made for a command id, only recorded in EMUIIBO_DEBUG builds
+    struct CommandStats {
+        u32 command_id;
+        u32 count;
+        u32 failures;
+        u64 total_ns;
+        u64 min_ns;
+        u64 max_ns;
+        // Over the last requests only
+        u64 p99_ns;
+    };
+
     bool IsAvailable();
 
     Result Initialize();
@@ -68,20 +111,36 @@ namespace emu {
     VirtualAmiiboStatus GetActiveVirtualAmiiboStatus();
     void SetActiveVirtualAmiiboStatus(VirtualAmiiboStatus status);
 
-    void IsApplicationIdIntercepted(u64 app_id, bool *out_intercepted);
+    Result IsApplicationIdIntercepted(u64 app_id, bool *out_intercepted);
 
-    inline bool IsCurrentApplicationIdIntercepted() {
-        bool intercepted = false;
-        u64 process_id = 0;
-        if(R_SUCCEEDED(pmdmntGetApplicationProcessId(&process_id))) {
-            u64 program_id = 0;
-            if(R_SUCCEEDED(pminfoGetProgramId(&program_id, process_id))) {
-                IsApplicationIdIntercepted(program_id, &intercepted);
-            }
-        }
-        return intercepted;
-    }
+    // The program id is only looked up again when the application process changes, 0 when no application is running
+    u64 GetCurrentApplicationId();
+
+    // The verdict is kept until the current application changes or InvalidateInterceptedApplicationCache is called
+    // A failed request counts as not intercepted, and is asked again on the next call
+    bool IsCurrentApplicationIdIntercepted();
+
+    // To be called when emuiibo signals a state change, since the set of intercepted applications may have changed
+    void InvalidateInterceptedApplicationCache();
 
     Result TryParseVirtualAmiibo(char *path, size_t path_size, VirtualAmiiboData *out_amiibo_data);
 
+    // Lists the subdirectories of path (virtual amiibos and plain folders), starting at cursor: keep calling with next_cursor until it is 0
+    Result ListVirtualAmiiboDirectory(char *path, size_t path_size, u32 cursor, VirtualAmiiboListEntry *out_entries, size_t out_entry_count, VirtualAmiiboListPage *out_page);
+
+    // Emulation status, active virtual amiibo status and generation, and whether app_id is intercepted, in a single request
+    Result GetStatusSnapshot(u64 app_id, StatusSnapshot *out_snapshot);
+
+    // Event signalled whenever anything GetStatusSnapshot reports changes, loaded as autoclear
+    Result AttachStateChangeEvent(Event *out_event);
+
+    const char *GetCommandName(u32 command_id);
+
+    // Commands which were requested at least once, by id
+    std::vector<CommandStats> GetCommandStats();
+    void ResetCommandStats();
+
+    // Writes the statistics as text, the SD card has to be mounted already
+    bool DumpCommandStats(const char *path);
+
 }
\ No newline at end of file
@@ -0,0 +1,297 @@
+#pragma once
+#include <switch.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Favorite amiibos and folders, as an open-addressing hash set of their paths
+// They are stored as a journal of add/remove records relative to the virtual amiibo directory: changes are appended,
+// and the whole journal is only rewritten once it holds too many records which cancel each other out
+class FavoritesStore {
+
+    private:
+        static constexpr u32 JournalMagic = 0x4A564146; // "FAVJ"
+        static constexpr u32 JournalVersion = 1;
+        // Records beyond twice the favorite count (plus this much) make the next flush compact the journal
+        static constexpr size_t CompactionSlack = 32;
+        static constexpr size_t MinCapacity = 16;
+
+        enum class RecordKind : u8 {
+            Add = 1,
+            Remove = 2,
+        };
+
+        struct JournalHeader {
+            u32 magic;
+            u32 version;
+        };
+
+        // An empty path is an empty slot
+        struct Slot {
+            u64 hash;
+            std::string path;
+        };
+
+        std::filesystem::path base_path;
+        std::vector<Slot> slots;
+        size_t count{0};
+        // Records in the journal file, and the changes not written there yet
+        size_t journal_records{0};
+        bool journal_valid{false};
+        std::vector<u8> pending_records;
+        size_t pending_count{0};
+
+        static u64 hashPath(const std::string& path) {
+            u64 hash = 0xCBF29CE484222325;
+            for (const char c: path) {
+                hash = (hash ^ static_cast<u8>(c)) * 0x100000001B3;
+            }
+            return hash;
+        }
+
+        size_t mask() const {
+            return slots.size() - 1;
+        }
+
+        // Slot holding path, or the empty slot where it would go
+        size_t probe(const std::string& path, const u64 hash) const {
+            size_t idx = hash & mask();
+            while (!slots[idx].path.empty() && ((slots[idx].hash != hash) || (slots[idx].path != path))) {
+                idx = (idx + 1) & mask();
+            }
+            return idx;
+        }
+
+        void rehash(const size_t capacity) {
+            std::vector<Slot> old_slots(capacity);
+            old_slots.swap(slots);
+            for (auto& slot: old_slots) {
+                if (!slot.path.empty()) {
+                    const size_t idx = probe(slot.path, slot.hash);
+                    slots[idx] = std::move(slot);
+                }
+            }
+        }
+
+        bool insert(std::string&& path) {
+            if (path.empty()) {
+                return false;
+            }
+            if ((count + 1) * 2 > slots.size()) {
+                rehash(std::max(slots.size() * 2, MinCapacity));
+            }
+            const u64 hash = hashPath(path);
+            const size_t idx = probe(path, hash);
+            if (!slots[idx].path.empty()) {
+                return false;
+            }
+            slots[idx] = Slot{hash, std::move(path)};
+            count++;
+            return true;
+        }
+
+        // Backward shift deletion, so that lookups never have to skip tombstones
+        bool erase(const std::string& path) {
+            if (slots.empty() || path.empty()) {
+                return false;
+            }
+            size_t idx = probe(path, hashPath(path));
+            if (slots[idx].path.empty()) {
+                return false;
+            }
+            size_t next = (idx + 1) & mask();
+            while (!slots[next].path.empty()) {
+                const size_t home = slots[next].hash & mask();
+                // Moves the entry back unless its home slot lies cyclically within (idx, next]
+                if (((next - home) & mask()) >= ((next - idx) & mask())) {
+                    slots[idx] = std::move(slots[next]);
+                    idx = next;
+                }
+                next = (next + 1) & mask();
+            }
+            slots[idx] = Slot{};
+            count--;
+            return true;
+        }
+
+        std::string relativePath(const std::string& path) const {
+            return std::filesystem::path{path}.lexically_relative(base_path).string();
+        }
+
+        static void appendRecord(std::vector<u8>& out, const RecordKind kind, const std::string& relative_path) {
+            const u16 size = std::min<size_t>(relative_path.size(), UINT16_MAX);
+            out.push_back(static_cast<u8>(kind));
+            out.push_back(size & 0xFF);
+            out.push_back(size >> 8);
+            out.insert(out.end(), relative_path.begin(), relative_path.begin() + size);
+        }
+
+        void recordChange(const RecordKind kind, const std::string& path) {
+            appendRecord(pending_records, kind, relativePath(path));
+            pending_count++;
+        }
+
+        // Replays the records in order, false if this is not a journal
+        // A truncated last record (an append cut short) is ignored, and the journal is rewritten on the next flush so that nothing gets appended after it
+        bool replayJournal(const std::vector<u8>& data) {
+            JournalHeader header;
+            if (data.size() < sizeof(JournalHeader)) {
+                return false;
+            }
+            std::memcpy(&header, data.data(), sizeof(JournalHeader));
+            if ((header.magic != JournalMagic) || (header.version != JournalVersion)) {
+                return false;
+            }
+            size_t offset = sizeof(JournalHeader);
+            journal_valid = true;
+            while (offset < data.size()) {
+                if (offset + 3 > data.size()) {
+                    journal_valid = false;
+                    break;
+                }
+                const auto kind = static_cast<RecordKind>(data[offset]);
+                const size_t size = data[offset + 1] | (data[offset + 2] << 8);
+                offset += 3;
+                if (offset + size > data.size()) {
+                    journal_valid = false;
+                    break;
+                }
+                const std::string path = (base_path / std::string(reinterpret_cast<const char*>(data.data()) + offset, size)).string();
+                offset += size;
+                journal_records++;
+                switch (kind) {
+                    case RecordKind::Add: {
+                        insert(std::string(path));
+                        break;
+                    }
+                    case RecordKind::Remove: {
+                        erase(path);
+                        break;
+                    }
+                }
+            }
+            return true;
+        }
+
+        bool compact(const std::filesystem::path& journal_path) {
+            std::vector<u8> data(sizeof(JournalHeader));
+            const JournalHeader header = { JournalMagic, JournalVersion };
+            std::memcpy(data.data(), &header, sizeof(JournalHeader));
+            for (const auto& slot: slots) {
+                if (!slot.path.empty()) {
+                    appendRecord(data, RecordKind::Add, relativePath(slot.path));
+                }
+            }
+            std::ofstream file(journal_path, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+            if (!file.write(reinterpret_cast<const char*>(data.data()), data.size())) {
+                return false;
+            }
+            journal_records = count;
+            journal_valid = true;
+            return true;
+        }
+
+    public:
+        // legacy_path is the old text file, one relative path per line, only read if there is no journal yet
+        void load(const std::filesystem::path& base, const std::filesystem::path& journal_path, const std::filesystem::path& legacy_path) {
+            base_path = base;
+            slots.clear();
+            count = 0;
+            journal_records = 0;
+            journal_valid = false;
+            pending_records.clear();
+            pending_count = 0;
+
+            std::ifstream file(journal_path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+            if (file) {
+                std::vector<u8> data(file.tellg());
+                file.seekg(0);
+                if (file.read(reinterpret_cast<char*>(data.data()), data.size()) && replayJournal(data)) {
+                    return;
+                }
+            }
+
+            std::ifstream legacy_file(legacy_path);
+            std::string path_str;
+            while (std::getline(legacy_file, path_str)) {
+                if (!path_str.empty()) {
+                    insert((base_path / path_str).string());
+                }
+            }
+        }
+
+        // Writes the changes since the last flush, if any, a missing or unreadable journal is written from scratch
+        bool flush(const std::filesystem::path& journal_path) {
+            if (!isDirty()) {
+                return true;
+            }
+            bool flushed = false;
+            if (!journal_valid || (journal_records + pending_count > 2 * count + CompactionSlack)) {
+                flushed = compact(journal_path);
+            }
+            else {
+                std::ofstream file(journal_path, std::ofstream::out | std::ofstream::app | std::ofstream::binary);
+                flushed = static_cast<bool>(file.write(reinterpret_cast<const char*>(pending_records.data()), pending_records.size()));
+                if (flushed) {
+                    journal_records += pending_count;
+                }
+                else {
+                    // Whatever made it to the file, the next flush rewrites it from scratch
+                    journal_valid = false;
+                }
+            }
+            if (flushed) {
+                pending_records.clear();
+                pending_count = 0;
+            }
+            return flushed;
+        }
+
+        bool isDirty() const {
+            return (pending_count != 0) || !journal_valid;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        bool contains(const std::filesystem::path& path) const {
+            if (count == 0) {
+                return false;
+            }
+            return !slots[probe(path.string(), hashPath(path.string()))].path.empty();
+        }
+
+        bool add(const std::filesystem::path& path) {
+            if (!insert(path.string())) {
+                return false;
+            }
+            recordChange(RecordKind::Add, path.string());
+            return true;
+        }
+
+        bool remove(const std::filesystem::path& path) {
+            if (!erase(path.string())) {
+                return false;
+            }
+            recordChange(RecordKind::Remove, path.string());
+            return true;
+        }
+
+        // Sorted by path, the hash set has no meaningful order
+        std::vector<std::filesystem::path> getAll() const {
+            std::vector<std::filesystem::path> paths;
+            paths.reserve(count);
+            for (const auto& slot: slots) {
+                if (!slot.path.empty()) {
+                    paths.push_back(slot.path);
+                }
+            }
+            std::sort(paths.begin(), paths.end());
+            return paths;
+        }
+};
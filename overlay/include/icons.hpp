@@ -0,0 +1,566 @@
+#pragma once
+#include <switch.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <upng.h>
+#include <arena.hpp>
+#include <pixel.hpp>
+#include <async.hpp>
+#include <platform.hpp>
+#include <profiler.hpp>
+
+class PngImage {
+
+    private:
+        struct RowScaler {
+            PngImage* image;
+            upng_format format;
+            u8* rgba_row;
+            int width;
+            std::unique_ptr<pixel::AreaScaler> area_scaler;
+        };
+
+        // What the header of the file says, enough to set the decode up before the rest of the file is read
+        // The source size is the one of the image as it gets decoded, after the reduction
+        struct DecodePlan {
+            upng_format format;
+            u32 reduction;
+            int source_width;
+            int source_height;
+        };
+
+        // An interlaced image is decoded from its first Adam7 passes alone as long as those hold at least as many pixels as the icon on both axes,
+        // down to the first one, which holds every 8th pixel of every 8th row
+        static constexpr u32 MaxReduction = 3;
+
+        // Enough for the decoder window and scanlines of a source image up to 1024 pixels wide, larger ones grow the arena
+        static constexpr size_t DecodeArenaSize = 96 * 1024;
+
+        // Header of the pre-scaled RGBA8888 copy of the image cached next to it, followed by width * height pixels
+        struct ThumbnailHeader {
+            u32 magic;
+            u32 version;
+            u64 source_mtime;
+            u64 source_size;
+            u16 max_width;
+            u16 max_height;
+            u16 width;
+            u16 height;
+        };
+        static constexpr u32 ThumbnailMagic = 0x424D4854; // "THMB"
+        static constexpr u32 ThumbnailVersion = 1;
+
+        std::filesystem::path path;
+        bool is_error{false};
+        std::string error_text{""};
+        std::vector<u8> img_buffer{};
+        int img_buffer_width{0};
+        int img_buffer_height{0};
+        std::atomic<bool> ready{false};
+
+    public:
+        // Memory reused from one decode to the next by whoever opens images, one per thread decoding them
+        struct DecodeScratch {
+            std::vector<u8> file_data;
+            BumpArena arena{DecodeArenaSize};
+        };
+
+        PngImage() {
+        }
+
+        ~PngImage() {
+            closeFile();
+        }
+
+        // May run on the icon worker: nothing but isReady() is to be read by other threads until it returns true
+        void openFile(const std::filesystem::path &png_path, const int max_height, const int max_width, DecodeScratch& scratch) {
+            closeFile();
+            path = png_path;
+            ThumbnailHeader thumbnail = {};
+            bool has_thumbnail_key = false;
+            bool has_thumbnail = false;
+            bool has_data = false;
+            DecodePlan plan = {};
+            std::vector<u8>& png_data = scratch.file_data;
+            png_data.clear();
+            platform::DoWithSDCard([&] {
+                has_thumbnail_key = makeThumbnailKey(max_height, max_width, thumbnail);
+                has_thumbnail = has_thumbnail_key && loadThumbnail(thumbnail);
+                if (!has_thumbnail) {
+                    has_data = readFile(max_height, max_width, png_data, plan);
+                }
+            });
+            if (has_data) {
+                decode(png_data, plan, scratch.arena);
+                if (has_thumbnail_key && !is_error) {
+                    platform::DoWithSDCard([&] {
+                        saveThumbnail(thumbnail);
+                    });
+                }
+            }
+            ready.store(true, std::memory_order_release);
+        }
+
+        // Takes pixels which were already decoded and scaled, as kept by a snapshot of the previous session
+        void openPixels(const std::filesystem::path &png_path, const int width, const int height, std::vector<u8>&& rgba) {
+            closeFile();
+            path = png_path;
+            img_buffer = std::move(rgba);
+            img_buffer_width = width;
+            img_buffer_height = height;
+            ready.store(true, std::memory_order_release);
+        }
+
+        void closeFile() {
+            ready.store(false, std::memory_order_relaxed);
+            path.clear();
+            clearImage();
+        }
+
+        bool isReady() const {
+            return ready.load(std::memory_order_acquire);
+        }
+
+        const std::filesystem::path getPath() const {
+            return path;
+        }
+
+        size_t getMemorySize() const {
+            return sizeof(PngImage) + img_buffer.capacity() + error_text.capacity();
+        }
+
+        const u8* getRGBABuffer() const {
+            if (img_buffer.empty()) {
+                return nullptr;
+            }
+            return img_buffer.data();
+        }
+
+        const int getHeight() const {
+            return img_buffer_height;
+        }
+
+        const int getWidth() const {
+            return img_buffer_width;
+        }
+
+        bool isError() const {
+            return is_error;
+        }
+
+        std::string getError() const {
+            return error_text;
+        }
+
+    private:
+
+        // Only the header is read until it is known that the image will be decoded, then the rest of the file follows it in data
+        bool readFile(const int max_height, const int max_width, std::vector<u8>& data, DecodePlan& plan) {
+            std::ifstream file(path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+            const auto file_size = file ? static_cast<size_t>(std::max<std::streamoff>(file.tellg(), 0)) : 0;
+            if (file_size == 0) {
+                setError("Image not found.");
+                return false;
+            }
+            file.seekg(0);
+            u8 header[UPNG_HEADER_SIZE];
+            file.read(reinterpret_cast<char*>(header), std::min<size_t>(file_size, UPNG_HEADER_SIZE));
+            const size_t header_size = file.gcount();
+
+            upng_info info;
+            const auto error = upng_probe(header, header_size, &info);
+            if (error != UPNG_EOK) {
+                setUpngError(error);
+                return false;
+            }
+            if (!planDecode(info, max_height, max_width, plan)) {
+                return false;
+            }
+
+            data.resize(file_size);
+            std::memcpy(data.data(), header, header_size);
+            if (!file.read(reinterpret_cast<char*>(data.data()) + header_size, file_size - header_size)) {
+                data.clear();
+                setError("Image not found.");
+                return false;
+            }
+            return true;
+        }
+
+        // Rejects what would need upscaling and allocates the scaled image, so that nothing is left to decide once the pixels come in
+        bool planDecode(const upng_info& info, const int max_height, const int max_width, DecodePlan& plan) {
+            const int upng_width = info.width;
+            const int upng_height = info.height;
+            double scale1 = (double)max_height / (double)upng_height;
+            double scale2 = (double)max_width / (double)upng_width;
+            double scale = std::min(scale1, scale2);
+            if (scale > 1.0) {
+                setError("Upscale not allowed.");
+                return false;
+            }
+
+            img_buffer_width = std::max(1, (int)(upng_width*scale));
+            img_buffer_height = std::max(1, (int)(upng_height*scale));
+            img_buffer.assign(img_buffer_width * img_buffer_height * pixel::RGBA8Depth, 0);
+
+            plan.format = info.format;
+            plan.reduction = 0;
+            while (info.interlaced && (plan.reduction < MaxReduction)
+                && (reducedSize(upng_width, plan.reduction + 1) >= img_buffer_width) && (reducedSize(upng_height, plan.reduction + 1) >= img_buffer_height)) {
+                plan.reduction++;
+            }
+            plan.source_width = reducedSize(upng_width, plan.reduction);
+            plan.source_height = reducedSize(upng_height, plan.reduction);
+            return true;
+        }
+
+        // Size along one axis of an Adam7 image decoded with upng_set_reduction()
+        static int reducedSize(const int size, const u32 reduction) {
+            return (size + (1 << reduction) - 1) >> reduction;
+        }
+
+        // Everything upng allocates comes from the arena, which is reset once the image is decoded
+        // Icons are decoded row by row on the worker alone, never with upng_set_parallel: a parallel decode needs the whole image inflated in memory
+        // at once, which for the large images it helps with is more than the overlay heap has, and the other cores are the game's
+        void decode(const std::vector<u8>& png_data, const DecodePlan& plan, BumpArena& arena) {
+            EMUIIBO_PROFILE_SCOPE(IconDecode);
+            const upng_allocator allocator = arena.getUpngAllocator();
+            upng_t* upng = upng_new_from_bytes_with_allocator(png_data.data(), png_data.size(), &allocator);
+            if (upng == NULL) {
+                arena.reset();
+                setError("Bad file");
+                return;
+            }
+            upng_set_reduction(upng, plan.reduction);
+            if (upng_header(upng) == UPNG_EOK) {
+                RowScaler scaler{};
+                if (prepareScaler(plan, arena, scaler)) {
+                    upng_decode_rows(upng, &PngImage::scaleRow, &scaler);
+                }
+            }
+            setUpngError(upng_get_error(upng));
+            upng_free(upng);
+            arena.reset();
+        }
+
+        void setUpngError(const upng_error error) {
+            switch(error) {
+                case UPNG_EOK: {
+                    break;
+                }
+                case UPNG_ENOMEM: {
+                    setError("Image is too big.");
+                    break;
+                }
+                case UPNG_ENOTFOUND: {
+                    setError("Image not found.");
+                    break;
+                }
+                case UPNG_ENOTPNG: {
+                    setError("Image is not a PNG.");
+                    break;
+                }
+                case UPNG_EMALFORMED: {
+                    setError("PNG malformed.");
+                    break;
+                }
+                case UPNG_EUNSUPPORTED: {
+                    setError("This PNG not supported.");
+                    break;
+                }
+                case UPNG_EUNINTERLACED: {
+                    setError("Image interlacing is not supported.");
+                    break;
+                }
+                case UPNG_EUNFORMAT: {
+                    setError("Image color format is not supported.");
+                    break;
+                }
+                case UPNG_EPARAM: {
+                    setError("Invalid parameter.");
+                    break;
+                }
+                case UPNG_ECHECKSUM: {
+                    setError("Image is corrupted.");
+                    break;
+                }
+            }
+        }
+
+        bool prepareScaler(const DecodePlan& plan, BumpArena& arena, RowScaler& scaler) {
+            scaler.rgba_row = static_cast<u8*>(arena.allocate(plan.source_width * pixel::RGBA8Depth));
+            if (scaler.rgba_row == nullptr) {
+                setError("Image is too big.");
+                return false;
+            }
+
+            scaler.image = this;
+            scaler.format = plan.format;
+            scaler.width = plan.source_width;
+            scaler.area_scaler = std::make_unique<pixel::AreaScaler>(plan.source_width, plan.source_height, img_buffer_width, img_buffer_height);
+            return true;
+        }
+
+        // Area-averaging downscale, done as the scanlines are decoded
+        static void scaleRow(void* user, unsigned y, const unsigned char* row) {
+            auto& scaler = *static_cast<RowScaler*>(user);
+            pixel::ExpandToRGBA8(scaler.format, row, scaler.rgba_row, scaler.width);
+            scaler.area_scaler->PushRow(scaler.rgba_row, scaler.image->img_buffer.data());
+        }
+
+        std::filesystem::path thumbnailPath() const {
+            return path.parent_path() / ".thumb.rgba";
+        }
+
+        // The cached thumbnail is only valid for the same source file and the same requested size
+        bool makeThumbnailKey(const int max_height, const int max_width, ThumbnailHeader& key) const {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) {
+                return false;
+            }
+            key.magic = ThumbnailMagic;
+            key.version = ThumbnailVersion;
+            key.source_mtime = st.st_mtime;
+            key.source_size = st.st_size;
+            key.max_width = max_width;
+            key.max_height = max_height;
+            return true;
+        }
+
+        // Header and pixels are fetched with a single read
+        bool loadThumbnail(const ThumbnailHeader& key) {
+            std::ifstream file(thumbnailPath(), std::ifstream::in | std::ifstream::binary);
+            if (!file) {
+                return false;
+            }
+            std::vector<u8> data(sizeof(ThumbnailHeader) + key.max_width * key.max_height * pixel::RGBA8Depth);
+            file.read(reinterpret_cast<char*>(data.data()), data.size());
+            const size_t read_size = file.gcount();
+            if (read_size < sizeof(ThumbnailHeader)) {
+                return false;
+            }
+            ThumbnailHeader header;
+            std::memcpy(&header, data.data(), sizeof(ThumbnailHeader));
+            if (header.magic != key.magic || header.version != key.version || header.source_mtime != key.source_mtime || header.source_size != key.source_size
+                || header.max_width != key.max_width || header.max_height != key.max_height
+                || header.width == 0 || header.height == 0 || header.width > key.max_width || header.height > key.max_height
+                || read_size != sizeof(ThumbnailHeader) + header.width * header.height * pixel::RGBA8Depth) {
+                return false;
+            }
+            img_buffer.assign(data.begin() + sizeof(ThumbnailHeader), data.begin() + read_size);
+            img_buffer_width = header.width;
+            img_buffer_height = header.height;
+            return true;
+        }
+
+        void saveThumbnail(ThumbnailHeader& key) {
+            key.width = img_buffer_width;
+            key.height = img_buffer_height;
+            std::ofstream file(thumbnailPath(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+            file.write(reinterpret_cast<const char*>(&key), sizeof(ThumbnailHeader));
+            file.write(reinterpret_cast<const char*>(img_buffer.data()), img_buffer.size());
+        }
+
+        void clearImage() {
+            error_text = {};
+            is_error = false;
+            img_buffer.clear();
+            img_buffer_height = 0;
+            img_buffer_width = 0;
+        }
+
+        // The path is kept, so that a broken image is not decoded again on every frame
+        void setError(const std::string &text) {
+            clearImage();
+            is_error = true;
+            error_text = text;
+        }
+};
+
+// Decoded icons keyed by image path, most recently used first
+// Icons are decoded by a worker thread: the cache hands out PngImage objects right away and they become ready once decoded
+// Entries are dropped once the cache goes over its byte budget, but icons still held elsewhere (the active or the focused amiibo) stay alive
+class IconCache {
+
+    private:
+        struct Entry {
+            std::string path;
+            std::shared_ptr<PngImage> image;
+            size_t charged_bytes;
+        };
+
+        struct Job {
+            std::shared_ptr<PngImage> image;
+            std::filesystem::path png_path;
+            int max_height;
+            int max_width;
+        };
+
+        size_t budget_bytes;
+        size_t used_bytes{0};
+        u64 hits{0};
+        u64 misses{0};
+        std::list<Entry> entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        // Used by the worker or by load() when there is no worker, never both
+        PngImage::DecodeScratch decode_scratch;
+
+        async::SpscQueue<Job, 64> jobs;
+        // Jobs which did not fit in the worker queue yet, in the order they were asked for
+        std::deque<Job> deferred_jobs;
+        async::Signal jobs_signal;
+        async::Thread worker;
+        bool worker_running{false};
+        std::atomic<bool> worker_exit{false};
+
+    public:
+        IconCache(const size_t budget) : budget_bytes{budget} {}
+
+        ~IconCache() {
+            stopWorker();
+        }
+
+        void startWorker() {
+            worker_exit = false;
+            worker_running = worker.start([this] {
+                workerMain();
+            }, 0x10000);
+        }
+
+        void stopWorker() {
+            if (!worker_running) {
+                return;
+            }
+            worker_exit = true;
+            jobs_signal.post();
+            worker.join();
+            worker_running = false;
+        }
+
+        // The returned icon may still be loading
+        std::shared_ptr<const PngImage> get(const std::filesystem::path& png_path, const int max_height, const int max_width) {
+            queueDeferredJobs();
+            auto it = index.find(png_path.string());
+            if (it != index.end()) {
+                ++hits;
+                entries.splice(entries.begin(), entries, it->second);
+                return it->second->image;
+            }
+            ++misses;
+            return load(png_path, max_height, max_width);
+        }
+
+        // Queues the icon for decoding if it is not cached yet, without counting a hit or a miss
+        void prefetch(const std::filesystem::path& png_path, const int max_height, const int max_width) {
+            queueDeferredJobs();
+            if (index.count(png_path.string()) == 0) {
+                load(png_path, max_height, max_width);
+            }
+        }
+
+        // Caches an icon which is already loaded, replacing the cached one if any
+        void insert(const std::filesystem::path& png_path, const std::shared_ptr<PngImage>& image, const int max_height, const int max_width) {
+            auto it = index.find(png_path.string());
+            if (it != index.end()) {
+                used_bytes -= it->second->charged_bytes;
+                entries.erase(it->second);
+                index.erase(it);
+            }
+            add(png_path, image, max_height, max_width);
+        }
+
+        // Hands the worker the jobs which did not fit in its queue, as it makes room for them
+        void queueDeferredJobs() {
+            while (!deferred_jobs.empty()) {
+                // Evicted while waiting, nobody wants the icon anymore
+                if (deferred_jobs.front().image.use_count() == 1) {
+                    deferred_jobs.pop_front();
+                    continue;
+                }
+                if (!jobs.push(deferred_jobs.front())) {
+                    break;
+                }
+                deferred_jobs.pop_front();
+                jobs_signal.post();
+            }
+        }
+
+        u64 getHits() const {
+            return hits;
+        }
+
+        u64 getMisses() const {
+            return misses;
+        }
+
+        size_t getUsedBytes() const {
+            return used_bytes;
+        }
+
+    private:
+        std::shared_ptr<PngImage> load(const std::filesystem::path& png_path, const int max_height, const int max_width) {
+            auto image = std::make_shared<PngImage>();
+            if (worker_running) {
+                Job job{image, png_path, max_height, max_width};
+                // Behind the deferred jobs, to keep the order icons were asked for in
+                if (!deferred_jobs.empty() || !jobs.push(job)) {
+                    deferred_jobs.push_back(std::move(job));
+                }
+                else {
+                    jobs_signal.post();
+                }
+            }
+            else {
+                image->openFile(png_path, max_height, max_width, decode_scratch);
+            }
+            add(png_path, image, max_height, max_width);
+            return image;
+        }
+
+        void add(const std::filesystem::path& png_path, const std::shared_ptr<PngImage>& image, const int max_height, const int max_width) {
+            // Charged for the largest possible icon, the actual size is only known once the worker is done with it
+            const size_t charged_bytes = sizeof(PngImage) + max_height * max_width * pixel::RGBA8Depth;
+            entries.push_front(Entry{png_path.string(), image, charged_bytes});
+            index[png_path.string()] = entries.begin();
+            used_bytes += charged_bytes;
+            evict();
+        }
+
+        void evict() {
+            while (used_bytes > budget_bytes && entries.size() > 1) {
+                const auto& oldest = entries.back();
+                used_bytes -= oldest.charged_bytes;
+                index.erase(oldest.path);
+                entries.pop_back();
+            }
+        }
+
+        void workerMain() {
+            while (true) {
+                jobs_signal.wait();
+                if (worker_exit) {
+                    break;
+                }
+                Job job;
+                if (!jobs.pop(job)) {
+                    continue;
+                }
+                // Nobody wants the icon anymore when the job holds the last reference (it was evicted while queued)
+                if (job.image.use_count() > 1) {
+                    job.image->openFile(job.png_path, job.max_height, job.max_width, decode_scratch);
+                }
+            }
+        }
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <switch.h>
+#include <upng.h>
+#include <memory>
+#include <vector>
+
+namespace pixel {
+
+    // Every format is expanded to 4 bytes per pixel, the layout tsl::gfx::Renderer::drawBitmap reads
+    constexpr u32 RGBA8Depth = 4;
+
+    // Converts one unfiltered scanline of the given format into width RGBA8888 pixels
+    // 16-bit samples are truncated to their high byte, grey levels are replicated into the color channels and missing alpha is opaque
+    void ExpandToRGBA8(const upng_format format, const u8 *src, u8 *dst, const u32 width);
+
+    // Fixed-point box filter weights of one axis: destination pixel i averages source pixels first[i] .. first[i] + count[i] - 1,
+    // with the weights starting at weights[offset[i]]
+    struct AxisWeights {
+        std::vector<u32> first;
+        std::vector<u32> count;
+        std::vector<u32> offset;
+        std::vector<u16> weights;
+    };
+
+    // Weights are cached per (src, dst) size pair, since nearly every icon is shrunk between the same sizes
+    std::shared_ptr<const AxisWeights> GetAxisWeights(const u32 src_size, const u32 dst_size);
+
+    // Area-averaging downscaler fed one RGBA8888 source row at a time, in order
+    // Colors are averaged premultiplied by alpha, so transparent pixels do not bleed into the edges of the icon
+    class AreaScaler {
+
+        private:
+            u32 dst_width;
+            u32 dst_height;
+            u32 src_row;
+            u32 dst_row;
+            std::shared_ptr<const AxisWeights> horizontal;
+            std::shared_ptr<const AxisWeights> vertical;
+            std::vector<u16> scaled_row;
+            std::vector<u32> accumulators[2];
+
+        public:
+            AreaScaler(const u32 src_width, const u32 src_height, const u32 dst_width, const u32 dst_height);
+
+            // Every completed destination row is written to dst, which holds dst_width * dst_height RGBA8888 pixels
+            void PushRow(const u8 *rgba_row, u8 *dst);
+
+    };
+
+}
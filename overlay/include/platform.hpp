@@ -0,0 +1,14 @@
+#pragma once
+#include <functional>
+
+namespace platform {
+
+    // Services the core needs from its frontend: the tesla helpers on the console, direct calls on host builds
+
+    // Runs fn with the SD card mounted, calls from different threads never overlap
+    void DoWithSDCard(const std::function<void()>& fn);
+
+    // Runs fn with an open sm session, to look up services
+    void DoWithSmSession(const std::function<void()>& fn);
+
+}
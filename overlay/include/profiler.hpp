@@ -0,0 +1,177 @@
+#pragma once
+
+#ifdef EMUIIBO_DEBUG
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+#include <switch.h>
+
+#ifndef __SWITCH__
+#include <chrono>
+#endif
+
+namespace prof {
+
+    // Frame-time profiler, only built in EMUIIBO_DEBUG builds: scoped timers add up the time spent in each section
+    // during a frame, and every frame of the main page is kept in a ring buffer to compute percentiles from
+
+    enum class Section : u32 {
+        Ipc,
+        IconDecode,
+        ListLayout,
+        Draw,
+        Frame,
+        Count
+    };
+
+    constexpr size_t SectionCount = static_cast<size_t>(Section::Count);
+
+    // A few seconds worth of frames
+    constexpr size_t FrameHistorySize = 256;
+
+    // Anything longer is the main page not being shown (other pages, overlay hidden) rather than a slow frame
+    constexpr u64 FrameGapNs = 1000000000;
+
+    struct SectionStats {
+        u32 frame_count;
+        u64 p50_ns;
+        u64 p95_ns;
+        u64 p99_ns;
+        u64 max_ns;
+    };
+
+    inline const char* GetSectionName(const Section section) {
+        switch(section) {
+            case Section::Ipc: return "IPC";
+            case Section::IconDecode: return "Icon decode";
+            case Section::ListLayout: return "List layout";
+            case Section::Draw: return "Draw";
+            case Section::Frame: return "Frame";
+            default: return "?";
+        }
+    }
+
+    inline u64 GetTicks() {
+#ifdef __SWITCH__
+        return armGetSystemTick();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    inline u64 TicksToNs(const u64 ticks) {
+#ifdef __SWITCH__
+        return armTicksToNs(ticks);
+#else
+        return ticks;
+#endif
+    }
+
+    namespace impl {
+
+        using FrameRecord = std::array<u32, SectionCount>;
+
+        // Icons are decoded by the worker thread, hence atomics for the running frame
+        inline std::array<std::atomic<u64>, SectionCount> g_current_frame{};
+        inline u64 g_frame_start_ticks = 0;
+
+        inline std::array<FrameRecord, FrameHistorySize> g_frames{};
+        inline size_t g_frame_count = 0;
+        inline size_t g_next_frame = 0;
+
+    }
+
+    inline void Record(const Section section, const u64 ticks) {
+        impl::g_current_frame[static_cast<size_t>(section)].fetch_add(ticks, std::memory_order_relaxed);
+    }
+
+    // Closes the running frame, meant to be called once per frame by the page being profiled
+    inline void NextFrame() {
+        const u64 now = GetTicks();
+        impl::FrameRecord record{};
+        for (size_t i = 0; i != SectionCount; ++i) {
+            record[i] = static_cast<u32>(std::min<u64>(impl::g_current_frame[i].exchange(0, std::memory_order_relaxed), UINT32_MAX));
+        }
+        const u64 frame_ticks = now - impl::g_frame_start_ticks;
+        const bool had_frame = impl::g_frame_start_ticks != 0;
+        impl::g_frame_start_ticks = now;
+        if (!had_frame || (TicksToNs(frame_ticks) > FrameGapNs)) {
+            return;
+        }
+        record[static_cast<size_t>(Section::Frame)] = static_cast<u32>(std::min<u64>(frame_ticks, UINT32_MAX));
+        impl::g_frames[impl::g_next_frame] = record;
+        impl::g_next_frame = (impl::g_next_frame + 1) % FrameHistorySize;
+        impl::g_frame_count = std::min(impl::g_frame_count + 1, FrameHistorySize);
+    }
+
+    inline void Reset() {
+        for (auto& ticks: impl::g_current_frame) {
+            ticks.store(0, std::memory_order_relaxed);
+        }
+        impl::g_frame_start_ticks = 0;
+        impl::g_frame_count = 0;
+        impl::g_next_frame = 0;
+    }
+
+    // Time spent in a section over each recorded frame, oldest first
+    inline std::vector<u64> GetSectionHistory(const Section section) {
+        std::vector<u64> history;
+        history.reserve(impl::g_frame_count);
+        const size_t first = (impl::g_next_frame + FrameHistorySize - impl::g_frame_count) % FrameHistorySize;
+        for (size_t i = 0; i != impl::g_frame_count; ++i) {
+            history.push_back(TicksToNs(impl::g_frames[(first + i) % FrameHistorySize][static_cast<size_t>(section)]));
+        }
+        return history;
+    }
+
+    inline SectionStats GetSectionStats(const Section section) {
+        auto history = GetSectionHistory(section);
+        SectionStats stats = { static_cast<u32>(history.size()), 0, 0, 0, 0 };
+        if (history.empty()) {
+            return stats;
+        }
+        const auto percentile = [&history](const size_t pct) {
+            const auto it = history.begin() + (history.size() - 1) * pct / 100;
+            std::nth_element(history.begin(), it, history.end());
+            return *it;
+        };
+        stats.p50_ns = percentile(50);
+        stats.p95_ns = percentile(95);
+        stats.p99_ns = percentile(99);
+        stats.max_ns = *std::max_element(history.begin(), history.end());
+        return stats;
+    }
+
+    class ScopedTimer {
+
+        private:
+            Section section;
+            u64 start_ticks;
+
+        public:
+            ScopedTimer(const Section section) : section{section}, start_ticks{GetTicks()} {}
+
+            ScopedTimer(const ScopedTimer&) = delete;
+            ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+            ~ScopedTimer() {
+                Record(section, GetTicks() - start_ticks);
+            }
+
+    };
+
+}
+
+#define EMUIIBO_PROFILE_CONCAT_IMPL(a, b) a##b
+#define EMUIIBO_PROFILE_CONCAT(a, b) EMUIIBO_PROFILE_CONCAT_IMPL(a, b)
+#define EMUIIBO_PROFILE_SCOPE(section) ::prof::ScopedTimer EMUIIBO_PROFILE_CONCAT(profile_scope_, __LINE__)(::prof::Section::section)
+#define EMUIIBO_PROFILE_NEXT_FRAME() ::prof::NextFrame()
+
+#else
+
+#define EMUIIBO_PROFILE_SCOPE(section)
+#define EMUIIBO_PROFILE_NEXT_FRAME()
+
+#endif
@@ -0,0 +1,659 @@
+#pragma once
+#include <emuiibo.hpp>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <favorites.hpp>
+#include <icons.hpp>
+#include <platform.hpp>
+
+// The folders and virtual amiibos of a listing, packed into a single string buffer
+// Folder listings are fetched from emuiibo a page at a time, as the list scrolls: until the model is complete, more entries may follow the ones it has
+class AmiiboListModel {
+
+    public:
+        enum class Kind : u8 {
+            Folder,
+            Amiibo,
+        };
+
+    private:
+        struct Entry {
+            u32 path_offset;
+            u32 name_offset;
+            Kind kind;
+
+            bool operator==(const Entry& other) const {
+                return (path_offset == other.path_offset) && (name_offset == other.name_offset) && (kind == other.kind);
+            }
+        };
+
+        std::filesystem::path base_path;
+        std::vector<Entry> entries;
+        std::string strings;
+        size_t amiibo_count{0};
+        // Where emuiibo carries on with the listing, 0 before its first page
+        u32 next_cursor{0};
+        bool complete{false};
+
+        u32 addString(const std::string& str) {
+            const u32 offset = strings.size();
+            strings.append(str);
+            strings.push_back('\0');
+            return offset;
+        }
+
+    public:
+        AmiiboListModel(const std::filesystem::path& base) : base_path{base} {}
+
+        // path is relative to the base path, name is what the list shows
+        void add(const Kind kind, const std::string& path, const std::string& name) {
+            const u32 path_offset = addString(path);
+            const u32 name_offset = (name == path) ? path_offset : addString(name);
+            entries.push_back({ path_offset, name_offset, kind });
+            if (kind == Kind::Amiibo) {
+                amiibo_count++;
+            }
+        }
+
+        bool operator==(const AmiiboListModel& other) const {
+            return (base_path == other.base_path) && (entries == other.entries) && (strings == other.strings);
+        }
+
+        // Whether the entries both models have are the same, in the same order: strings are laid out in entry order, so their common prefix matches too
+        bool sharesEntries(const AmiiboListModel& other) const {
+            const size_t count = std::min(size(), other.size());
+            const size_t strings_size = std::min(strings.size(), other.strings.size());
+            return (base_path == other.base_path) && std::equal(entries.begin(), entries.begin() + count, other.entries.begin())
+                && (strings.compare(0, strings_size, other.strings, 0, strings_size) == 0);
+        }
+
+        bool isComplete() const {
+            return complete;
+        }
+
+        u32 getNextCursor() const {
+            return next_cursor;
+        }
+
+        // The cursor emuiibo gave with the last page, 0 once the listing is done
+        void setNextCursor(const u32 cursor) {
+            next_cursor = cursor;
+            complete = (cursor == 0);
+        }
+
+        // Nothing more is to be fetched, for models which are built whole or which cannot be listed further
+        void setComplete() {
+            setNextCursor(0);
+        }
+
+        size_t size() const {
+            return entries.size();
+        }
+
+        size_t getAmiiboCount() const {
+            return amiibo_count;
+        }
+
+        const std::filesystem::path& getBasePath() const {
+            return base_path;
+        }
+
+        Kind getKind(const size_t index) const {
+            return entries[index].kind;
+        }
+
+        std::filesystem::path getPath(const size_t index) const {
+            return base_path / getRelativePath(index);
+        }
+
+        const char* getRelativePath(const size_t index) const {
+            return strings.c_str() + entries[index].path_offset;
+        }
+
+        const char* getName(const size_t index) const {
+            return strings.c_str() + entries[index].name_offset;
+        }
+};
+
+// What the first frame of the overlay shows, saved on exit so that the next launch can paint it before asking emuiibo anything
+class UiSnapshot {
+
+    private:
+        static constexpr u32 Magic = 0x504E5355; // "USNP"
+        static constexpr u32 Version = 2;
+
+        class Writer {
+
+            public:
+                std::vector<u8> data;
+
+                template<typename T>
+                void put(const T& val) {
+                    const auto bytes = reinterpret_cast<const u8*>(&val);
+                    data.insert(data.end(), bytes, bytes + sizeof(T));
+                }
+
+                void putString(const std::string& str) {
+                    put<u16>(str.size());
+                    data.insert(data.end(), str.begin(), str.end());
+                }
+
+        };
+
+        // Every read is bounds checked, a truncated or corrupted file just fails to load
+        class Reader {
+
+            private:
+                const std::vector<u8>& data;
+                size_t offset{0};
+
+            public:
+                Reader(const std::vector<u8>& snapshot_data) : data{snapshot_data} {}
+
+                template<typename T>
+                bool get(T& val) {
+                    if (offset + sizeof(T) > data.size()) {
+                        return false;
+                    }
+                    std::memcpy(&val, data.data() + offset, sizeof(T));
+                    offset += sizeof(T);
+                    return true;
+                }
+
+                bool getString(std::string& str) {
+                    u16 size = 0;
+                    if (!get(size) || (offset + size > data.size())) {
+                        return false;
+                    }
+                    str.assign(reinterpret_cast<const char*>(data.data()) + offset, size);
+                    offset += size;
+                    return true;
+                }
+
+                bool getBytes(std::vector<u8>& bytes, const size_t size) {
+                    if (offset + size > data.size()) {
+                        return false;
+                    }
+                    bytes.assign(data.begin() + offset, data.begin() + offset + size);
+                    offset += size;
+                    return true;
+                }
+
+        };
+
+    public:
+        emu::StatusSnapshot status;
+        std::string active_amiibo_path;
+        emu::VirtualAmiiboData active_amiibo_data;
+        // Scaled icon of the active amiibo, empty if it was not decoded yet
+        u16 icon_max_height{0};
+        u16 icon_max_width{0};
+        u16 icon_height{0};
+        u16 icon_width{0};
+        std::vector<u8> icon_rgba;
+        std::shared_ptr<AmiiboListModel> listing;
+
+        bool save(const std::filesystem::path& snapshot_path) const {
+            Writer writer;
+            writer.put(Magic);
+            writer.put(Version);
+            writer.put(status);
+            writer.putString(active_amiibo_path);
+            writer.put(active_amiibo_data);
+            writer.put(icon_max_height);
+            writer.put(icon_max_width);
+            writer.put(icon_height);
+            writer.put(icon_width);
+            writer.data.insert(writer.data.end(), icon_rgba.begin(), icon_rgba.end());
+            writer.put<u8>(listing != nullptr);
+            if (listing) {
+                writer.putString(listing->getBasePath().string());
+                writer.put<u32>(listing->size());
+                for (size_t i = 0; i != listing->size(); ++i) {
+                    writer.put(listing->getKind(i));
+                    writer.putString(listing->getRelativePath(i));
+                    writer.putString(listing->getName(i));
+                }
+            }
+
+            std::ofstream file(snapshot_path, std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+            return static_cast<bool>(file.write(reinterpret_cast<const char*>(writer.data.data()), writer.data.size()));
+        }
+
+        bool load(const std::filesystem::path& snapshot_path) {
+            std::ifstream file(snapshot_path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+            if (!file) {
+                return false;
+            }
+            std::vector<u8> data(file.tellg());
+            file.seekg(0);
+            if (!file.read(reinterpret_cast<char*>(data.data()), data.size())) {
+                return false;
+            }
+
+            Reader reader{data};
+            u32 magic = 0;
+            u32 version = 0;
+            if (!reader.get(magic) || !reader.get(version) || (magic != Magic) || (version != Version)) {
+                return false;
+            }
+            if (!reader.get(status) || !reader.getString(active_amiibo_path) || !reader.get(active_amiibo_data)) {
+                return false;
+            }
+            if (!reader.get(icon_max_height) || !reader.get(icon_max_width) || !reader.get(icon_height) || !reader.get(icon_width)
+                || (icon_height > icon_max_height) || (icon_width > icon_max_width)
+                || !reader.getBytes(icon_rgba, icon_height * icon_width * pixel::RGBA8Depth)) {
+                return false;
+            }
+            u8 has_listing = 0;
+            if (!reader.get(has_listing)) {
+                return false;
+            }
+            listing.reset();
+            if (has_listing) {
+                std::string base_path;
+                u32 entry_count = 0;
+                if (!reader.getString(base_path) || !reader.get(entry_count)) {
+                    return false;
+                }
+                AmiiboListModel model{base_path};
+                for (u32 i = 0; i != entry_count; ++i) {
+                    AmiiboListModel::Kind kind;
+                    std::string path;
+                    std::string name;
+                    if (!reader.get(kind) || (kind != AmiiboListModel::Kind::Folder && kind != AmiiboListModel::Kind::Amiibo) || !reader.getString(path) || !reader.getString(name)) {
+                        return false;
+                    }
+                    model.add(kind, path, name);
+                }
+                // Whatever was listed then is all that is shown until the folder is listed again
+                model.setComplete();
+                listing = std::make_shared<AmiiboListModel>(std::move(model));
+            }
+            return true;
+        }
+};
+
+class EmuiiboState {
+
+    public:
+        // Entries emuiibo lists per request
+        static constexpr size_t VirtualAmiiboListPageSize = 32;
+
+    private:
+        // A dozen or so scaled icons, a small share of the overlay heap
+        static constexpr size_t IconCacheBudget = 1024 * 1024;
+
+        bool emuiibo_init_ok{false};
+        std::filesystem::path emuiibo_amiibo_dir;
+        emu::Version emuiibo_version;
+        std::filesystem::path active_amiibo_path;
+        emu::VirtualAmiiboData active_amiibo_data;
+        std::optional<u32> active_amiibo_generation;
+        emu::StatusSnapshot status_snapshot{emu::EmulationStatus::Off, emu::VirtualAmiiboStatus::Invalid, 0, false};
+        Event state_change_event{};
+        bool state_change_event_ok{false};
+        bool status_outdated{true};
+        IconCache icon_cache{IconCacheBudget};
+        std::shared_ptr<const PngImage> amiibo_image;
+        FavoritesStore favorites;
+        int icon_max_height{0};
+        int icon_max_width{0};
+        // Listing of the folder browsed last, kept for the snapshot
+        std::shared_ptr<AmiiboListModel> last_listing;
+
+        static std::string favoritesFile() {
+            return "favorites.bin";
+        }
+
+        // Plain list of paths, as saved by older versions
+        static std::string legacyFavoritesFile() {
+            return "favorites.txt";
+        }
+
+        static std::string uiSnapshotFile() {
+            return "overlay_snapshot.bin";
+        }
+
+        std::filesystem::path favoritesPath() const {
+            return std::filesystem::path{getEmuiiboVirtualAmiiboPath()} / favoritesFile();
+        }
+
+        std::filesystem::path uiSnapshotPath() const {
+            return std::filesystem::path{getEmuiiboVirtualAmiiboPath()}.parent_path() / uiSnapshotFile();
+        }
+
+
+    public:
+        bool isEmuiiboOk() const {
+            return emuiibo_init_ok;
+        }
+
+        bool isCurrentApplicationIdIntercepted() const {
+            return status_snapshot.is_application_id_intercepted;
+        }
+
+        bool isActiveAmiiboValid() const {
+            return !active_amiibo_path.empty();
+        }
+
+        const emu::Version& getEmuiiboVersion() const {
+            return emuiibo_version;
+        }
+
+        std::string getEmuiiboVersionString() const {
+            if (!isEmuiiboOk()) {
+                return "emuiibo not found...";
+            }
+            const auto& emuiibo_version = getEmuiiboVersion();
+            return std::to_string(emuiibo_version.major) + "." + std::to_string(emuiibo_version.minor) + "." + std::to_string(emuiibo_version.micro) + " (" + (emuiibo_version.dev_build ? "dev" : "release") + ")";
+        }
+
+        emu::EmulationStatus getEmulationStatus() const {
+            return status_snapshot.emulation_status;
+        }
+
+        std::string getEmuiiboVirtualAmiiboPath() const {
+            return emuiibo_amiibo_dir;
+        }
+
+        std::string getActiveVirtualAmiiboPath() const {
+            return active_amiibo_path;
+        }
+
+        emu::VirtualAmiiboStatus getActiveVirtualAmiiboStatus() const {
+            if(!isActiveAmiiboValid()) {
+                return emu::VirtualAmiiboStatus::Invalid;
+            }
+            return status_snapshot.active_virtual_amiibo_status;
+        }
+
+        // Fetches every status shown by the UI in a single request, meant to be called once per frame
+        // Nothing is requested until emuiibo signals a change, and the active amiibo is only reloaded when it was replaced
+        void refreshStatus() {
+            if(state_change_event_ok && R_SUCCEEDED(eventWait(&state_change_event, 0))) {
+                emu::InvalidateInterceptedApplicationCache();
+                status_outdated = true;
+            }
+            if(!status_outdated) {
+                return;
+            }
+            status_outdated = !state_change_event_ok;
+            emu::StatusSnapshot snapshot = {};
+            if(R_FAILED(emu::GetStatusSnapshot(emu::GetCurrentApplicationId(), &snapshot))) {
+                status_outdated = true;
+                return;
+            }
+            status_snapshot = snapshot;
+            if(active_amiibo_generation != snapshot.active_virtual_amiibo_generation) {
+                active_amiibo_generation = snapshot.active_virtual_amiibo_generation;
+                loadActiveAmiibo();
+            }
+        }
+
+        const emu::VirtualAmiiboData& getActiveVirtualAmiiboAmiiboData() const {
+            return active_amiibo_data;
+        }
+
+        bool getVirtualAmiiboAmiiboData(const std::string& path, emu::VirtualAmiiboData& data) const {
+            return R_SUCCEEDED(emu::TryParseVirtualAmiibo(const_cast<char*>(path.c_str()), path.size(), &data));
+        }
+
+        // Appends the next page of the folder listing of model, as parsed by emuiibo
+        // A page emuiibo fails to list leaves model as it was, incomplete and at the same cursor, so that the page can be asked for again later
+        bool fetchVirtualAmiiboDirectoryPage(AmiiboListModel& model) const {
+            std::vector<emu::VirtualAmiiboListEntry> entries(VirtualAmiiboListPageSize);
+            const auto path = model.getBasePath().string();
+            emu::VirtualAmiiboListPage page = {};
+            if (R_FAILED(emu::ListVirtualAmiiboDirectory(const_cast<char*>(path.c_str()), path.size(), model.getNextCursor(), entries.data(), entries.size(), &page))) {
+                return false;
+            }
+            for (u32 i = 0; i != page.entry_count; ++i) {
+                const auto& entry = entries[i];
+                if (entry.kind == emu::VirtualAmiiboListEntryKind::Amiibo) {
+                    model.add(AmiiboListModel::Kind::Amiibo, entry.name, entry.data.name);
+                }
+                else {
+                    model.add(AmiiboListModel::Kind::Folder, entry.name, entry.name);
+                }
+            }
+            model.setNextCursor(page.next_cursor);
+            return true;
+        }
+
+        // Fetches pages until model has at least count entries or is complete, false if a page failed first
+        bool fetchVirtualAmiiboDirectory(AmiiboListModel& model, const size_t count) const {
+            while (!model.isComplete() && (model.size() < count)) {
+                if (!fetchVirtualAmiiboDirectoryPage(model)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const std::shared_ptr<const PngImage>& image() const {
+            return amiibo_image;
+        }
+
+        // Icons are scaled to fit these bounds, which depend on the layout of the frontend
+        void setIconSize(const int max_height, const int max_width) {
+            icon_max_height = max_height;
+            icon_max_width = max_width;
+        }
+
+        std::shared_ptr<const PngImage> getIcon(const std::filesystem::path& amiibo_path) {
+            return icon_cache.get(amiibo_path / "amiibo.png", icon_max_height, icon_max_width);
+        }
+
+        void prefetchIcon(const std::filesystem::path& amiibo_path) {
+            icon_cache.prefetch(amiibo_path / "amiibo.png", icon_max_height, icon_max_width);
+        }
+
+        // Once a frame, so that icons which did not fit in the loader queue are not left waiting for the next lookup
+        void updateIconLoader() {
+            icon_cache.queueDeferredJobs();
+        }
+
+        void startIconLoader() {
+            icon_cache.startWorker();
+        }
+
+        void stopIconLoader() {
+            icon_cache.stopWorker();
+        }
+
+        const IconCache& getIconCache() const {
+            return icon_cache;
+        }
+
+        void initEmuiibo() {
+            platform::DoWithSmSession([this] {
+                if(emu::IsAvailable()) {
+                    emuiibo_init_ok = R_SUCCEEDED(emu::Initialize()) && R_SUCCEEDED(pmdmntInitialize()) && R_SUCCEEDED(pminfoInitialize());
+                    if(emuiibo_init_ok) {
+                        emuiibo_version = emu::GetVersion();
+                        char emuiibo_amiibo_dir_str[FS_MAX_PATH];
+                        emu::GetVirtualAmiiboDirectory(emuiibo_amiibo_dir_str, FS_MAX_PATH);
+                        emuiibo_amiibo_dir = std::string(emuiibo_amiibo_dir_str);
+                        state_change_event_ok = R_SUCCEEDED(emu::AttachStateChangeEvent(&state_change_event));
+                    }
+                }
+            });
+        }
+
+        void exitEmuiibo() {
+            if(state_change_event_ok) {
+                eventClose(&state_change_event);
+                state_change_event_ok = false;
+            }
+        }
+
+        void setEmulationStatus(const emu::EmulationStatus status) {
+            emu::SetEmulationStatus(status);
+            status_snapshot.emulation_status = status;
+        }
+
+        void toggleEmulationStatus() {
+            switch(getEmulationStatus()) {
+            case emu::EmulationStatus::On: {
+                    setEmulationStatus(emu::EmulationStatus::Off);
+                    break;
+                }
+            case emu::EmulationStatus::Off: {
+                    setEmulationStatus(emu::EmulationStatus::On);
+                    break;
+                }
+            }
+        }
+
+        void setActiveVirtualAmiibo(const std::string & path) {
+            emu::SetActiveVirtualAmiibo(const_cast<char*>(path.c_str()), path.size());
+            status_outdated = true;
+            refreshStatus();
+        }
+
+        void ResetActiveVirtualAmiibo() {
+            emu::ResetActiveVirtualAmiibo();
+            status_outdated = true;
+            refreshStatus();
+        }
+
+        void setActiveVirtualAmiiboStatus(const emu::VirtualAmiiboStatus status) {
+            emu::SetActiveVirtualAmiiboStatus(status);
+            status_snapshot.active_virtual_amiibo_status = status;
+        }
+
+        void toggleActiveVirtualAmiiboStatus() {
+            switch(getActiveVirtualAmiiboStatus()) {
+                case emu::VirtualAmiiboStatus::Connected: {
+                    setActiveVirtualAmiiboStatus(emu::VirtualAmiiboStatus::Disconnected);
+                    break;
+                }
+                case emu::VirtualAmiiboStatus::Disconnected: {
+                    setActiveVirtualAmiiboStatus(emu::VirtualAmiiboStatus::Connected);
+                    break;
+                }
+                case emu::VirtualAmiiboStatus::Invalid: {
+                    break;
+                }
+            }
+        }
+
+        void loadActiveAmiibo() {
+            char active_amiibo_path_str[FS_MAX_PATH];
+            emu::GetActiveVirtualAmiibo(&active_amiibo_data, active_amiibo_path_str, FS_MAX_PATH);
+            active_amiibo_path = std::string(active_amiibo_path_str);
+
+            amiibo_image.reset();
+            if(isActiveAmiiboValid()) {
+                amiibo_image = getIcon(active_amiibo_path);
+            }
+        }
+
+        void loadFavorites() {
+            platform::DoWithSDCard([this](){
+                favorites.load(getEmuiiboVirtualAmiiboPath(), favoritesPath(), std::filesystem::path{getEmuiiboVirtualAmiiboPath()} / legacyFavoritesFile());
+            });
+        }
+
+        // Nothing is written unless favorites changed since they were loaded
+        void saveFavorites() {
+            if (!favorites.isDirty()) {
+                return;
+            }
+            platform::DoWithSDCard([this](){
+                favorites.flush(favoritesPath());
+            });
+        }
+
+        // Shows what the previous session left, without asking emuiibo anything: refreshStatus() revalidates all of it afterwards
+        bool loadUiSnapshot() {
+            UiSnapshot snapshot;
+            bool loaded = false;
+            platform::DoWithSDCard([&] {
+                loaded = snapshot.load(uiSnapshotPath());
+            });
+            if (!loaded) {
+                return false;
+            }
+
+            status_snapshot = snapshot.status;
+            status_outdated = true;
+            active_amiibo_generation.reset();
+            active_amiibo_path = snapshot.active_amiibo_path;
+            active_amiibo_data = snapshot.active_amiibo_data;
+            amiibo_image.reset();
+            if (isActiveAmiiboValid()) {
+                if (!snapshot.icon_rgba.empty() && (snapshot.icon_max_height == icon_max_height) && (snapshot.icon_max_width == icon_max_width)) {
+                    const auto png_path = active_amiibo_path / "amiibo.png";
+                    auto image = std::make_shared<PngImage>();
+                    image->openPixels(png_path, snapshot.icon_width, snapshot.icon_height, std::move(snapshot.icon_rgba));
+                    icon_cache.insert(png_path, image, icon_max_height, icon_max_width);
+                    amiibo_image = image;
+                }
+                else {
+                    amiibo_image = getIcon(active_amiibo_path);
+                }
+            }
+
+            last_listing = std::move(snapshot.listing);
+            return true;
+        }
+
+        // Meant to be called on exit
+        void saveUiSnapshot() const {
+            if (!isEmuiiboOk()) {
+                return;
+            }
+            UiSnapshot snapshot;
+            snapshot.status = status_snapshot;
+            snapshot.active_amiibo_path = active_amiibo_path.string();
+            snapshot.active_amiibo_data = active_amiibo_data;
+            if (amiibo_image && amiibo_image->isReady() && amiibo_image->getRGBABuffer()) {
+                snapshot.icon_max_height = icon_max_height;
+                snapshot.icon_max_width = icon_max_width;
+                snapshot.icon_height = amiibo_image->getHeight();
+                snapshot.icon_width = amiibo_image->getWidth();
+                snapshot.icon_rgba.assign(amiibo_image->getRGBABuffer(), amiibo_image->getRGBABuffer() + amiibo_image->getHeight() * amiibo_image->getWidth() * pixel::RGBA8Depth);
+            }
+            snapshot.listing = last_listing;
+            platform::DoWithSDCard([&] {
+                snapshot.save(uiSnapshotPath());
+            });
+        }
+
+        // The listing of path as it was last shown, if it was the last folder browsed
+        std::shared_ptr<AmiiboListModel> getLastListing(const std::filesystem::path& path) const {
+            if (last_listing && (last_listing->getBasePath() == path)) {
+                return last_listing;
+            }
+            return nullptr;
+        }
+
+        void setLastListing(const std::shared_ptr<AmiiboListModel>& listing) {
+            last_listing = listing;
+        }
+
+        std::vector<std::filesystem::path> getFavorites() const {
+            return favorites.getAll();
+        }
+
+        void addToFavorite(const std::filesystem::path& path) {
+            favorites.add(path);
+        }
+
+        void removeFromFavorite(const std::filesystem::path& path) {
+            favorites.remove(path);
+        }
+
+        bool isFavorite(const std::filesystem::path& path) const {
+            return favorites.contains(path);
+        }
+};
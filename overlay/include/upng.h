@@ -34,9 +34,10 @@ typedef enum upng_error {
 	UPNG_ENOTPNG		= 3, /* image data does not have a PNG header */
 	UPNG_EMALFORMED		= 4, /* image data is not a valid PNG image */
 	UPNG_EUNSUPPORTED	= 5, /* critical PNG chunk type is not supported */
-	UPNG_EUNINTERLACED	= 6, /* image interlacing is not supported */
+	UPNG_EUNINTERLACED	= 6, /* no longer returned, Adam7 interlaced images are supported */
 	UPNG_EUNFORMAT		= 7, /* image color format is not supported */
-	UPNG_EPARAM			= 8  /* invalid parameter to method call */
+	UPNG_EPARAM			= 8, /* invalid parameter to method call */
+	UPNG_ECHECKSUM		= 9  /* the CRC of a critical chunk or the adler32 of the image data does not match */
 } upng_error;
 
 typedef enum upng_format {
@@ -57,12 +58,54 @@ typedef enum upng_format {
 
 typedef struct upng_t upng_t;
 
+/* the signature and the IHDR chunk with its CRC: all upng_probe needs to read */
+#define UPNG_HEADER_SIZE	33
+
+/* what the IHDR chunk says about an image */
+typedef struct upng_info {
+	unsigned	width;
+	unsigned	height;
+	unsigned	bpp;
+	upng_format	format;
+	unsigned	interlaced;	/* 1 for Adam7, see upng_set_reduction */
+} upng_info;
+
+/* every allocation made for an image; free may be NULL if memory is released in bulk (an arena).
+   with a parallel_for set, alloc and free may be called from several of its tasks at once */
+typedef struct upng_allocator {
+	void*	(*alloc)(void* user, unsigned long size);
+	void	(*free)(void* user, void* ptr);
+	void*	user;
+} upng_allocator;
+
+/* runs task(task_user, index) for every index in [0, count), on as many threads as the caller likes, and returns once all of them are done */
+typedef void (*upng_task)(void* task_user, unsigned index);
+typedef void (*upng_parallel_for)(void* user, unsigned count, upng_task task, void* task_user);
+
+/* one unfiltered scanline of (width * bpp + 7) / 8 bytes; interlaced images are handed out once fully decoded */
+typedef void (*upng_row_callback)(void* user, unsigned y, const unsigned char* row);
+
 upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
 upng_t*		upng_new_from_file	(const char* path);
+upng_t*		upng_new_from_bytes_with_allocator	(const unsigned char* buffer, unsigned long size, const upng_allocator* allocator);
 void		upng_free			(upng_t* upng);
 
+/* the CRCs of the critical chunks and the adler32 of the image data are checked unless this is turned off (verify = 0), before upng_header */
+void		upng_set_verify		(upng_t* upng, int verify);
+
+/* decodes only the first Adam7 passes, as the image of every (1 << shift)-th pixel and row: 3 (at most) is the first pass,
+   2 the first 3 passes, 1 the first 5. upng_get_width/height give the reduced size, non-interlaced images are decoded whole */
+void		upng_set_reduction	(upng_t* upng, unsigned shift);
+
+/* lets upng_decode inflate and unfilter large images on several threads, where the image data allows it; NULL decodes on the calling thread only */
+void		upng_set_parallel	(upng_t* upng, upng_parallel_for parallel_for, void* user);
+
+/* checks the first UPNG_HEADER_SIZE bytes of a file like upng_header does, without allocating anything; info is only filled on success */
+upng_error	upng_probe			(const unsigned char* buffer, unsigned long size, upng_info* info);
+
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
+upng_error	upng_decode_rows	(upng_t* upng, upng_row_callback callback, void* user);
 
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
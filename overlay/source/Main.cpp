@@ -3,11 +3,9 @@
 #include <emuiibo.hpp>
 #include <tesla.hpp>
 #include <tesla_extensions.hpp>
-#include <dirent.h>
 #include <filesystem>
-#include <fstream>
-#include <set>
-#include <upng.h>
+#include <state.hpp>
+#include <profiler.hpp>
 
 namespace {
     enum Action : u64 {
@@ -19,6 +17,10 @@ namespace {
         RemoveFromFavorite = KEY_X,
         ToogleConnectAmiibo = KEY_RSTICK,
         ResetActiveAmiibo = KEY_MINUS,
+#ifdef EMUIIBO_DEBUG
+        ShowDebug = KEY_ZR,
+        ShowProfiler = KEY_ZL,
+#endif
     };
     std::string actionGlyph(const Action action) {
         static const std::unordered_map<u64, std::string> KEY_GLYPH = {
@@ -56,351 +58,29 @@ namespace {
     int maxIconWidth() {
         return tsl::cfg::LayerWidth / 2 - 2 * marginIcon();
     }
-    std::string favoritesFile() {
-        return "favorites.txt";
+    int iconPrefetchCount() {
+        return 3;
+    }
+    size_t amiiboListRowPoolSize() {
+        // Rows the bottom section can show at once, plus some margin above and below
+        return 16;
     }
 }
 
-class PngImage {
-
-    private:
-        std::filesystem::path path;
-        bool is_error{false};
-        std::string error_text{""};
-        std::vector<u8> img_buffer{};
-        int img_buffer_width{0};
-        int img_buffer_height{0};
-
-    public:
-        PngImage() {
-        }
-
-        ~PngImage() {
-            closeFile();
-        }
-
-        void openFile(const std::filesystem::path &png_path, const int max_height, const int max_width) {
-            closeFile();
-            path = png_path;
-            tsl::hlp::doWithSDCardHandle([this, max_height, max_width] {
-                upng_t* upng = upng_new_from_file(path.c_str());
-                if (upng == NULL) {
-                    setError("Bad file");
-                    return;
-                }
-                upng_decode(upng);
-                switch(upng_get_error(upng)) {
-                    case UPNG_EOK: {
-                        bool is_rgb = ( upng_get_format(upng) == UPNG_RGB8 || upng_get_format(upng) == UPNG_RGB16 );
-                        /*
-                        *  DELETE ONCE RGB DOWNSCALE WORKS PROPERLY
-                        */
-                        if (is_rgb){
-                            setError("Please use RGBA PNG.");
-                            break;
-                        }
-                        /* DELETE END */
-
-                        int upng_width = upng_get_width(upng);
-                        int upng_height = upng_get_height(upng);
-                        int bpp = upng_get_bpp(upng);
-                        int bitdepth = upng_get_bitdepth(upng);
-                        int img_depth = bpp/bitdepth;
-                        double scale1 = (double)max_height / (double)upng_height;
-                        double scale2 = (double)max_width / (double)upng_width;
-                        double scale = std::min(scale1, scale2);
-                        if (scale > 1.0) {
-                            setError("Upscale not allowed.");
-                            break;
-                        }
-
-                        img_buffer_width = upng_width*scale;
-                        img_buffer_height = upng_height*scale;
-                        img_buffer.resize(img_buffer_width * img_buffer_height * img_depth);
-                        std::fill(img_buffer.begin(), img_buffer.end(), 0);
-
-                        /* DEBUG STRING START * /
-                        std::string dbg_string;
-                        if ( is_rgb ) {
-                            dbg_string += "RGB - ";
-                            //MAKE SOME MAGIC HERE TO PROPERLY DOWNSCALE RGB
-                        } else {
-                            dbg_string += "RGBA - ";
-                        }
-                        dbg_string += std::to_string(bpp) + "/" + std::to_string(bitdepth) + " ";
-                        dbg_string += std::to_string(img_depth);
-                        / * DEBUG STRING END */
-
-                        for(int h = 0; h != img_buffer_height; ++h) {
-                            for(int w = 0; w != img_buffer_width; ++w) {
-                                int pixel = (h * (img_buffer_width *img_depth)) + (w*img_depth);
-                                int nearestMatch =  (((int)(h / scale) * (upng_width *img_depth)) + ((int)(w / scale) *img_depth));
-                                for(int d = 0; d != img_depth; ++d) {
-                                    img_buffer[pixel + d] =  upng_get_buffer(upng)[nearestMatch + d];
-                                }
-                            }
-                        }
-                        break;
-                    }
-                    case UPNG_ENOMEM: {
-                        setError("Image is too big.");
-                        break;
-                    }
-                    case UPNG_ENOTFOUND: {
-                        setError("Image not found.");
-                        break;
-                    }
-                    case UPNG_ENOTPNG: {
-                        setError("Image is not a PNG.");
-                        break;
-                    }
-                    case UPNG_EMALFORMED: {
-                        setError("PNG malformed.");
-                        break;
-                    }
-                    case UPNG_EUNSUPPORTED: {
-                        setError("This PNG not supported.");
-                        break;
-                    }
-                    case UPNG_EUNINTERLACED: {
-                        setError("Image interlacing is not supported.");
-                        break;
-                    }
-                    case UPNG_EUNFORMAT: {
-                        setError("Image color format is not supported.");
-                        break;
-                    }
-                    case UPNG_EPARAM: {
-                        setError("Invalid parameter.");
-                        break;
-                    }
-                }
-                upng_free(upng);
-            });
-        }
-
-        void closeFile() {
-            path.clear();
-            error_text = {};
-            is_error = false;
-            img_buffer.clear();
-            img_buffer_height = 0;
-            img_buffer_width = 0;
-        }
-
-        const std::filesystem::path getPath() {
-            return path;
-        }
-
-        const u8* getRGBABuffer() const {
-            if (img_buffer.empty()) {
-                return nullptr;
-            }
-            return img_buffer.data();
-        }
-
-        const int getHeight() const {
-            return img_buffer_height;
-        }
-
-        const int getWidth() const {
-            return img_buffer_width;
-        }
-
-        bool isError() const {
-            return is_error;
-        }
-
-        std::string getError() const {
-            return error_text;
-        }
-
-    private:
-
-        void setError(const std::string &text) {
-            closeFile();
-            is_error = true;
-            error_text = text;
-        }
-};
-
-class EmuiiboState {
-
-    private:
-        bool emuiibo_init_ok{false};
-        std::filesystem::path emuiibo_amiibo_dir;
-        emu::Version emuiibo_version;
-        std::filesystem::path active_amiibo_path;
-        emu::VirtualAmiiboData active_amiibo_data;
-        PngImage amiibo_image;
-        std::set<std::filesystem::path> favorites;
-
-    public:
-        bool isEmuiiboOk() const {
-            return emuiibo_init_ok;
-        }
-
-        bool isCurrentApplicationIdIntercepted() const {
-            return emu::IsCurrentApplicationIdIntercepted();
-        }
-
-        bool isActiveAmiiboValid() const {
-            return !active_amiibo_path.empty();
-        }
-
-        const emu::Version& getEmuiiboVersion() const {
-            return emuiibo_version;
-        }
-
-        std::string getEmuiiboVersionString() const {
-            if (!isEmuiiboOk()) {
-                return "emuiibo not found...";
-            }
-            const auto& emuiibo_version = getEmuiiboVersion();
-            return std::to_string(emuiibo_version.major) + "." + std::to_string(emuiibo_version.minor) + "." + std::to_string(emuiibo_version.micro) + " (" + (emuiibo_version.dev_build ? "dev" : "release") + ")";
-        }
-
-        emu::EmulationStatus getEmulationStatus() const {
-            return emu::GetEmulationStatus();
-        }
-
-        std::string getEmuiiboVirtualAmiiboPath() const {
-            return emuiibo_amiibo_dir;
-        }
-
-        std::string getActiveVirtualAmiiboPath() const {
-            return active_amiibo_path;
-        }
-
-        emu::VirtualAmiiboStatus getActiveVirtualAmiiboStatus() const {
-            if(!isActiveAmiiboValid()) {
-                return emu::VirtualAmiiboStatus::Invalid;
-            }
-            return emu::GetActiveVirtualAmiiboStatus();
-        }
-
-        const emu::VirtualAmiiboData& getActiveVirtualAmiiboAmiiboData() const {
-            return active_amiibo_data;
-        }
-
-        bool getVirtualAmiiboAmiiboData(const std::string& path, emu::VirtualAmiiboData& data) const {
-            return R_SUCCEEDED(emu::TryParseVirtualAmiibo(const_cast<char*>(path.c_str()), path.size(), &data));
-        }
-
-        const PngImage& image() const {
-            return amiibo_image;
-        }
-
-        void initEmuiibo() {
-            tsl::hlp::doWithSmSession([this] {
-                if(emu::IsAvailable()) {
-                    emuiibo_init_ok = R_SUCCEEDED(emu::Initialize()) && R_SUCCEEDED(pmdmntInitialize()) && R_SUCCEEDED(pminfoInitialize());
-                    if(emuiibo_init_ok) {
-                        emuiibo_version = emu::GetVersion();
-                        char emuiibo_amiibo_dir_str[FS_MAX_PATH];
-                        emu::GetVirtualAmiiboDirectory(emuiibo_amiibo_dir_str, FS_MAX_PATH);
-                        emuiibo_amiibo_dir = std::string(emuiibo_amiibo_dir_str);
-                    }
-                }
-            });
-        }
+namespace platform {
 
-        void setEmulationStatus(const emu::EmulationStatus status) {
-            emu::SetEmulationStatus(status);
-        }
-
-        void toggleEmulationStatus() {
-            switch(getEmulationStatus()) {
-            case emu::EmulationStatus::On: {
-                    setEmulationStatus(emu::EmulationStatus::Off);
-                    break;
-                }
-            case emu::EmulationStatus::Off: {
-                    setEmulationStatus(emu::EmulationStatus::On);
-                    break;
-                }
-            }
-        }
-
-        void setActiveVirtualAmiibo(const std::string & path) {
-            emu::SetActiveVirtualAmiibo(const_cast<char*>(path.c_str()), path.size());
-            loadActiveAmiibo();
-        }
-
-        void ResetActiveVirtualAmiibo() {
-            emu::ResetActiveVirtualAmiibo();
-            loadActiveAmiibo();
-        }
-
-        void setActiveVirtualAmiiboStatus(const emu::VirtualAmiiboStatus status) {
-            emu::SetActiveVirtualAmiiboStatus(status);
-        }
-
-        void toggleActiveVirtualAmiiboStatus() {
-            switch(getActiveVirtualAmiiboStatus()) {
-                case emu::VirtualAmiiboStatus::Connected: {
-                    setActiveVirtualAmiiboStatus(emu::VirtualAmiiboStatus::Disconnected);
-                    break;
-                }
-                case emu::VirtualAmiiboStatus::Disconnected: {
-                    setActiveVirtualAmiiboStatus(emu::VirtualAmiiboStatus::Connected);
-                    break;
-                }
-                case emu::VirtualAmiiboStatus::Invalid: {
-                    break;
-                }
-            }
-        }
-
-        void loadActiveAmiibo() {
-            char active_amiibo_path_str[FS_MAX_PATH];
-            emu::GetActiveVirtualAmiibo(&active_amiibo_data, active_amiibo_path_str, FS_MAX_PATH);
-            active_amiibo_path = std::string(active_amiibo_path_str);
-
-            amiibo_image.closeFile();
-            if(isActiveAmiiboValid()) {
-                amiibo_image.openFile(active_amiibo_path / "amiibo.png", maxIconHeigth(), maxIconWidth());
-            }
-        }
-
-        void loadFavorites() {
-            favorites.clear();
-            tsl::hlp::doWithSDCardHandle([this](){
-                std::ifstream file(std::filesystem::path{getEmuiiboVirtualAmiiboPath()} / favoritesFile());
-                std::string path_str;
-                while (std::getline(file, path_str)) {
-                    const std::filesystem::path path{path_str};
-                    addToFavorite(getEmuiiboVirtualAmiiboPath() / path);
-                }
-            });
-        }
-
-        void saveFavorites() {
-            tsl::hlp::doWithSDCardHandle([this](){
-                std::ofstream file(std::filesystem::path{getEmuiiboVirtualAmiiboPath()} / favoritesFile(), std::ofstream::out | std::ofstream::trunc);
-                for (const auto path: favorites) {
-                    file << path.lexically_relative(getEmuiiboVirtualAmiiboPath()).string() << std::endl;
-                }
-            });
-        }
-
-        std::list<std::filesystem::path> getFavorites() const {
-            const std::list<std::filesystem::path> out{favorites.begin(), favorites.end()};
-            return out;
-        }
-
-        void addToFavorite(const std::filesystem::path& path) {
-            favorites.insert(path);
-        }
+    // The SD card is mounted for every access, so the icon worker and the UI thread have to take turns
+    void DoWithSDCard(const std::function<void()>& fn) {
+        static async::Mutex sd_card_mutex;
+        std::lock_guard<async::Mutex> lock(sd_card_mutex);
+        tsl::hlp::doWithSDCardHandle(fn);
+    }
 
-        void removeFromFavorite(const std::filesystem::path& path) {
-            favorites.erase(path);
-        }
+    void DoWithSmSession(const std::function<void()>& fn) {
+        tsl::hlp::doWithSmSession(fn);
+    }
 
-        bool isFavorite(const std::filesystem::path& path) const {
-            return favorites.count(path) != 0;
-        }
-};
+}
 
 class GuiListElement: public tslext::elm::SmallListItem {
     private:
@@ -442,6 +122,13 @@ class GuiListElement: public tslext::elm::SmallListItem {
             update();
         }
 
+        // List rows are recycled while scrolling, so the same element shows another entry from now on
+        void rebind(const std::filesystem::path& path, const std::string& label) {
+            amiibo_path = path;
+            setText(label);
+            update();
+        }
+
         virtual bool canBeFavorite() const {
             return false;
         }
@@ -462,7 +149,7 @@ class ActionListElement: public GuiListElement {
 
 class FolderListElement: public GuiListElement {
     public:
-        FolderListElement(std::shared_ptr<EmuiiboState> state, const std::filesystem::path& path) : GuiListElement(state, path, path.filename()) {
+        FolderListElement(std::shared_ptr<EmuiiboState> state) : GuiListElement(state, {}, "") {
             update();
         }
 
@@ -475,7 +162,7 @@ class FolderListElement: public GuiListElement {
 
 class AmiiboListElement: public GuiListElement {
     public:
-        AmiiboListElement(std::shared_ptr<EmuiiboState> state, const std::filesystem::path& path, const emu::VirtualAmiiboData& data) : GuiListElement(state, path, data.name) {
+        AmiiboListElement(std::shared_ptr<EmuiiboState> state) : GuiListElement(state, {}, "") {
             update();
         }
 
@@ -490,27 +177,232 @@ class AmiiboListElement: public GuiListElement {
         }
 };
 
+// Scrolling list which only keeps elements for the entries around the visible ones, recycling them as the focus moves
+// Opening a folder costs the same number of elements whether it holds twenty amiibos or thousands
+class AmiiboList: public tsl::elm::Element {
+
+    private:
+        static constexpr size_t NoIndex = SIZE_MAX;
+
+        std::shared_ptr<const AmiiboListModel> model;
+        std::function<AmiiboListElement*()> amiibo_row_factory;
+        std::function<FolderListElement*()> folder_row_factory;
+        std::vector<AmiiboListElement*> amiibo_rows;
+        std::vector<FolderListElement*> folder_rows;
+        // Entry currently shown by each row slot, entry i always goes to slot i % pool size
+        std::vector<size_t> bound_entries;
+        size_t max_pool_size;
+        size_t window_first{0};
+        size_t focused_index{0};
+        s32 row_height{0};
+        s32 offset{0};
+
+        size_t poolSize() const {
+            return bound_entries.size();
+        }
+
+        GuiListElement* rowFor(const size_t index) const {
+            const size_t slot = index % poolSize();
+            if (model->getKind(index) == AmiiboListModel::Kind::Amiibo) {
+                return amiibo_rows[slot];
+            }
+            return folder_rows[slot];
+        }
+
+        void measureRows() {
+            if ((row_height != 0) || (poolSize() == 0)) {
+                return;
+            }
+            // Rows size themselves on layout, every row has the same height
+            auto row = amiibo_rows.front();
+            row->setBoundaries(getX(), getY(), getWidth(), 0);
+            row->layout(getX(), getY(), getWidth(), getHeight());
+            row_height = row->getHeight();
+        }
+
+        size_t visibleCount() {
+            if (row_height == 0) {
+                return poolSize();
+            }
+            return std::min<size_t>(getHeight() / row_height + 2, poolSize());
+        }
+
+        size_t firstVisible() const {
+            return (row_height == 0) ? 0 : (offset / row_height);
+        }
+
+        void scrollToFocused() {
+            if (row_height == 0) {
+                return;
+            }
+            const s32 focused_top = focused_index * row_height;
+            if (focused_top < offset) {
+                offset = focused_top;
+            }
+            else if (focused_top + row_height > offset + getHeight()) {
+                offset = focused_top + row_height - getHeight();
+            }
+            const s32 max_offset = std::max<s32>(model->size() * row_height - getHeight(), 0);
+            offset = std::clamp<s32>(offset, 0, max_offset);
+        }
+
+        // Keeps the pooled rows centered around the visible entries, rebinding the ones which moved out of the window
+        void slideWindow() {
+            const size_t count = model->size();
+            const size_t pool_size = poolSize();
+            const size_t margin = (pool_size - visibleCount()) / 2;
+            const size_t first_visible = firstVisible();
+            size_t first = (first_visible > margin) ? (first_visible - margin) : 0;
+            first = std::min(first, count - pool_size);
+            window_first = first;
+            for (size_t index = first; index != first + pool_size; ++index) {
+                const size_t slot = index % pool_size;
+                if (bound_entries[slot] != index) {
+                    bound_entries[slot] = index;
+                    rowFor(index)->rebind(model->getPath(index), model->getName(index));
+                }
+            }
+        }
+
+        Element* focusIndex(const size_t index) {
+            focused_index = index;
+            scrollToFocused();
+            slideWindow();
+            invalidate();
+            return rowFor(index);
+        }
+
+    public:
+        AmiiboList(std::shared_ptr<const AmiiboListModel> list_model, const size_t pool_size, const std::function<AmiiboListElement*()>& make_amiibo_row, const std::function<FolderListElement*()>& make_folder_row) : amiibo_row_factory{make_amiibo_row}, folder_row_factory{make_folder_row}, max_pool_size{pool_size} {
+            setModel(std::move(list_model));
+        }
+
+        virtual ~AmiiboList() {
+            for (auto row: amiibo_rows) {
+                delete row;
+            }
+            for (auto row: folder_rows) {
+                delete row;
+            }
+        }
+
+        const std::shared_ptr<const AmiiboListModel>& getModel() const {
+            return model;
+        }
+
+        // Rows are only created as the listing needs them, and rebound to the new entries, the focus stays on the same index if it still exists
+        void setModel(std::shared_ptr<const AmiiboListModel> list_model) {
+            model = std::move(list_model);
+            bound_entries.clear();
+            resizeModel();
+        }
+
+        // The model got entries added or removed at its end: the rows keep the entries they show unless the pool has to grow or shrink
+        void resizeModel() {
+            const size_t row_count = std::min(max_pool_size, model->size());
+            while (amiibo_rows.size() < row_count) {
+                amiibo_rows.push_back(amiibo_row_factory());
+                amiibo_rows.back()->setParent(this);
+                folder_rows.push_back(folder_row_factory());
+                folder_rows.back()->setParent(this);
+            }
+            if (row_count != poolSize()) {
+                bound_entries.assign(row_count, NoIndex);
+            }
+            focused_index = std::min(focused_index, (model->size() != 0) ? (model->size() - 1) : 0);
+            if (row_count != 0) {
+                scrollToFocused();
+                slideWindow();
+            }
+            invalidate();
+        }
+
+        // One past the last entry the pooled rows are bound to
+        size_t getWindowEnd() const {
+            return window_first + poolSize();
+        }
+
+        size_t getFocusedIndex() const {
+            return focused_index;
+        }
+
+        virtual void draw(tsl::gfx::Renderer* renderer) override {
+            EMUIIBO_PROFILE_SCOPE(Draw);
+            if (poolSize() == 0) {
+                return;
+            }
+            renderer->enableScissoring(getX(), getY(), getWidth(), getHeight());
+            const size_t last = std::min(firstVisible() + visibleCount(), model->size());
+            for (size_t index = firstVisible(); index < last; ++index) {
+                rowFor(index)->frame(renderer);
+            }
+            renderer->disableScissoring();
+
+            const s32 list_height = model->size() * row_height;
+            if (list_height > getHeight()) {
+                const s32 scrollbar_height = std::max<s32>(getHeight() * getHeight() / list_height, 10);
+                const s32 scrollbar_offset = offset * (getHeight() - scrollbar_height) / (list_height - getHeight());
+                renderer->drawRect(getX() + getWidth() + 10, getY() + scrollbar_offset, 5, scrollbar_height, a(tsl::style::color::ColorHandle));
+            }
+        }
+
+        virtual void layout(u16 parentX, u16 parentY, u16 parentWidth, u16 parentHeight) override {
+            EMUIIBO_PROFILE_SCOPE(ListLayout);
+            if (poolSize() == 0) {
+                return;
+            }
+            measureRows();
+            scrollToFocused();
+            slideWindow();
+            for (size_t index = window_first; index != window_first + poolSize(); ++index) {
+                auto row = rowFor(index);
+                row->setBoundaries(getX(), getY() + static_cast<s32>(index) * row_height - offset, getWidth(), row_height);
+                row->invalidate();
+            }
+        }
+
+        virtual tsl::elm::Element* requestFocus(tsl::elm::Element* old_focus, tsl::FocusDirection direction) override {
+            if (poolSize() == 0) {
+                return nullptr;
+            }
+            switch (direction) {
+                case tsl::FocusDirection::None:
+                    return focusIndex(focused_index);
+                case tsl::FocusDirection::Up:
+                    return (focused_index > 0) ? focusIndex(focused_index - 1) : old_focus;
+                case tsl::FocusDirection::Down:
+                    return (focused_index + 1 < model->size()) ? focusIndex(focused_index + 1) : old_focus;
+                default:
+                    return old_focus;
+            }
+        }
+};
+
 class AmiiboIcons: public tsl::elm::Element {
 
     private:
         std::shared_ptr<EmuiiboState> emuiibo;
-        PngImage curent_amiibo_image;
+        std::filesystem::path curent_amiibo_path;
+        std::shared_ptr<const PngImage> curent_amiibo_image;
 
     public:
         AmiiboIcons(std::shared_ptr<EmuiiboState> state) : emuiibo{state} {}
 
         void setCurrentAmiiboPath(std::filesystem::path amiibo_path) {
             if (amiibo_path.empty()) {
-                curent_amiibo_image.closeFile();
+                curent_amiibo_path.clear();
+                curent_amiibo_image.reset();
                 return;
             }
-            if (curent_amiibo_image.getPath() != amiibo_path) {
-                curent_amiibo_image.openFile(amiibo_path / "amiibo.png", maxIconHeigth(), maxIconWidth());
+            if (!curent_amiibo_image || curent_amiibo_path != amiibo_path) {
+                curent_amiibo_path = amiibo_path;
+                curent_amiibo_image = emuiibo->getIcon(amiibo_path);
             }
         }
 
     private:
         virtual void draw(gfx::Renderer* renderer) override {
+            EMUIIBO_PROFILE_SCOPE(Draw);
             renderer->enableScissoring(ELEMENT_BOUNDS(this));
             drawCustom(renderer, ELEMENT_BOUNDS(this));
             renderer->disableScissoring();
@@ -519,14 +411,25 @@ class AmiiboIcons: public tsl::elm::Element {
         virtual void layout(u16 parentX, u16 parentY, u16 parentWidth, u16 parentHeight) override {
         }
 
-        void drawIcon(tsl::gfx::Renderer* renderer, s32 x, s32 y, s32 w, s32 h, const PngImage& image) {
+        void drawIcon(tsl::gfx::Renderer* renderer, s32 x, s32 y, s32 w, s32 h, const std::shared_ptr<const PngImage>& icon) {
+            if (!icon) {
+                return;
+            }
+            const auto& image = *icon;
             const auto margin_icon = marginIcon();
+            const auto font_size = 15;
+            if (!image.isReady()) {
+                renderer->drawString("Loading...", false,
+                                     x + margin_icon,
+                                     y + h / 2,
+                                     font_size, renderer->a(tsl::style::color::ColorDescription));
+                return;
+            }
             if(image.getRGBABuffer()){
                 renderer->drawBitmap(x + margin_icon / 2 + w / 2 - image.getWidth() / 2,
                                      y + margin_icon,
                                      image.getWidth(), image.getHeight(), image.getRGBABuffer());
             } else {
-                const auto font_size = 15;
                 renderer->drawString(image.getError().c_str(), false,
                                      x + margin_icon,
                                      y + h / 2,
@@ -542,6 +445,156 @@ class AmiiboIcons: public tsl::elm::Element {
         }
 };
 
+#ifdef EMUIIBO_DEBUG
+
+// Latency of every emuiibo command requested so far, reached from the help page
+class AmiiboGuiIpcStats : public tsl::Gui {
+
+    private:
+        std::shared_ptr<EmuiiboState> emuiibo;
+        std::unordered_map<u32, tslext::elm::SmallListItem*> command_items;
+
+        static std::string formatStats(const emu::CommandStats& stats) {
+            return std::to_string(stats.count) + "x " + std::to_string(stats.total_ns / stats.count / 1000) + "/" + std::to_string(stats.p99_ns / 1000) + "/" + std::to_string(stats.max_ns / 1000) + "us" + (stats.failures ? " (" + std::to_string(stats.failures) + " failed)" : "");
+        }
+
+    public:
+        AmiiboGuiIpcStats(std::shared_ptr<EmuiiboState> state) : emuiibo{state} {}
+
+        virtual tsl::elm::Element* createUI() override {
+            auto root_frame = new tslext::elm::DoubleSectionOverlayFrame("emuiibo IPC", "avg/p99/max", tslext::SectionsLayout::big_top, false);
+            auto top_list = new tsl::elm::List();
+            root_frame->setTopSection(top_list);
+            auto bottom_list = new tsl::elm::List();
+            root_frame->setBottomSection(bottom_list);
+
+            for (const auto& stats: emu::GetCommandStats()) {
+                auto item = new tslext::elm::SmallListItem(emu::GetCommandName(stats.command_id), formatStats(stats));
+                command_items[stats.command_id] = item;
+                top_list->addItem(item);
+            }
+
+            auto dump_item = new tslext::elm::SmallListItem("Dump to SD card", actionGlyph(Action::ActivateItem));
+            dump_item->setClickListener([this, dump_item](u64 keys) {
+                if (keys & Action::ActivateItem) {
+                    const auto dump_path = std::filesystem::path{emuiibo->getEmuiiboVirtualAmiiboPath()}.parent_path() / "overlay_ipc_stats.csv";
+                    bool dumped = false;
+                    platform::DoWithSDCard([&] {
+                        dumped = emu::DumpCommandStats(dump_path.c_str());
+                    });
+                    dump_item->setValue(dumped ? "saved" : "failed");
+                    return true;
+                }
+                return false;
+            });
+            bottom_list->addItem(dump_item);
+
+            auto reset_item = new tslext::elm::SmallListItem("Reset", actionGlyph(Action::ActivateItem));
+            reset_item->setClickListener([](u64 keys) {
+                if (keys & Action::ActivateItem) {
+                    emu::ResetCommandStats();
+                    return true;
+                }
+                return false;
+            });
+            bottom_list->addItem(reset_item);
+
+            return root_frame;
+        }
+
+        virtual void update() override {
+            for (auto& [command_id, item]: command_items) {
+                item->setValue("-");
+            }
+            for (const auto& stats: emu::GetCommandStats()) {
+                const auto it = command_items.find(stats.command_id);
+                if (it != command_items.end()) {
+                    it->second->setValue(formatStats(stats));
+                }
+            }
+            tsl::Gui::update();
+        }
+};
+
+// Frame times of the main page, and the time spent in its costly sections, reached from the help page
+class AmiiboGuiProfiler : public tsl::Gui {
+
+    private:
+        static constexpr u64 HistogramBucketNs = 2000000;
+        static constexpr size_t HistogramBucketCount = 17;
+
+        std::unordered_map<u32, tslext::elm::SmallListItem*> section_items;
+        std::array<u32, HistogramBucketCount> frame_histogram{};
+
+        static std::string formatStats(const prof::SectionStats& stats) {
+            if (stats.frame_count == 0) {
+                return "-";
+            }
+            return std::to_string(stats.p50_ns / 1000) + "/" + std::to_string(stats.p95_ns / 1000) + "/" + std::to_string(stats.p99_ns / 1000) + "/" + std::to_string(stats.max_ns / 1000) + "us";
+        }
+
+        // Frame times in 2ms buckets, the last one holding anything slower
+        void updateHistogram() {
+            frame_histogram.fill(0);
+            for (const auto frame_ns: prof::GetSectionHistory(prof::Section::Frame)) {
+                frame_histogram[std::min<size_t>(frame_ns / HistogramBucketNs, HistogramBucketCount - 1)]++;
+            }
+        }
+
+        void drawHistogram(tsl::gfx::Renderer* renderer, s32 x, s32 y, s32 w, s32 h) {
+            const u32 max_count = std::max<u32>(*std::max_element(frame_histogram.begin(), frame_histogram.end()), 1);
+            const s32 label_height = 20;
+            const s32 bar_area_height = h - label_height;
+            const s32 bucket_width = w / HistogramBucketCount;
+            for (size_t i = 0; i != HistogramBucketCount; ++i) {
+                const s32 bar_height = bar_area_height * frame_histogram[i] / max_count;
+                renderer->drawRect(x + i * bucket_width + 1, y + bar_area_height - bar_height, bucket_width - 2, bar_height, renderer->a(tsl::style::color::ColorHighlight));
+            }
+            renderer->drawString("0", false, x, y + h - 4, 15, renderer->a(tsl::style::color::ColorDescription));
+            renderer->drawString(std::to_string((HistogramBucketCount - 1) * HistogramBucketNs / 1000000).append("+ ms").c_str(), false, x + (HistogramBucketCount - 1) * bucket_width, y + h - 4, 15, renderer->a(tsl::style::color::ColorDescription));
+        }
+
+    public:
+        virtual tsl::elm::Element* createUI() override {
+            auto root_frame = new tslext::elm::DoubleSectionOverlayFrame("emuiibo profiler", "p50/p95/p99/max", tslext::SectionsLayout::big_top, false);
+            auto top_list = new tsl::elm::List();
+            root_frame->setTopSection(top_list);
+            auto bottom_list = new tsl::elm::List();
+            root_frame->setBottomSection(bottom_list);
+
+            for (size_t section = 0; section != prof::SectionCount; ++section) {
+                auto item = new tslext::elm::SmallListItem(prof::GetSectionName(static_cast<prof::Section>(section)), "-");
+                section_items[section] = item;
+                top_list->addItem(item);
+            }
+            top_list->addItem(new tsl::elm::CustomDrawer([this](tsl::gfx::Renderer* renderer, s32 x, s32 y, s32 w, s32 h) {
+                drawHistogram(renderer, x, y, w, h);
+            }), 100);
+
+            auto reset_item = new tslext::elm::SmallListItem("Reset", actionGlyph(Action::ActivateItem));
+            reset_item->setClickListener([](u64 keys) {
+                if (keys & Action::ActivateItem) {
+                    prof::Reset();
+                    return true;
+                }
+                return false;
+            });
+            bottom_list->addItem(reset_item);
+
+            return root_frame;
+        }
+
+        virtual void update() override {
+            for (auto& [section, item]: section_items) {
+                item->setValue(formatStats(prof::GetSectionStats(static_cast<prof::Section>(section))));
+            }
+            updateHistogram();
+            tsl::Gui::update();
+        }
+};
+
+#endif
+
 class AmiiboGuiHelp : public tsl::Gui {
 
     private:
@@ -564,6 +617,21 @@ class AmiiboGuiHelp : public tsl::Gui {
             top_list->addItem(new tslext::elm::SmallListItem("Remove from favorites", actionGlyph(Action::RemoveFromFavorite)));
             top_list->addItem(new tslext::elm::SmallListItem("Reset active amiibo", actionGlyph(Action::ResetActiveAmiibo)));
 
+#ifdef EMUIIBO_DEBUG
+            // Deliberately not listed above
+            root_frame->setClickListener([this](u64 keys) {
+                if (keys & Action::ShowDebug) {
+                    tsl::changeTo<AmiiboGuiIpcStats>(emuiibo);
+                    return true;
+                }
+                if (keys & Action::ShowProfiler) {
+                    tsl::changeTo<AmiiboGuiProfiler>();
+                    return true;
+                }
+                return false;
+            });
+#endif
+
             return root_frame;
         }
 };
@@ -588,6 +656,17 @@ class AmiiboGui : public tsl::Gui {
         AmiiboIcons* amiibo_icons;
         tsl::elm::List *top_list{nullptr};
         tsl::elm::List *bottom_list{nullptr};
+        tslext::elm::SmallListItem *amiibo_count_item{nullptr};
+        AmiiboList *amiibo_list{nullptr};
+        // What amiibo_list shows, folder listings grow as it scrolls
+        std::shared_ptr<AmiiboListModel> list_model;
+        size_t prefetch_index{SIZE_MAX};
+        // createUI and the first frame both update before anything is drawn, emuiibo is only asked once that frame shows what is already known
+        u32 updates_before_refresh{2};
+        bool listing_outdated{false};
+        // A folder emuiibo failed to list is only asked again after a while, instead of every frame
+        static constexpr u32 ListingRetryUpdates = 60;
+        u32 updates_before_listing_retry{0};
 
     public:
         AmiiboGui(std::shared_ptr<EmuiiboState> state, const Type type, const std::filesystem::path &path) : emuiibo{state}, gui_type{type}, base_path(path) {}
@@ -599,55 +678,39 @@ class AmiiboGui : public tsl::Gui {
             // Top and bottom containers
             top_list = new tsl::elm::List();
             root_frame->setTopSection(top_list);
-            bottom_list = new tsl::elm::List();
-            root_frame->setBottomSection(bottom_list);
 
             if(!emuiibo->isEmuiiboOk()) {
+                root_frame->setBottomSection(new tsl::elm::List());
                 return root_frame;
             }
 
             // Iterate base folder
-            u32 amiibo_count = 0;
             if (gui_type == Type::Root) {
+                bottom_list = new tsl::elm::List();
+                root_frame->setBottomSection(bottom_list);
                 bottom_list->addItem(createRootElement());
                 bottom_list->addItem(createFavoritesElement());
                 bottom_list->addItem(createResetElement());
                 bottom_list->addItem(createHelpElement());
             }
             else {
-                std::list<std::filesystem::path> dir_paths;
                 if (gui_type == Type::Favorites) {
-                    dir_paths = emuiibo->getFavorites();
+                    list_model = createFavoritesModel();
                 }
                 if (gui_type == Type::Folder) {
-                    tsl::hlp::doWithSDCardHandle([base_path = base_path, &dir_paths](){
-                        auto dir = opendir(base_path.c_str());
-                        if(dir) {
-                            while(true) {
-                                auto entry = readdir(dir);
-                                if(entry == nullptr) {
-                                    break;
-                                }
-                                if(!(entry->d_type & DT_DIR)) {
-                                    continue;
-                                }
-                                const auto dir_path = base_path / entry->d_name;
-                                dir_paths.push_back(dir_path);
-                            }
-                            closedir(dir);
-                        }
-                    });
-                }
-                for (const auto dir_path: dir_paths) {
-                    if (tsl::elm::Element* item = createAmiiboElement(dir_path)) {
-                        bottom_list->addItem(item);
-                        amiibo_count++;
-                        continue;
-                    }
-                    if (tsl::elm::Element* item = createFolderElement(dir_path)) {
-                        bottom_list->addItem(item);
+                    // The folder browsed last is shown as it was then, and listed again once the first frame is drawn
+                    list_model = emuiibo->getLastListing(base_path);
+                    listing_outdated = (list_model != nullptr);
+                    if (!list_model) {
+                        list_model = std::make_shared<AmiiboListModel>(base_path);
+                        emuiibo->fetchVirtualAmiiboDirectory(*list_model, amiiboListRowPoolSize() + EmuiiboState::VirtualAmiiboListPageSize);
+                        emuiibo->setLastListing(list_model);
                     }
                 }
+                amiibo_list = new AmiiboList(list_model, amiiboListRowPoolSize(),
+                                             [this]() { return createAmiiboElement(); },
+                                             [this]() { return createFolderElement(); });
+                root_frame->setBottomSection(amiibo_list);
             }
 
             // emuiibo emulation status
@@ -674,7 +737,8 @@ class AmiiboGui : public tsl::Gui {
             top_list->addItem(amiibo_icons, maxIconHeigth() + 2 * marginIcon());
 
             // Information about base folder
-            top_list->addItem(new tslext::elm::SmallListItem(std::string("Available amiibos in '") + base_path.filename().string() + "'", std::to_string(amiibo_count)));
+            amiibo_count_item = new tslext::elm::SmallListItem(std::string("Available amiibos in '") + base_path.filename().string() + "'", amiiboCountText());
+            top_list->addItem(amiibo_count_item);
 
             // Main key bindings
             root_frame->setClickListener([&](u64 keys) {
@@ -717,9 +781,27 @@ class AmiiboGui : public tsl::Gui {
         }
 
         virtual void update() override {
+            EMUIIBO_PROFILE_NEXT_FRAME();
             if(!emuiibo->isEmuiiboOk()) {
                 return;
             }
+            emuiibo->updateIconLoader();
+            if (updates_before_refresh != 0) {
+                --updates_before_refresh;
+            }
+            else {
+                EMUIIBO_PROFILE_SCOPE(Ipc);
+                emuiibo->refreshStatus();
+                if (updates_before_listing_retry != 0) {
+                    --updates_before_listing_retry;
+                }
+                else {
+                    if (listing_outdated) {
+                        revalidateListing();
+                    }
+                    fetchListingAhead();
+                }
+            }
 
             game_header->setColoredValue(emuiibo->isCurrentApplicationIdIntercepted() ? "intercepted" : "not intercepted",
                                          emuiibo->isCurrentApplicationIdIntercepted() ? tsl::style::color::ColorHighlight : tslext::style::color::ColorWarning);
@@ -735,6 +817,7 @@ class AmiiboGui : public tsl::Gui {
 
             if (auto* amiibo_item = dynamic_cast<AmiiboListElement*>(getFocusedElement())) {
                 amiibo_icons->setCurrentAmiiboPath(amiibo_item->getPath());
+                prefetchNeighbourIcons();
             }
             else {
                 amiibo_icons->setCurrentAmiiboPath({});
@@ -779,20 +862,95 @@ class AmiiboGui : public tsl::Gui {
             return item;
         }
 
-        tsl::elm::Element* createFolderElement(const std::filesystem::path& path) {
-            auto item = new FolderListElement(emuiibo, path);
+        FolderListElement* createFolderElement() {
+            auto item = new FolderListElement(emuiibo);
             item->setActionListener([this](auto& caller) {
                 tsl::changeTo<AmiiboGui>(emuiibo, Type::Folder, caller.getPath());
             });
             return item;
         }
 
-        tsl::elm::Element* createAmiiboElement(const std::filesystem::path& path) {
-            emu::VirtualAmiiboData data = {};
-            if(!emuiibo->getVirtualAmiiboAmiiboData(path, data)) {
-                return nullptr;
+        // Favorites are stored as full paths
+        std::shared_ptr<AmiiboListModel> createFavoritesModel() {
+            auto model = std::make_shared<AmiiboListModel>(std::filesystem::path{});
+            for (const auto dir_path: emuiibo->getFavorites()) {
+                emu::VirtualAmiiboData data = {};
+                if (emuiibo->getVirtualAmiiboAmiiboData(dir_path, data)) {
+                    model->add(AmiiboListModel::Kind::Amiibo, dir_path.string(), data.name);
+                    continue;
+                }
+                model->add(AmiiboListModel::Kind::Folder, dir_path.string(), dir_path.filename().string());
+            }
+            model->setComplete();
+            return model;
+        }
+
+        // A folder which is not listed to its end yet may hold more amiibos than the ones counted so far
+        std::string amiiboCountText() const {
+            const auto count = list_model ? list_model->getAmiiboCount() : 0;
+            return std::to_string(count) + ((list_model && !list_model->isComplete()) ? "+" : "");
+        }
+
+        // Keeps a page of entries listed past the rows of the list, the rest of the folder is only listed once it scrolls that close
+        void fetchListingAhead() {
+            if (!amiibo_list || list_model->isComplete()) {
+                return;
             }
-            auto item = new AmiiboListElement(emuiibo, path, data);
+            const size_t old_size = list_model->size();
+            if (!emuiibo->fetchVirtualAmiiboDirectory(*list_model, amiibo_list->getWindowEnd() + EmuiiboState::VirtualAmiiboListPageSize)) {
+                updates_before_listing_retry = ListingRetryUpdates;
+            }
+            if (list_model->size() != old_size) {
+                amiibo_list->resizeModel();
+            }
+            if ((list_model->size() != old_size) || list_model->isComplete()) {
+                amiibo_count_item->setValue(amiiboCountText());
+            }
+        }
+
+        // The folder is listed again as far as the list shows it, the list is only reset if the entries it had changed
+        void revalidateListing() {
+            auto model = std::make_shared<AmiiboListModel>(base_path);
+            if (!emuiibo->fetchVirtualAmiiboDirectory(*model, amiibo_list->getWindowEnd() + EmuiiboState::VirtualAmiiboListPageSize)) {
+                // The listing shown so far stays until the folder can be listed again
+                updates_before_listing_retry = ListingRetryUpdates;
+                return;
+            }
+            listing_outdated = false;
+            if (list_model->sharesEntries(*model)) {
+                // Whatever was shown past the entries listed again is dropped, and listed again as the list scrolls there
+                *list_model = std::move(*model);
+                amiibo_list->resizeModel();
+                amiibo_count_item->setValue(amiiboCountText());
+                return;
+            }
+            list_model = model;
+            emuiibo->setLastListing(list_model);
+            amiibo_list->setModel(list_model);
+            amiibo_count_item->setValue(amiiboCountText());
+            prefetch_index = SIZE_MAX;
+            requestFocus((list_model->size() != 0) ? static_cast<tsl::elm::Element*>(amiibo_list) : top_list, tsl::FocusDirection::None);
+        }
+
+        // Queues the icons of the amiibos around the focused one, closest first, so that scrolling finds them already decoded
+        void prefetchNeighbourIcons() {
+            if (!amiibo_list || (amiibo_list->getFocusedIndex() == prefetch_index)) {
+                return;
+            }
+            prefetch_index = amiibo_list->getFocusedIndex();
+            const auto& model = *amiibo_list->getModel();
+            const int focused_index = prefetch_index;
+            for (int distance = 1; distance <= iconPrefetchCount(); ++distance) {
+                for (const int index: { focused_index + distance, focused_index - distance }) {
+                    if (index >= 0 && index < (int)model.size() && model.getKind(index) == AmiiboListModel::Kind::Amiibo) {
+                        emuiibo->prefetchIcon(model.getPath(index));
+                    }
+                }
+            }
+        }
+
+        AmiiboListElement* createAmiiboElement() {
+            auto item = new AmiiboListElement(emuiibo);
             item->setActionListener([this](auto& caller) {
                 if (emuiibo->getActiveVirtualAmiiboPath() != caller.getPath()) {
                     emuiibo->setActiveVirtualAmiibo(caller.getPath());
@@ -816,17 +974,25 @@ class EmuiiboOverlay : public tsl::Overlay {
 
         virtual void initServices() override {
             emuiibo->initEmuiibo();
+            emuiibo->startIconLoader();
         }
 
         virtual void exitServices() override {
+            emuiibo->stopIconLoader();
             emuiibo->saveFavorites();
+            emuiibo->saveUiSnapshot();
+            emuiibo->exitEmuiibo();
             pminfoExit();
             pmdmntExit();
             emu::Exit();
         }
 
         virtual std::unique_ptr<tsl::Gui> loadInitialGui() override {
-            emuiibo->loadActiveAmiibo();
+            emuiibo->setIconSize(maxIconHeigth(), maxIconWidth());
+            // The state left by the previous session is shown right away, AmiiboGui asks emuiibo once it is on screen
+            if(emuiibo->isEmuiiboOk() && !emuiibo->loadUiSnapshot()) {
+                emuiibo->refreshStatus();
+            }
             emuiibo->loadFavorites();
             return initially<AmiiboGui>(emuiibo, AmiiboGui::Type::Root, "<root>");
         }
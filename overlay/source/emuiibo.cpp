@@ -1,4 +1,7 @@
 #include <emuiibo.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdio>
 
 #define EMU_EMUIIBO_SRV "emuiibo"
 
@@ -6,6 +9,57 @@ namespace emu {
 
     static Service g_emuiibo_srv;
 
+    static u64 g_current_process_id = 0;
+    static u64 g_current_program_id = 0;
+    static u64 g_intercepted_program_id = 0;
+    static bool g_intercepted = false;
+
+#ifdef EMUIIBO_DEBUG
+
+    constexpr u32 CommandCount = 14;
+    constexpr size_t RecentLatencyCount = 256;
+
+    struct CommandRecord {
+        u32 count;
+        u32 failures;
+        u64 total_ticks;
+        u64 min_ticks;
+        u64 max_ticks;
+        std::array<u64, RecentLatencyCount> recent_ticks;
+    };
+
+    static std::array<CommandRecord, CommandCount> g_command_records = {};
+
+    static void RecordCommand(u32 cmd_id, u64 ticks, Result rc) {
+        if(cmd_id >= CommandCount) {
+            return;
+        }
+        auto &record = g_command_records[cmd_id];
+        record.recent_ticks[record.count % RecentLatencyCount] = ticks;
+        record.min_ticks = (record.count == 0) ? ticks : std::min(record.min_ticks, ticks);
+        record.max_ticks = std::max(record.max_ticks, ticks);
+        record.total_ticks += ticks;
+        record.count++;
+        if(R_FAILED(rc)) {
+            record.failures++;
+        }
+    }
+
+#endif
+
+    // Every request goes through here, so that debug builds can time them
+    template<typename F>
+    static inline Result Dispatch(u32 cmd_id, F dispatch_fn) {
+#ifdef EMUIIBO_DEBUG
+        const auto start_tick = armGetSystemTick();
+        const auto rc = dispatch_fn(cmd_id);
+        RecordCommand(cmd_id, armGetSystemTick() - start_tick, rc);
+        return rc;
+#else
+        return dispatch_fn(cmd_id);
+#endif
+    }
+
     bool IsAvailable() {
         auto srv_name = smEncodeName(EMU_EMUIIBO_SRV);
         Handle tmph = 0;
@@ -26,78 +80,241 @@ namespace emu {
 
     void Exit() {
         serviceClose(&g_emuiibo_srv);
+        g_current_process_id = 0;
+        g_current_program_id = 0;
+        InvalidateInterceptedApplicationCache();
     }
 
     Version GetVersion() {
         Version ver = {};
-        serviceDispatchOut(&g_emuiibo_srv, 0, ver);
+        Dispatch(0, [&](u32 cmd_id) {
+            return serviceDispatchOut(&g_emuiibo_srv, cmd_id, ver);
+        });
         return ver;
     }
 
     void GetVirtualAmiiboDirectory(char *out_path, size_t out_path_size) {
-        serviceDispatch(&g_emuiibo_srv, 1,
-            .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
-            .buffers = { { out_path, out_path_size } },
-        );
+        Dispatch(1, [&](u32 cmd_id) {
+            return serviceDispatch(&g_emuiibo_srv, cmd_id,
+                .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_Out },
+                .buffers = { { out_path, out_path_size } },
+            );
+        });
     }
 
     EmulationStatus GetEmulationStatus() {
         u32 out = 0;
-        serviceDispatchOut(&g_emuiibo_srv, 2, out);
+        Dispatch(2, [&](u32 cmd_id) {
+            return serviceDispatchOut(&g_emuiibo_srv, cmd_id, out);
+        });
         return static_cast<EmulationStatus>(out);
     }
 
     void SetEmulationStatus(EmulationStatus status) {
         u32 in = static_cast<u32>(status);
-        serviceDispatchIn(&g_emuiibo_srv, 3, in);
+        Dispatch(3, [&](u32 cmd_id) {
+            return serviceDispatchIn(&g_emuiibo_srv, cmd_id, in);
+        });
     }
 
     Result GetActiveVirtualAmiibo(VirtualAmiiboData *out_amiibo_data, char *out_path, size_t out_path_size) {
-        return serviceDispatchOut(&g_emuiibo_srv, 4, *out_amiibo_data,
-            .buffer_attrs = {
-                SfBufferAttr_HipcMapAlias | SfBufferAttr_Out
-            },
-            .buffers = {
-                { out_path, out_path_size }
-            },
-        );
+        return Dispatch(4, [&](u32 cmd_id) {
+            return serviceDispatchOut(&g_emuiibo_srv, cmd_id, *out_amiibo_data,
+                .buffer_attrs = {
+                    SfBufferAttr_HipcMapAlias | SfBufferAttr_Out
+                },
+                .buffers = {
+                    { out_path, out_path_size }
+                },
+            );
+        });
     }
 
     Result SetActiveVirtualAmiibo(char *path, size_t path_size) {
-        return serviceDispatch(&g_emuiibo_srv, 5,
-            .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
-            .buffers = { { path, path_size } },
-        );
+        return Dispatch(5, [&](u32 cmd_id) {
+            return serviceDispatch(&g_emuiibo_srv, cmd_id,
+                .buffer_attrs = { SfBufferAttr_HipcMapAlias | SfBufferAttr_In },
+                .buffers = { { path, path_size } },
+            );
+        });
     }
 
     void ResetActiveVirtualAmiibo() {
-        serviceDispatch(&g_emuiibo_srv, 6);
+        Dispatch(6, [&](u32 cmd_id) {
+            return serviceDispatch(&g_emuiibo_srv, cmd_id);
+        });
     }
 
     VirtualAmiiboStatus GetActiveVirtualAmiiboStatus() {
         u32 out = 0;
-        serviceDispatchOut(&g_emuiibo_srv, 7, out);
+        Dispatch(7, [&](u32 cmd_id) {
+            return serviceDispatchOut(&g_emuiibo_srv, cmd_id, out);
+        });
         return static_cast<VirtualAmiiboStatus>(out);
     }
 
     void SetActiveVirtualAmiiboStatus(VirtualAmiiboStatus status) {
         u32 in = static_cast<u32>(status);
-        serviceDispatchIn(&g_emuiibo_srv, 8, in);
+        Dispatch(8, [&](u32 cmd_id) {
+            return serviceDispatchIn(&g_emuiibo_srv, cmd_id, in);
+        });
+    }
+
+    Result IsApplicationIdIntercepted(u64 app_id, bool *out_intercepted) {
+        return Dispatch(9, [&](u32 cmd_id) {
+            return serviceDispatchInOut(&g_emuiibo_srv, cmd_id, app_id, *out_intercepted);
+        });
     }
 
-    void IsApplicationIdIntercepted(u64 app_id, bool *out_intercepted) {
-        serviceDispatchInOut(&g_emuiibo_srv, 9, app_id, *out_intercepted);
+    u64 GetCurrentApplicationId() {
+        u64 process_id = 0;
+        if(R_FAILED(pmdmntGetApplicationProcessId(&process_id))) {
+            process_id = 0;
+        }
+        if((process_id != g_current_process_id) || ((process_id != 0) && (g_current_program_id == 0))) {
+            u64 program_id = 0;
+            if((process_id != 0) && R_FAILED(pminfoGetProgramId(&program_id, process_id))) {
+                program_id = 0;
+            }
+            g_current_process_id = process_id;
+            g_current_program_id = program_id;
+        }
+        return g_current_program_id;
+    }
+
+    bool IsCurrentApplicationIdIntercepted() {
+        const auto program_id = GetCurrentApplicationId();
+        if(program_id == 0) {
+            return false;
+        }
+        if(program_id != g_intercepted_program_id) {
+            bool intercepted = false;
+            if(R_FAILED(IsApplicationIdIntercepted(program_id, &intercepted))) {
+                return false;
+            }
+            g_intercepted_program_id = program_id;
+            g_intercepted = intercepted;
+        }
+        return g_intercepted;
+    }
+
+    void InvalidateInterceptedApplicationCache() {
+        g_intercepted_program_id = 0;
+        g_intercepted = false;
     }
 
     Result TryParseVirtualAmiibo(char *path, size_t path_size, VirtualAmiiboData *out_amiibo_data) {
-        return serviceDispatchOut(&g_emuiibo_srv, 10, *out_amiibo_data,
-            .buffer_attrs = {
-                SfBufferAttr_HipcMapAlias | SfBufferAttr_In
-            },
-            .buffers = {
-                { path, path_size }
-            },
-        );
+        return Dispatch(10, [&](u32 cmd_id) {
+            return serviceDispatchOut(&g_emuiibo_srv, cmd_id, *out_amiibo_data,
+                .buffer_attrs = {
+                    SfBufferAttr_HipcMapAlias | SfBufferAttr_In
+                },
+                .buffers = {
+                    { path, path_size }
+                },
+            );
+        });
+    }
+
+    Result ListVirtualAmiiboDirectory(char *path, size_t path_size, u32 cursor, VirtualAmiiboListEntry *out_entries, size_t out_entry_count, VirtualAmiiboListPage *out_page) {
+        return Dispatch(11, [&](u32 cmd_id) {
+            return serviceDispatchInOut(&g_emuiibo_srv, cmd_id, cursor, *out_page,
+                .buffer_attrs = {
+                    SfBufferAttr_HipcMapAlias | SfBufferAttr_In,
+                    SfBufferAttr_HipcMapAlias | SfBufferAttr_Out
+                },
+                .buffers = {
+                    { path, path_size },
+                    { out_entries, out_entry_count * sizeof(VirtualAmiiboListEntry) }
+                },
+            );
+        });
+    }
+
+    Result GetStatusSnapshot(u64 app_id, StatusSnapshot *out_snapshot) {
+        auto rc = Dispatch(12, [&](u32 cmd_id) {
+            return serviceDispatchInOut(&g_emuiibo_srv, cmd_id, app_id, *out_snapshot);
+        });
+        if(R_SUCCEEDED(rc) && (app_id != 0)) {
+            g_intercepted_program_id = app_id;
+            g_intercepted = out_snapshot->is_application_id_intercepted;
+        }
+        return rc;
+    }
+
+    Result AttachStateChangeEvent(Event *out_event) {
+        Handle event_handle = INVALID_HANDLE;
+        auto rc = Dispatch(13, [&](u32 cmd_id) {
+            return serviceDispatch(&g_emuiibo_srv, cmd_id,
+                .out_handle_attrs = { SfOutHandleAttr_HipcCopy },
+                .out_handles = &event_handle,
+            );
+        });
+        if(R_SUCCEEDED(rc)) {
+            eventLoadRemote(out_event, event_handle, true);
+        }
+        return rc;
+    }
+
+    const char *GetCommandName(u32 command_id) {
+        static const char *command_names[] = {
+            "GetVersion",
+            "GetVirtualAmiiboDirectory",
+            "GetEmulationStatus",
+            "SetEmulationStatus",
+            "GetActiveVirtualAmiibo",
+            "SetActiveVirtualAmiibo",
+            "ResetActiveVirtualAmiibo",
+            "GetActiveVirtualAmiiboStatus",
+            "SetActiveVirtualAmiiboStatus",
+            "IsApplicationIdIntercepted",
+            "TryParseVirtualAmiibo",
+            "ListVirtualAmiiboDirectory",
+            "GetStatusSnapshot",
+            "AttachStateChangeEvent",
+        };
+        if(command_id >= sizeof(command_names) / sizeof(command_names[0])) {
+            return "Unknown";
+        }
+        return command_names[command_id];
+    }
+
+    std::vector<CommandStats> GetCommandStats() {
+        std::vector<CommandStats> stats;
+#ifdef EMUIIBO_DEBUG
+        for(u32 i = 0; i < CommandCount; i++) {
+            const auto &record = g_command_records[i];
+            if(record.count == 0) {
+                continue;
+            }
+            std::vector<u64> recent_ticks(record.recent_ticks.begin(), record.recent_ticks.begin() + std::min<size_t>(record.count, RecentLatencyCount));
+            const auto p99 = recent_ticks.begin() + (recent_ticks.size() * 99) / 100;
+            std::nth_element(recent_ticks.begin(), p99, recent_ticks.end());
+            stats.push_back({ i, record.count, record.failures, armTicksToNs(record.total_ticks), armTicksToNs(record.min_ticks), armTicksToNs(record.max_ticks), armTicksToNs(*p99) });
+        }
+#endif
+        return stats;
+    }
+
+    void ResetCommandStats() {
+#ifdef EMUIIBO_DEBUG
+        g_command_records = {};
+#endif
+    }
+
+    bool DumpCommandStats(const char *path) {
+        auto file = fopen(path, "w");
+        if(file == nullptr) {
+            return false;
+        }
+        fprintf(file, "command,name,count,failures,total_ns,avg_ns,min_ns,max_ns,p99_ns\n");
+        for(const auto &stat: GetCommandStats()) {
+            fprintf(file, "%u,%s,%u,%u,%llu,%llu,%llu,%llu,%llu\n", stat.command_id, GetCommandName(stat.command_id), stat.count, stat.failures,
+                static_cast<unsigned long long>(stat.total_ns), static_cast<unsigned long long>(stat.total_ns / stat.count),
+                static_cast<unsigned long long>(stat.min_ns), static_cast<unsigned long long>(stat.max_ns), static_cast<unsigned long long>(stat.p99_ns));
+        }
+        fclose(file);
+        return true;
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,344 @@
+#include <pixel.hpp>
+#include <cstring>
+#include <algorithm>
+#include <map>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace pixel {
+
+    namespace {
+
+        // Each kernel converts as many leading pixels as it can and returns how many, the scalar loops then finish the row
+
+#if defined(__ARM_NEON)
+
+        u32 ExpandRGB8Neon(const u8 *src, u8 *dst, const u32 width) {
+            uint8x16x4_t out;
+            out.val[3] = vdupq_n_u8(0xFF);
+            u32 x = 0;
+            for(; x + 16 <= width; x += 16) {
+                const uint8x16x3_t in = vld3q_u8(src + x * 3);
+                out.val[0] = in.val[0];
+                out.val[1] = in.val[1];
+                out.val[2] = in.val[2];
+                vst4q_u8(dst + x * 4, out);
+            }
+            return x;
+        }
+
+        u32 ExpandLuminance8Neon(const u8 *src, u8 *dst, const u32 width) {
+            uint8x16x4_t out;
+            out.val[3] = vdupq_n_u8(0xFF);
+            u32 x = 0;
+            for(; x + 16 <= width; x += 16) {
+                const uint8x16_t in = vld1q_u8(src + x);
+                out.val[0] = in;
+                out.val[1] = in;
+                out.val[2] = in;
+                vst4q_u8(dst + x * 4, out);
+            }
+            return x;
+        }
+
+        u32 ExpandLuminanceAlpha8Neon(const u8 *src, u8 *dst, const u32 width) {
+            uint8x16x4_t out;
+            u32 x = 0;
+            for(; x + 16 <= width; x += 16) {
+                const uint8x16x2_t in = vld2q_u8(src + x * 2);
+                out.val[0] = in.val[0];
+                out.val[1] = in.val[0];
+                out.val[2] = in.val[0];
+                out.val[3] = in.val[1];
+                vst4q_u8(dst + x * 4, out);
+            }
+            return x;
+        }
+
+        // 16-bit samples are big endian, so loaded as little endian lanes their high byte ends up in the low half, which is what vmovn keeps
+
+        u32 ExpandRGB16Neon(const u8 *src, u8 *dst, const u32 width) {
+            uint8x8x4_t out;
+            out.val[3] = vdup_n_u8(0xFF);
+            u32 x = 0;
+            for(; x + 8 <= width; x += 8) {
+                const uint16x8x3_t in = vld3q_u16(reinterpret_cast<const u16*>(src + x * 6));
+                out.val[0] = vmovn_u16(in.val[0]);
+                out.val[1] = vmovn_u16(in.val[1]);
+                out.val[2] = vmovn_u16(in.val[2]);
+                vst4_u8(dst + x * 4, out);
+            }
+            return x;
+        }
+
+        u32 ExpandRGBA16Neon(const u8 *src, u8 *dst, const u32 width) {
+            uint8x8x4_t out;
+            u32 x = 0;
+            for(; x + 8 <= width; x += 8) {
+                const uint16x8x4_t in = vld4q_u16(reinterpret_cast<const u16*>(src + x * 8));
+                out.val[0] = vmovn_u16(in.val[0]);
+                out.val[1] = vmovn_u16(in.val[1]);
+                out.val[2] = vmovn_u16(in.val[2]);
+                out.val[3] = vmovn_u16(in.val[3]);
+                vst4_u8(dst + x * 4, out);
+            }
+            return x;
+        }
+
+#else
+
+        // No vector kernels on host builds, the scalar loops convert the whole row
+
+        u32 ExpandRGB8Neon(const u8*, u8*, const u32) {
+            return 0;
+        }
+
+        u32 ExpandLuminance8Neon(const u8*, u8*, const u32) {
+            return 0;
+        }
+
+        u32 ExpandLuminanceAlpha8Neon(const u8*, u8*, const u32) {
+            return 0;
+        }
+
+        u32 ExpandRGB16Neon(const u8*, u8*, const u32) {
+            return 0;
+        }
+
+        u32 ExpandRGBA16Neon(const u8*, u8*, const u32) {
+            return 0;
+        }
+
+#endif
+
+        inline void StorePixel(u8 *dst, const u8 r, const u8 g, const u8 b, const u8 a) {
+            dst[0] = r;
+            dst[1] = g;
+            dst[2] = b;
+            dst[3] = a;
+        }
+
+        // Reads the sample_index-th sample of bit_depth bits from a packed (1, 2 or 4 bit) scanline, scaled to 0-255
+        inline u8 PackedSample(const u8 *src, const u32 sample_index, const u32 bit_depth) {
+            const u32 bit = sample_index * bit_depth;
+            const u32 max_value = (1 << bit_depth) - 1;
+            const u32 value = (src[bit / 8] >> (8 - bit_depth - bit % 8)) & max_value;
+            return static_cast<u8>(value * (0xFF / max_value));
+        }
+
+        void ExpandPacked(const u8 *src, u8 *dst, const u32 width, const u32 bit_depth, const bool has_alpha) {
+            for(u32 x = 0; x != width; ++x) {
+                if(has_alpha) {
+                    const u8 l = PackedSample(src, x * 2, bit_depth);
+                    StorePixel(dst + x * 4, l, l, l, PackedSample(src, x * 2 + 1, bit_depth));
+                }
+                else {
+                    const u8 l = PackedSample(src, x, bit_depth);
+                    StorePixel(dst + x * 4, l, l, l, 0xFF);
+                }
+            }
+        }
+
+
+        // Box filter weights sum up to 1 << WeightBits
+        constexpr u32 WeightBits = 14;
+        constexpr size_t MaxCachedAxisWeights = 8;
+
+        // Adds weight * row to the accumulators, over the whole (4 channels per pixel) row
+        void AccumulateRow(u32 *acc, const u16 *row, const u16 weight, const u32 count) {
+            u32 i = 0;
+#if defined(__ARM_NEON)
+            for(; i + 8 <= count; i += 8) {
+                const uint16x8_t in = vld1q_u16(row + i);
+                vst1q_u32(acc + i, vmlal_n_u16(vld1q_u32(acc + i), vget_low_u16(in), weight));
+                vst1q_u32(acc + i + 4, vmlal_high_n_u16(vld1q_u32(acc + i + 4), in, weight));
+            }
+#endif
+            for(; i != count; ++i) {
+                acc[i] += row[i] * weight;
+            }
+        }
+
+        // Horizontal pass: each destination pixel gets its alpha weighted colors (8.8 alpha and color * alpha, both 16 bits)
+        void ScaleRowHorizontal(const AxisWeights &horizontal, const u8 *src, u16 *dst) {
+            const u16 *weight = horizontal.weights.data();
+            for(u32 x = 0; x != horizontal.first.size(); ++x) {
+                u32 r = 0;
+                u32 g = 0;
+                u32 b = 0;
+                u32 a = 0;
+                const u8 *px = src + horizontal.first[x] * RGBA8Depth;
+                for(u32 i = 0; i != horizontal.count[x]; ++i, px += RGBA8Depth) {
+                    const u32 wa = *weight++ * px[3];
+                    r += wa * px[0];
+                    g += wa * px[1];
+                    b += wa * px[2];
+                    a += wa;
+                }
+                dst[0] = (r + (1 << (WeightBits - 1))) >> WeightBits;
+                dst[1] = (g + (1 << (WeightBits - 1))) >> WeightBits;
+                dst[2] = (b + (1 << (WeightBits - 1))) >> WeightBits;
+                dst[3] = (a + (1 << (WeightBits - 9))) >> (WeightBits - 8);
+                dst += RGBA8Depth;
+            }
+        }
+
+        // Vertical pass result back to plain RGBA8888, undoing the alpha premultiplication
+        void StoreScaledRow(const u32 *acc, u8 *dst, const u32 width) {
+            for(u32 x = 0; x != width; ++x, acc += RGBA8Depth, dst += RGBA8Depth) {
+                const u32 alpha = (acc[3] + (1 << (WeightBits - 1))) >> WeightBits;
+                for(u32 c = 0; c != 3; ++c) {
+                    const u32 color = (acc[c] + (1 << (WeightBits - 1))) >> WeightBits;
+                    dst[c] = alpha ? std::min<u32>((color * 0x100 + alpha / 2) / alpha, 0xFF) : 0;
+                }
+                dst[3] = std::min<u32>((alpha + 0x80) >> 8, 0xFF);
+            }
+        }
+
+        std::shared_ptr<const AxisWeights> ComputeAxisWeights(const u32 src_size, const u32 dst_size) {
+            auto axis = std::make_shared<AxisWeights>();
+            axis->first.resize(dst_size);
+            axis->count.resize(dst_size);
+            axis->offset.resize(dst_size);
+            // In units of 1 / (src_size * dst_size): destination pixel i spans [i * src_size, (i + 1) * src_size), source pixel j spans [j * dst_size, (j + 1) * dst_size)
+            for(u32 i = 0; i != dst_size; ++i) {
+                const u64 start = (u64)i * src_size;
+                const u64 end = start + src_size;
+                const u32 first = start / dst_size;
+                const u32 last = (end - 1) / dst_size;
+                const size_t weights_start = axis->weights.size();
+                u32 sum = 0;
+                for(u32 j = first; j <= last; ++j) {
+                    const u64 overlap = std::min<u64>(end, (u64)(j + 1) * dst_size) - std::max<u64>(start, (u64)j * dst_size);
+                    const u16 weight = ((overlap << WeightBits) + src_size / 2) / src_size;
+                    axis->weights.push_back(weight);
+                    sum += weight;
+                }
+                // Rounding leftovers go to the heaviest tap, so that every pixel keeps a total weight of exactly 1
+                auto heaviest = std::max_element(axis->weights.begin() + weights_start, axis->weights.end());
+                *heaviest += (1 << WeightBits) - sum;
+                axis->first[i] = first;
+                axis->count[i] = last - first + 1;
+                axis->offset[i] = weights_start;
+            }
+            return axis;
+        }
+
+    }
+
+    void ExpandToRGBA8(const upng_format format, const u8 *src, u8 *dst, const u32 width) {
+        switch(format) {
+            case UPNG_RGBA8: {
+                std::memcpy(dst, src, width * RGBA8Depth);
+                break;
+            }
+            case UPNG_RGB8: {
+                for(u32 x = ExpandRGB8Neon(src, dst, width); x != width; ++x) {
+                    StorePixel(dst + x * 4, src[x * 3], src[x * 3 + 1], src[x * 3 + 2], 0xFF);
+                }
+                break;
+            }
+            case UPNG_RGBA16: {
+                for(u32 x = ExpandRGBA16Neon(src, dst, width); x != width; ++x) {
+                    StorePixel(dst + x * 4, src[x * 8], src[x * 8 + 2], src[x * 8 + 4], src[x * 8 + 6]);
+                }
+                break;
+            }
+            case UPNG_RGB16: {
+                for(u32 x = ExpandRGB16Neon(src, dst, width); x != width; ++x) {
+                    StorePixel(dst + x * 4, src[x * 6], src[x * 6 + 2], src[x * 6 + 4], 0xFF);
+                }
+                break;
+            }
+            case UPNG_LUMINANCE8: {
+                for(u32 x = ExpandLuminance8Neon(src, dst, width); x != width; ++x) {
+                    StorePixel(dst + x * 4, src[x], src[x], src[x], 0xFF);
+                }
+                break;
+            }
+            case UPNG_LUMINANCE_ALPHA8: {
+                for(u32 x = ExpandLuminanceAlpha8Neon(src, dst, width); x != width; ++x) {
+                    StorePixel(dst + x * 4, src[x * 2], src[x * 2], src[x * 2], src[x * 2 + 1]);
+                }
+                break;
+            }
+            case UPNG_LUMINANCE1: {
+                ExpandPacked(src, dst, width, 1, false);
+                break;
+            }
+            case UPNG_LUMINANCE2: {
+                ExpandPacked(src, dst, width, 2, false);
+                break;
+            }
+            case UPNG_LUMINANCE4: {
+                ExpandPacked(src, dst, width, 4, false);
+                break;
+            }
+            case UPNG_LUMINANCE_ALPHA1: {
+                ExpandPacked(src, dst, width, 1, true);
+                break;
+            }
+            case UPNG_LUMINANCE_ALPHA2: {
+                ExpandPacked(src, dst, width, 2, true);
+                break;
+            }
+            case UPNG_LUMINANCE_ALPHA4: {
+                ExpandPacked(src, dst, width, 4, true);
+                break;
+            }
+            case UPNG_BADFORMAT: {
+                break;
+            }
+        }
+    }
+
+    std::shared_ptr<const AxisWeights> GetAxisWeights(const u32 src_size, const u32 dst_size) {
+        static std::map<std::pair<u32, u32>, std::shared_ptr<const AxisWeights>> cached_weights;
+        const auto key = std::make_pair(src_size, dst_size);
+        auto it = cached_weights.find(key);
+        if(it != cached_weights.end()) {
+            return it->second;
+        }
+        if(cached_weights.size() == MaxCachedAxisWeights) {
+            cached_weights.clear();
+        }
+        auto axis = ComputeAxisWeights(src_size, dst_size);
+        cached_weights[key] = axis;
+        return axis;
+    }
+
+    AreaScaler::AreaScaler(const u32 src_width, const u32 src_height, const u32 dst_width, const u32 dst_height) : dst_width(dst_width), dst_height(dst_height), src_row(0), dst_row(0) {
+        this->horizontal = GetAxisWeights(src_width, dst_width);
+        this->vertical = GetAxisWeights(src_height, dst_height);
+        this->scaled_row.resize(dst_width * RGBA8Depth);
+        this->accumulators[0].assign(dst_width * RGBA8Depth, 0);
+        this->accumulators[1].assign(dst_width * RGBA8Depth, 0);
+    }
+
+    void AreaScaler::PushRow(const u8 *rgba_row, u8 *dst) {
+        if(this->dst_row == this->dst_height) {
+            return;
+        }
+        ScaleRowHorizontal(*this->horizontal, rgba_row, this->scaled_row.data());
+
+        // When shrinking, a source row overlaps at most two destination rows: the pending one and the next
+        const auto &vertical = *this->vertical;
+        for(u32 row = this->dst_row; row != std::min(this->dst_row + 2, this->dst_height); ++row) {
+            if(this->src_row >= vertical.first[row] && this->src_row < vertical.first[row] + vertical.count[row]) {
+                const u16 weight = vertical.weights[vertical.offset[row] + this->src_row - vertical.first[row]];
+                AccumulateRow(this->accumulators[row & 1].data(), this->scaled_row.data(), weight, this->scaled_row.size());
+            }
+        }
+
+        if(this->src_row == vertical.first[this->dst_row] + vertical.count[this->dst_row] - 1) {
+            auto &acc = this->accumulators[this->dst_row & 1];
+            StoreScaledRow(acc.data(), dst + this->dst_row * this->dst_width * RGBA8Depth, this->dst_width);
+            std::fill(acc.begin(), acc.end(), 0);
+            ++this->dst_row;
+        }
+        ++this->src_row;
+    }
+
+}
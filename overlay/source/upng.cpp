@@ -29,6 +29,20 @@ freely, subject to the following restrictions:
 #include <string.h>
 #include <limits.h>
 
+/* the vector kernels and the CRC32 instructions are used wherever the target has them, unless UPNG_NO_SIMD is defined, which leaves the portable code alone (to test the kernels against it) */
+#if !defined(UPNG_NO_SIMD) && defined(__ARM_NEON)
+#define UPNG_NEON
+#include <arm_neon.h>
+#elif !defined(UPNG_NO_SIMD) && defined(__SSE2__)
+#define UPNG_SSE2
+#include <emmintrin.h>
+#endif
+
+#if !defined(UPNG_NO_SIMD) && defined(__ARM_FEATURE_CRC32)
+#define UPNG_CRC32
+#include <arm_acle.h>
+#endif
+
 #include "upng.h"
 
 #define MAKE_BYTE(b) ((b) & 0xFF)
@@ -45,16 +59,35 @@ freely, subject to the following restrictions:
 #define NUM_DEFLATE_CODE_SYMBOLS 288	/*256 literals, the end code, some length codes, and 2 unused codes */
 #define NUM_DISTANCE_SYMBOLS 32	/*the distance codes have their own symbols, 30 used, 2 unused */
 #define NUM_CODE_LENGTH_CODES 19	/*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros */
-#define MAX_SYMBOLS 288 /* largest number of symbols used by any tree type */
-
-#define DEFLATE_CODE_BITLEN 15
-#define DISTANCE_BITLEN 15
-#define CODE_LENGTH_BITLEN 7
 #define MAX_BIT_LENGTH 15 /* largest bitlen used by any tree type */
 
-#define DEFLATE_CODE_BUFFER_SIZE (NUM_DEFLATE_CODE_SYMBOLS * 2)
-#define DISTANCE_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
-#define CODE_LENGTH_BUFFER_SIZE (NUM_DISTANCE_SYMBOLS * 2)
+#define DEFLATE_CODE_ROOT_BITS 10	/* index bits of the primary literal/length lookup table */
+#define DISTANCE_ROOT_BITS 8	/* index bits of the primary distance lookup table */
+#define CODE_LENGTH_ROOT_BITS 7	/* code length codes are at most 7 bits long, so they never need a subtable */
+
+/* worst case number of entries (primary table plus all overflow subtables) for each root size, as computed by zlib's "enough" utility */
+#define DEFLATE_CODE_TABLE_SIZE 1334
+#define DISTANCE_TABLE_SIZE 402
+#define CODE_LENGTH_TABLE_SIZE 128
+
+/* a lookup table entry holds the symbol (or the subtable offset) in the upper 16 bits and the number of bits to consume (or the subtable index bits) in the lower 8 */
+#define HUFFMAN_ENTRY_SUBTABLE 0x100
+#define HUFFMAN_ENTRY(value,flags,bits) (((value) << 16) | (flags) | (bits))
+#define HUFFMAN_ENTRY_VALUE(entry) ((entry) >> 16)
+#define HUFFMAN_ENTRY_BITS(entry) ((entry) & 0xFF)
+
+#define UZ_REFILL_BITS 56 /* minimum number of bits held by the bit buffer after a refill */
+#define UZ_WINDOW_SIZE 32768 /* how far back a deflate distance may reach */
+#define UZ_MAX_MATCH 258 /* longest copy a length code may ask for */
+
+#define ADLER_BASE 65521 /* largest prime below 65536 */
+#define ADLER_BLOCK 2048 /* bytes summed before reducing modulo ADLER_BASE, small enough for the 16 bit column sums of the vector code */
+
+#define UPNG_MAX_SEGMENTS 16 /* most pieces a parallel decode splits the image data or the scanlines into */
+#define UPNG_PARALLEL_MIN_SIZE 262144 /* inflated size below which an image is not worth the threads */
+
+#define ADAM7_PASSES 7
+#define ADAM7_MAX_SHIFT 3 /* the first pass alone holds every 8th pixel of every 8th row */
 
 #define SET_ERROR(upng,code) do { (upng)->error = (code); (upng)->error_line = __LINE__; } while (0)
 
@@ -98,13 +131,71 @@ struct upng_t {
 
 	upng_state		state;
 	upng_source		source;
+
+	upng_allocator	allocator;
+
+	upng_parallel_for	parallel_for;
+	void*				parallel_user;
+
+	int				verify;
+	unsigned		interlace;	/* 1 for Adam7 */
+	unsigned		reduction;	/* an Adam7 image is decoded from the passes making up every (1 << reduction)-th pixel of every (1 << reduction)-th row */
+};
+
+typedef struct huffman_table {
+	unsigned* entries;	/* 1 << rootbits primary entries, followed by the overflow subtables */
+	unsigned size;	/* number of entries available in the buffer */
+	unsigned rootbits;	/* number of bits used to index the primary table */
+} huffman_table;
+
+typedef struct uz_stream uz_stream;
+
+/* called when the output buffer is full; it may consume output and move the still needed part to the front of the buffer */
+typedef void (*uz_flush_fn)(upng_t* upng, uz_stream* s);
+
+struct uz_stream {
+	const unsigned char*	in;			/* input being read: the data of the current IDAT chunk */
+	unsigned long			insize;
+	unsigned long			inpos;		/* next input byte to be loaded into the bit buffer */
+	const unsigned char*	chunk;		/* next chunk to take input from once in is exhausted, NULL if there is none */
+	const unsigned char*	chunks_end;
+	unsigned long			base;		/* offset of in within the image data, as if the chunks were put together */
+	unsigned long			stop;		/* offset in the image data at which a segment of a parallel decode ends, 0 to inflate up to the final block */
+
+	unsigned long long		bitbuf;		/* bits are consumed from the lsb side, as deflate stores them */
+	unsigned				bitcount;	/* number of valid bits in bitbuf */
+	unsigned				overrun;	/* zero bytes fed to the bit buffer past the end of the input */
+
+	unsigned char*			out;
+	unsigned long			outsize;
+	unsigned long			outpos;
+
+	int						verify;		/* compute the adler32 of the output and check it against the zlib trailer */
+	unsigned				adler;
+	unsigned long			adlerpos;	/* output before this offset is already part of adler */
+
+	uz_flush_fn				flush;		/* NULL if out holds the whole inflated data */
+	void*					user;
+	int						done;		/* set by flush once it has all the output it wants: inflating stops there, without the rest of the data nor its trailer */
 };
 
-typedef struct huffman_tree {
-	unsigned* tree2d;
-	unsigned maxbitlen;	/*maximum number of bits a single code can get */
-	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
-} huffman_tree;
+typedef struct adam7_passes {
+	unsigned		count;		/* passes which are decoded, the first ones */
+	unsigned		w[ADAM7_PASSES];
+	unsigned		h[ADAM7_PASSES];
+	unsigned long	filter_start[ADAM7_PASSES + 1];	/* offset of every pass in the inflated data, where each scanline starts with its filter type */
+	unsigned long	padded_start[ADAM7_PASSES + 1];	/* offset of every pass once unfiltered in place, scanlines padded to whole bytes */
+} adam7_passes;
+
+typedef struct upng_row_stream {
+	upng_row_callback	callback;
+	void*				user;
+	unsigned char*		lines;		/* two unfiltered scanlines, the current one and the previous one */
+	unsigned long		linebytes;
+	unsigned long		bytewidth;
+	unsigned long		consumed;	/* inflated bytes already unfiltered and handed to the callback */
+	unsigned			y;
+} upng_row_stream;
 
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
@@ -129,204 +220,489 @@ static const unsigned DISTANCE_EXTRA[30] = {	/*the extra bits of backwards dista
 static const unsigned CLCL[NUM_CODE_LENGTH_CODES]	/*the order in which "code length alphabet code lengths" are stored, out of this the huffman tree of the dynamic huffman tree lengths is generated */
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
 
-static const unsigned FIXED_DEFLATE_CODE_TREE[NUM_DEFLATE_CODE_SYMBOLS * 2] = {
-	289, 370, 290, 307, 546, 291, 561, 292, 293, 300, 294, 297, 295, 296, 0, 1,
-	2, 3, 298, 299, 4, 5, 6, 7, 301, 304, 302, 303, 8, 9, 10, 11, 305, 306, 12,
-	13, 14, 15, 308, 339, 309, 324, 310, 317, 311, 314, 312, 313, 16, 17, 18,
-	19, 315, 316, 20, 21, 22, 23, 318, 321, 319, 320, 24, 25, 26, 27, 322, 323,
-	28, 29, 30, 31, 325, 332, 326, 329, 327, 328, 32, 33, 34, 35, 330, 331, 36,
-	37, 38, 39, 333, 336, 334, 335, 40, 41, 42, 43, 337, 338, 44, 45, 46, 47,
-	340, 355, 341, 348, 342, 345, 343, 344, 48, 49, 50, 51, 346, 347, 52, 53,
-	54, 55, 349, 352, 350, 351, 56, 57, 58, 59, 353, 354, 60, 61, 62, 63, 356,
-	363, 357, 360, 358, 359, 64, 65, 66, 67, 361, 362, 68, 69, 70, 71, 364,
-	367, 365, 366, 72, 73, 74, 75, 368, 369, 76, 77, 78, 79, 371, 434, 372,
-	403, 373, 388, 374, 381, 375, 378, 376, 377, 80, 81, 82, 83, 379, 380, 84,
-	85, 86, 87, 382, 385, 383, 384, 88, 89, 90, 91, 386, 387, 92, 93, 94, 95,
-	389, 396, 390, 393, 391, 392, 96, 97, 98, 99, 394, 395, 100, 101, 102, 103,
-	397, 400, 398, 399, 104, 105, 106, 107, 401, 402, 108, 109, 110, 111, 404,
-	419, 405, 412, 406, 409, 407, 408, 112, 113, 114, 115, 410, 411, 116, 117,
-	118, 119, 413, 416, 414, 415, 120, 121, 122, 123, 417, 418, 124, 125, 126,
-	127, 420, 427, 421, 424, 422, 423, 128, 129, 130, 131, 425, 426, 132, 133,
-	134, 135, 428, 431, 429, 430, 136, 137, 138, 139, 432, 433, 140, 141, 142,
-	143, 435, 483, 436, 452, 568, 437, 438, 445, 439, 442, 440, 441, 144, 145,
-	146, 147, 443, 444, 148, 149, 150, 151, 446, 449, 447, 448, 152, 153, 154,
-	155, 450, 451, 156, 157, 158, 159, 453, 468, 454, 461, 455, 458, 456, 457,
-	160, 161, 162, 163, 459, 460, 164, 165, 166, 167, 462, 465, 463, 464, 168,
-	169, 170, 171, 466, 467, 172, 173, 174, 175, 469, 476, 470, 473, 471, 472,
-	176, 177, 178, 179, 474, 475, 180, 181, 182, 183, 477, 480, 478, 479, 184,
-	185, 186, 187, 481, 482, 188, 189, 190, 191, 484, 515, 485, 500, 486, 493,
-	487, 490, 488, 489, 192, 193, 194, 195, 491, 492, 196, 197, 198, 199, 494,
-	497, 495, 496, 200, 201, 202, 203, 498, 499, 204, 205, 206, 207, 501, 508,
-	502, 505, 503, 504, 208, 209, 210, 211, 506, 507, 212, 213, 214, 215, 509,
-	512, 510, 511, 216, 217, 218, 219, 513, 514, 220, 221, 222, 223, 516, 531,
-	517, 524, 518, 521, 519, 520, 224, 225, 226, 227, 522, 523, 228, 229, 230,
-	231, 525, 528, 526, 527, 232, 233, 234, 235, 529, 530, 236, 237, 238, 239,
-	532, 539, 533, 536, 534, 535, 240, 241, 242, 243, 537, 538, 244, 245, 246,
-	247, 540, 543, 541, 542, 248, 249, 250, 251, 544, 545, 252, 253, 254, 255,
-	547, 554, 548, 551, 549, 550, 256, 257, 258, 259, 552, 553, 260, 261, 262,
-	263, 555, 558, 556, 557, 264, 265, 266, 267, 559, 560, 268, 269, 270, 271,
-	562, 565, 563, 564, 272, 273, 274, 275, 566, 567, 276, 277, 278, 279, 569,
-	572, 570, 571, 280, 281, 282, 283, 573, 574, 284, 285, 286, 287, 0, 0
-};
+static const unsigned ADAM7_IX[ADAM7_PASSES] = { 0, 4, 0, 2, 0, 1, 0 };	/*x start values of the passes */
+static const unsigned ADAM7_IY[ADAM7_PASSES] = { 0, 0, 4, 0, 2, 0, 1 };	/*y start values */
+static const unsigned ADAM7_DX[ADAM7_PASSES] = { 8, 8, 4, 4, 2, 2, 1 };	/*x delta values */
+static const unsigned ADAM7_DY[ADAM7_PASSES] = { 8, 8, 8, 4, 4, 2, 2 };	/*y delta values */
+
+static unsigned long long load_le64(const unsigned char* p)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+#else
+	unsigned long long v = 0;
+	unsigned i;
+	for (i = 0; i < 8; i++)
+		v |= (unsigned long long)p[i] << (i * 8);
+	return v;
+#endif
+}
 
-static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
-	33, 48, 34, 41, 35, 38, 36, 37, 0, 1, 2, 3, 39, 40, 4, 5, 6, 7, 42, 45, 43,
-	44, 8, 9, 10, 11, 46, 47, 12, 13, 14, 15, 49, 56, 50, 53, 51, 52, 16, 17,
-	18, 19, 54, 55, 20, 21, 22, 23, 57, 60, 58, 59, 24, 25, 26, 27, 61, 62, 28,
-	29, 30, 31, 0, 0
+#if !defined(UPNG_CRC32)
+static const unsigned CRC_TABLE[256] = {	/* CRC-32 of every byte value, for the reflected polynomial 0xEDB88320 used by PNG */
+	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
+	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
+	0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
+	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
+	0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
+	0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
+	0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
+	0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
+	0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
+	0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
+	0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
+	0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
+	0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
+	0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
+	0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
+	0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
+	0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
+	0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
+	0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
+	0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
+	0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
+	0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
+#endif
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+/* CRC-32 as used by PNG chunks, with the CRC32 instructions of ARMv8 when they are there */
+static unsigned crc32_update(unsigned crc, const unsigned char* data, unsigned long len)
 {
-	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
-	(*bitpointer)++;
-	return result;
+	crc = ~crc;
+#if defined(UPNG_CRC32)
+	for (; len >= 8; data += 8, len -= 8) {
+		unsigned long long v;
+		memcpy(&v, data, 8);
+		crc = __crc32d(crc, v);
+	}
+	for (; len > 0; data++, len--)
+		crc = __crc32b(crc, *data);
+#else
+	for (; len > 0; data++, len--)
+		crc = CRC_TABLE[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+#endif
+	return ~crc;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+/* true if the CRC after the chunk data matches its type and data. avail is the bytes left in the buffer from the chunk on */
+static int upng_chunk_crc_ok(const unsigned char* chunk, unsigned long avail)
 {
-	unsigned result = 0, i;
-	for (i = 0; i < nbits; i++)
-		result |= ((unsigned)read_bit(bitpointer, bitstream)) << i;
-	return result;
+	unsigned long length = upng_chunk_length(chunk);
+	unsigned crc;
+
+	if (avail < 12 || length > avail - 12) {
+		return 0;
+	}
+
+	crc = MAKE_DWORD_PTR(chunk + 8 + length);
+	return crc32_update(0, chunk + 4, length + 4) == crc;
 }
 
-/* the buffer must be numcodes*2 in size! */
-static void huffman_tree_init(huffman_tree* tree, unsigned* buffer, unsigned numcodes, unsigned maxbitlen)
+#if defined(UPNG_NEON) || defined(UPNG_SSE2)
+
+/*
+   adler32 of 16 byte blocks, at most ADLER_BLOCK / 16 of them: with S(k) the sum of block k, of n blocks in total, and C(j) the sum of the bytes at offset j of every block, s2 grows by
+   16 * n * s1 + 16 * (sum of S(k) * (n - 1 - k)) + (sum of C(j) * (16 - j)), the middle sum being built by adding the running sum of the previous blocks once per block
+ */
+#if defined(UPNG_NEON)
+
+static void adler32_blocks(unsigned long long* s1, unsigned long long* s2, const unsigned char* data, unsigned long blocks)
 {
-	tree->tree2d = buffer;
+	static const unsigned short WEIGHTS[16] = { 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+	uint32x4_t sum = vdupq_n_u32(0);
+	uint32x4_t prefix = vdupq_n_u32(0);
+	uint16x8_t columns_lo = vdupq_n_u16(0);
+	uint16x8_t columns_hi = vdupq_n_u16(0);
+	uint16x8_t weights_lo = vld1q_u16(WEIGHTS);
+	uint16x8_t weights_hi = vld1q_u16(WEIGHTS + 8);
+	uint32x4_t weighted;
+	unsigned long k;
+
+	for (k = 0; k < blocks; k++) {
+		uint8x16_t x = vld1q_u8(data + k * 16);
+		prefix = vaddq_u32(prefix, sum);
+		sum = vpadalq_u16(sum, vpaddlq_u8(x));
+		columns_lo = vaddw_u8(columns_lo, vget_low_u8(x));
+		columns_hi = vaddw_u8(columns_hi, vget_high_u8(x));
+	}
+
+	weighted = vmull_u16(vget_low_u16(columns_lo), vget_low_u16(weights_lo));
+	weighted = vmlal_u16(weighted, vget_high_u16(columns_lo), vget_high_u16(weights_lo));
+	weighted = vmlal_u16(weighted, vget_low_u16(columns_hi), vget_low_u16(weights_hi));
+	weighted = vmlal_u16(weighted, vget_high_u16(columns_hi), vget_high_u16(weights_hi));
 
-	tree->numcodes = numcodes;
-	tree->maxbitlen = maxbitlen;
+	*s2 += 16 * blocks * *s1 + 16 * (unsigned long long)vaddvq_u32(prefix) + vaddvq_u32(weighted);
+	*s1 += vaddvq_u32(sum);
 }
 
-/*given the code lengths (as stored in the PNG file), generate the tree as defined by Deflate. maxbitlen is the maximum bits that a code in the tree can have. return value is error.*/
-static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const unsigned *bitlen)
-{
-	unsigned tree1d[MAX_SYMBOLS];
-	unsigned blcount[MAX_BIT_LENGTH];
-	unsigned nextcode[MAX_BIT_LENGTH+1];
-	unsigned bits, n, i;
-	unsigned nodefilled = 0;	/*up to which node it is filled */
-	unsigned treepos = 0;	/*position in the tree (1 of the numcodes columns) */
+#else
 
-	/* initialize local vectors */
-	memset(blcount, 0, sizeof(blcount));
-	memset(nextcode, 0, sizeof(nextcode));
+static unsigned long long adler32_hsum(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (unsigned)_mm_cvtsi128_si32(v);
+}
 
-	/*step 1: count number of instances of each code length */
-	for (bits = 0; bits < tree->numcodes; bits++) {
-		blcount[bitlen[bits]]++;
+static void adler32_blocks(unsigned long long* s1, unsigned long long* s2, const unsigned char* data, unsigned long blocks)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	__m128i prefix = zero;
+	__m128i columns_lo = zero;
+	__m128i columns_hi = zero;
+	__m128i weighted;
+	unsigned long k;
+
+	for (k = 0; k < blocks; k++) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(data + k * 16));
+		prefix = _mm_add_epi32(prefix, sum);
+		sum = _mm_add_epi32(sum, _mm_sad_epu8(x, zero));
+		columns_lo = _mm_add_epi16(columns_lo, _mm_unpacklo_epi8(x, zero));
+		columns_hi = _mm_add_epi16(columns_hi, _mm_unpackhi_epi8(x, zero));
 	}
 
-	/*step 2: generate the nextcode values */
-	for (bits = 1; bits <= tree->maxbitlen; bits++) {
-		nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-	}
+	/* pmaddwd multiplies signed words: the column sums stay below 32768 as long as ADLER_BLOCK is at most 2048 */
+	weighted = _mm_add_epi32(_mm_madd_epi16(columns_lo, _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9)), _mm_madd_epi16(columns_hi, _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1)));
 
-	/*step 3: generate all the codes */
-	for (n = 0; n < tree->numcodes; n++) {
-		if (bitlen[n] != 0) {
-			tree1d[n] = nextcode[bitlen[n]]++;
+	*s2 += 16 * blocks * *s1 + 16 * adler32_hsum(prefix) + adler32_hsum(weighted);
+	*s1 += adler32_hsum(sum);
+}
+
+#endif
+
+#endif
+
+static unsigned adler32_update(unsigned adler, const unsigned char* data, unsigned long len)
+{
+	unsigned long long s1 = adler & 0xFFFF;
+	unsigned long long s2 = adler >> 16;
+
+	while (len > 0) {
+		unsigned long n = len < ADLER_BLOCK ? len : ADLER_BLOCK;
+		unsigned long i = 0;
+
+#if defined(UPNG_NEON) || defined(UPNG_SSE2)
+		adler32_blocks(&s1, &s2, data, n / 16);
+		i = n & ~15UL;
+#endif
+		for (; i < n; i++) {
+			s1 += data[i];
+			s2 += s1;
 		}
+
+		s1 %= ADLER_BASE;
+		s2 %= ADLER_BASE;
+		data += n;
+		len -= n;
+	}
+
+	return (unsigned)((s2 << 16) | s1);
+}
+
+/* fold the output not yet checksummed into the adler32, before it gets flushed away */
+static void uz_checksum_output(uz_stream* s)
+{
+	if (s->verify && s->outpos > s->adlerpos) {
+		s->adler = adler32_update(s->adler, s->out + s->adlerpos, s->outpos - s->adlerpos);
 	}
+	s->adlerpos = s->outpos;
+}
 
-	/*convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means uninited, a value >= numcodes is an address to another bit, a value < numcodes is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as many columns as codes - 1
-	   a good huffmann tree has N * 2 - 1 nodes, of which N - 1 are internal nodes. Here, the internal nodes are stored (what their 0 and 1 option point to). There is only memory for such good tree currently, if there are more nodes (due to too long length codes), error 55 will happen */
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		tree->tree2d[n] = 32767;	/*32767 here means the tree2d isn't filled there yet */
+/* move on to the data of the next IDAT chunk, so that the image data is inflated straight from the chunks it is split into. returns 0 at the end of the image data */
+static int uz_next_input(uz_stream* s)
+{
+	s->base += s->insize;
+	s->insize = 0;
+	s->inpos = 0;
+
+	while (s->chunk != NULL && s->chunk < s->chunks_end) {
+		const unsigned char* chunk = s->chunk;
+		unsigned long length = upng_chunk_length(chunk);
+
+		/* the chunks were validated by scan_chunks */
+		s->chunk += length + 12;
+		if (upng_chunk_type(chunk) == CHUNK_IDAT && length > 0) {
+			s->in = chunk + 8;
+			s->insize = length;
+			s->inpos = 0;
+			return 1;
+		}
 	}
 
-	for (n = 0; n < tree->numcodes; n++) {	/*the codes */
-		for (i = 0; i < bitlen[n]; i++) {	/*the bits for this code */
-			unsigned char bit = (unsigned char)((tree1d[n] >> (bitlen[n] - i - 1)) & 1);
-			/* check if oversubscribed */
-			if (treepos > tree->numcodes - 2) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
+	s->chunk = NULL;
+	return 0;
+}
 
-			if (tree->tree2d[2 * treepos + bit] == 32767) {	/*not yet filled in */
-				if (i + 1 == bitlen[n]) {	/*last bit */
-					tree->tree2d[2 * treepos + bit] = n;	/*put the current code in it */
-					treepos = 0;
-				} else {	/*put address of the next step in here, first that address has to be found of course (it's just nodefilled + 1)... */
-					nodefilled++;
-					tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;	/*addresses encoded with numcodes added to it */
-					treepos = nodefilled;
-				}
+/* top up the bit buffer to at least UZ_REFILL_BITS bits. past the end of the input zero bytes are fed instead, which is only an error if those bits actually get consumed (see uz_overrun) */
+static void uz_refill(uz_stream* s)
+{
+	if (s->insize - s->inpos >= 8) {
+		/* load 8 bytes at once but only advance by the whole bytes that fit; the partial byte on top is loaded again on the next refill */
+		s->bitbuf |= load_le64(s->in + s->inpos) << s->bitcount;
+		s->inpos += (63 - s->bitcount) >> 3;
+		s->bitcount |= UZ_REFILL_BITS;
+	} else {
+		while (s->bitcount < UZ_REFILL_BITS) {
+			if (s->inpos < s->insize || uz_next_input(s)) {
+				s->bitbuf |= (unsigned long long)s->in[s->inpos++] << s->bitcount;
 			} else {
-				treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
+				s->overrun++;
 			}
+			s->bitcount += 8;
 		}
 	}
+}
 
-	for (n = 0; n < tree->numcodes * 2; n++) {
-		if (tree->tree2d[n] == 32767) {
-			tree->tree2d[n] = 0;	/*remove possible remaining 32767's */
+/* continue reading the image data at the given offset, which must be a byte boundary. returns 0 if the image data is not that long */
+static int uz_seek(uz_stream* s, unsigned long offset)
+{
+	s->bitbuf = 0;
+	s->bitcount = 0;
+	s->overrun = 0;
+
+	while (offset >= s->base + s->insize) {
+		if (!uz_next_input(s)) {
+			return 0;
 		}
 	}
+
+	s->inpos = offset - s->base;
+	return 1;
+}
+
+/* number of bits of the image data consumed so far */
+static unsigned long long uz_bit_position(const uz_stream* s)
+{
+	return ((unsigned long long)(s->base + s->inpos + s->overrun) << 3) - s->bitcount;
+}
+
+/* true if bits past the end of the input have been consumed */
+static int uz_overrun(const uz_stream* s)
+{
+	return s->overrun * 8 > s->bitcount;
+}
+
+/* read nbits from the bit buffer, the caller must have refilled it */
+static unsigned uz_bits(uz_stream* s, unsigned nbits)
+{
+	unsigned result = (unsigned)(s->bitbuf & ((1ULL << nbits) - 1));
+	s->bitbuf >>= nbits;
+	s->bitcount -= nbits;
+	return result;
+}
+
+static unsigned read_bits(uz_stream* s, unsigned nbits)
+{
+	if (s->bitcount < nbits)
+		uz_refill(s);
+	return uz_bits(s, nbits);
+}
+
+static unsigned reverse_bits(unsigned code, unsigned nbits)
+{
+	unsigned result = 0, i;
+	for (i = 0; i < nbits; i++) {
+		result = (result << 1) | (code & 1);
+		code >>= 1;
+	}
+	return result;
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+/* make sure there is room for nbytes more output, flushing the output buffer if it is full */
+static int uz_reserve(upng_t* upng, uz_stream* s, unsigned long nbytes)
 {
-	unsigned treepos = 0, ct;
-	unsigned char bit;
-	for (;;) {
-		/* error: end of input memory reached without endcode */
-		if (((*bp) & 0x07) == 0 && ((*bp) >> 3) > inlength) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
+	if (s->outsize - s->outpos >= nbytes) {
+		return 1;
+	}
+
+	if (s->flush != NULL) {
+		uz_checksum_output(s);
+		s->flush(upng, s);
+		s->adlerpos = s->outpos;
+		if (upng->error != UPNG_EOK || s->done) {
 			return 0;
 		}
+		if (s->outsize - s->outpos >= nbytes) {
+			return 1;
+		}
+	}
+
+	SET_ERROR(upng, UPNG_EMALFORMED);
+	return 0;
+}
 
-		bit = read_bit(bp, in);
+static void huffman_table_init(huffman_table* table, unsigned* buffer, unsigned size, unsigned rootbits)
+{
+	table->entries = buffer;
+	table->size = size;
+	table->rootbits = rootbits;
+}
 
-		ct = codetree->tree2d[(treepos << 1) | bit];
-		if (ct < codetree->numcodes) {
-			return ct;
-		}
+/*given the code lengths (as stored in the PNG file), generate the lookup table as defined by Deflate.
+  codes of up to rootbits bits take one lookup, longer ones go through an overflow subtable indexed by their remaining bits*/
+static void huffman_table_create_lengths(upng_t* upng, huffman_table* table, const unsigned *bitlen, unsigned numcodes)
+{
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned offsets[MAX_BIT_LENGTH + 1];
+	unsigned sorted[NUM_DEFLATE_CODE_SYMBOLS];
+	unsigned rootbits = table->rootbits;
+	unsigned used = 1u << rootbits;	/* entries taken by the primary table and the subtables created so far */
+	unsigned prefix = ~0u;	/* root bits of the codes going into the current subtable */
+	unsigned subtable = 0, subbits = 0;
+	unsigned code = 0, prevlen = 0, total, n, i;
+	int left;
+
+	/*step 1: count number of instances of each code length */
+	memset(blcount, 0, sizeof(blcount));
+	for (n = 0; n < numcodes; n++) {
+		blcount[bitlen[n]]++;
+	}
 
-		treepos = ct - codetree->numcodes;
-		if (treepos >= codetree->numcodes) {
+	/*step 2: reject oversubscribed codes. incomplete codes are allowed, their unused entries stay 0 and are rejected while decoding */
+	left = 1;
+	for (n = 1; n <= MAX_BIT_LENGTH; n++) {
+		left <<= 1;
+		left -= blcount[n];
+		if (left < 0) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return 0;
+			return;
+		}
+	}
+
+	/*step 3: sort the symbols by code length, then by value, which is the order canonical codes are handed out in */
+	offsets[1] = 0;
+	for (n = 1; n < MAX_BIT_LENGTH; n++) {
+		offsets[n + 1] = offsets[n] + blcount[n];
+	}
+	total = offsets[MAX_BIT_LENGTH] + blcount[MAX_BIT_LENGTH];
+	for (n = 0; n < numcodes; n++) {
+		if (bitlen[n] != 0) {
+			sorted[offsets[bitlen[n]]++] = n;
+		}
+	}
+
+	/*step 4: generate the codes and fill the table. deflate sends codes msb first, so the index is the bit-reversed code */
+	memset(table->entries, 0, used * sizeof(unsigned));
+	for (i = 0; i < total; i++) {
+		unsigned symbol = sorted[i];
+		unsigned len = bitlen[symbol];
+		unsigned reversed, index;
+
+		code <<= len - (prevlen ? prevlen : len);
+		prevlen = len;
+		reversed = reverse_bits(code, len);
+
+		if (len <= rootbits) {
+			for (index = reversed; index < (1u << rootbits); index += 1u << len) {
+				table->entries[index] = HUFFMAN_ENTRY(symbol, 0, len);
+			}
+		} else {
+			unsigned low = reversed & ((1u << rootbits) - 1);
+			if (low != prefix) {
+				/* start a new subtable, large enough for all the remaining codes that share this prefix */
+				int avail;
+				subbits = len - rootbits;
+				avail = 1 << subbits;
+				while (subbits + rootbits < MAX_BIT_LENGTH) {
+					avail -= blcount[subbits + rootbits];
+					if (avail <= 0) {
+						break;
+					}
+					subbits++;
+					avail <<= 1;
+				}
+
+				if (used + (1u << subbits) > table->size) {
+					SET_ERROR(upng, UPNG_EMALFORMED);
+					return;
+				}
+				subtable = used;
+				used += 1u << subbits;
+				memset(table->entries + subtable, 0, (1u << subbits) * sizeof(unsigned));
+
+				table->entries[low] = HUFFMAN_ENTRY(subtable, HUFFMAN_ENTRY_SUBTABLE, subbits);
+				prefix = low;
+			}
+
+			for (index = reversed >> rootbits; index < (1u << subbits); index += 1u << (len - rootbits)) {
+				table->entries[subtable + index] = HUFFMAN_ENTRY(symbol, 0, len - rootbits);
+			}
 		}
+
+		/* blcount now tracks the codes still to be placed, which is what sizes the subtables */
+		blcount[len]--;
+		code++;
+	}
+}
+
+/* decode one symbol; the bit buffer must hold at least MAX_BIT_LENGTH bits */
+static unsigned huffman_decode_symbol(upng_t *upng, uz_stream* s, const huffman_table* codetable)
+{
+	unsigned entry = codetable->entries[s->bitbuf & ((1u << codetable->rootbits) - 1)];
+
+	if (entry & HUFFMAN_ENTRY_SUBTABLE) {
+		unsigned index = (unsigned)(s->bitbuf >> codetable->rootbits) & ((1u << HUFFMAN_ENTRY_BITS(entry)) - 1);
+		uz_bits(s, codetable->rootbits);
+		entry = codetable->entries[HUFFMAN_ENTRY_VALUE(entry) + index];
+	}
+
+	/* error: code not assigned by an incomplete tree */
+	if (HUFFMAN_ENTRY_BITS(entry) == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return 0;
 	}
+
+	uz_bits(s, HUFFMAN_ENTRY_BITS(entry));
+	return HUFFMAN_ENTRY_VALUE(entry);
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, uz_stream* s, huffman_table* codetree, huffman_table* codetreeD)
 {
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
 	unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+	unsigned codelengthcodetree_buffer[CODE_LENGTH_TABLE_SIZE];
+	huffman_table codelengthcodetree;
 	unsigned n, hlit, hdist, hclen, i;
 
-	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated */
-	/*C-code note: use no "return" between ctor and dtor of an uivector! */
-	if ((*bp) >> 3 >= inlength - 2) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return;
-	}
-
 	/* clear bitlen arrays */
 	memset(bitlen, 0, sizeof(bitlen));
 	memset(bitlenD, 0, sizeof(bitlenD));
 
-	/*the bit pointer is or will go past the memory */
-	hlit = read_bits(bp, in, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
-	hdist = read_bits(bp, in, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
-	hclen = read_bits(bp, in, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
+	hlit = read_bits(s, 5) + 257;	/*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already */
+	hdist = read_bits(s, 5) + 1;	/*number of distance codes. Unlike the spec, the value 1 is added to it here already */
+	hclen = read_bits(s, 4) + 4;	/*number of code length codes. Unlike the spec, the value 4 is added to it here already */
 
 	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 		if (i < hclen) {
-			codelengthcode[CLCL[i]] = read_bits(bp, in, 3);
+			codelengthcode[CLCL[i]] = read_bits(s, 3);
 		} else {
 			codelengthcode[CLCL[i]] = 0;	/*if not, it must stay 0 */
 		}
 	}
 
-	huffman_tree_create_lengths(upng, codelengthcodetree, codelengthcode);
+	/* error: the bit pointer is or will go past the memory */
+	if (uz_overrun(s)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	huffman_table_init(&codelengthcodetree, codelengthcodetree_buffer, CODE_LENGTH_TABLE_SIZE, CODE_LENGTH_ROOT_BITS);
+	huffman_table_create_lengths(upng, &codelengthcodetree, codelengthcode, NUM_CODE_LENGTH_CODES);
 
 	/* bail now if we encountered an error earlier */
 	if (upng->error != UPNG_EOK) {
@@ -336,7 +712,16 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 	/*now we can use this tree to read the lengths for the tree that this function will return */
 	i = 0;
 	while (i < hlit + hdist) {	/*i is the current symbol we're reading in the part that contains the code lengths of lit/len codes and dist codes */
-		unsigned code = huffman_decode_symbol(upng, in, bp, codelengthcodetree, inlength);
+		unsigned code, replength, value;
+
+		uz_refill(s);
+		/* error: end of input memory reached without endcode */
+		if (uz_overrun(s)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			break;
+		}
+
+		code = huffman_decode_symbol(upng, s, &codelengthcodetree);
 		if (upng->error != UPNG_EOK) {
 			break;
 		}
@@ -348,168 +733,123 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 				bitlenD[i - hlit] = code;
 			}
 			i++;
-		} else if (code == 16) {	/*repeat previous */
-			unsigned replength = 3;	/*read in the 2 bits that indicate repeat length (3-6) */
-			unsigned value;	/*set value to the previous code */
-
-			if ((*bp) >> 3 >= inlength) {
+			continue;
+		} else if (code == 16) {	/*repeat previous 3-6 times */
+			/* error: there is no previous length to repeat */
+			if (i == 0) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				break;
 			}
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 2);
-
-			if ((i - 1) < hlit) {
-				value = bitlen[i - 1];
-			} else {
-				value = bitlenD[i - hlit - 1];
-			}
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = value;
-				} else {
-					bitlenD[i - hlit] = value;
-				}
-				i++;
-			}
+			replength = 3 + uz_bits(s, 2);
+			value = (i - 1) < hlit ? bitlen[i - 1] : bitlenD[i - hlit - 1];
 		} else if (code == 17) {	/*repeat "0" 3-10 times */
-			unsigned replength = 3;	/*read in the bits that indicate repeat length */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			/*error, bit pointer jumps past memory */
-			replength += read_bits(bp, in, 3);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* error: i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-
-				if (i < hlit) {
-					bitlen[i] = 0;
-				} else {
-					bitlenD[i - hlit] = 0;
-				}
-				i++;
-			}
+			replength = 3 + uz_bits(s, 3);
+			value = 0;
 		} else if (code == 18) {	/*repeat "0" 11-138 times */
-			unsigned replength = 11;	/*read in the bits that indicate repeat length */
-			/* error, bit pointer jumps past memory */
-			if ((*bp) >> 3 >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				break;
-			}
-
-			replength += read_bits(bp, in, 7);
-
-			/*repeat this value in the next lengths */
-			for (n = 0; n < replength; n++) {
-				/* i is larger than the amount of codes */
-				if (i >= hlit + hdist) {
-					SET_ERROR(upng, UPNG_EMALFORMED);
-					break;
-				}
-				if (i < hlit)
-					bitlen[i] = 0;
-				else
-					bitlenD[i - hlit] = 0;
-				i++;
-			}
+			replength = 11 + uz_bits(s, 7);
+			value = 0;
 		} else {
 			/* somehow an unexisting code appeared. This can never happen. */
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			break;
 		}
+
+		/* error: i is larger than the amount of codes */
+		if (i + replength > hlit + hdist) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			break;
+		}
+
+		/*repeat this value in the next lengths */
+		for (n = 0; n < replength; n++) {
+			if (i < hlit) {
+				bitlen[i] = value;
+			} else {
+				bitlenD[i - hlit] = value;
+			}
+			i++;
+		}
 	}
 
+	/*the length of the end code 256 must be larger than 0 */
 	if (upng->error == UPNG_EOK && bitlen[256] == 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 	}
 
-	/*the length of the end code 256 must be larger than 0 */
 	/*now we've finally got hlit and hdist, so generate the code trees, and the function is done */
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetree, bitlen);
+		huffman_table_create_lengths(upng, codetree, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
 	}
 	if (upng->error == UPNG_EOK) {
-		huffman_tree_create_lengths(upng, codetreeD, bitlenD);
+		huffman_table_create_lengths(upng, codetreeD, bitlenD, NUM_DISTANCE_SYMBOLS);
 	}
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, uz_stream* s, huffman_table* codetree, huffman_table* codetreeD, unsigned btype)
 {
-	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
-	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
-	unsigned done = 0;
-
-	huffman_tree codetree;
-	huffman_tree codetreeD;
-
 	if (btype == 1) {
 		/* fixed trees */
-		huffman_tree_init(&codetree, (unsigned*)FIXED_DEFLATE_CODE_TREE, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, (unsigned*)FIXED_DISTANCE_TREE, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
+		unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+		unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+		unsigned n;
+
+		for (n = 0; n < 144; n++) bitlen[n] = 8;
+		for (n = 144; n < 256; n++) bitlen[n] = 9;
+		for (n = 256; n < 280; n++) bitlen[n] = 7;
+		for (n = 280; n < NUM_DEFLATE_CODE_SYMBOLS; n++) bitlen[n] = 8;
+		for (n = 0; n < NUM_DISTANCE_SYMBOLS; n++) bitlenD[n] = 5;
+
+		huffman_table_create_lengths(upng, codetree, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
+		huffman_table_create_lengths(upng, codetreeD, bitlenD, NUM_DISTANCE_SYMBOLS);
 	} else if (btype == 2) {
 		/* dynamic trees */
-		unsigned codelengthcodetree_buffer[CODE_LENGTH_BUFFER_SIZE];
-		huffman_tree codelengthcodetree;
+		get_tree_inflate_dynamic(upng, s, codetree, codetreeD);
+	}
 
-		huffman_tree_init(&codetree, codetree_buffer, NUM_DEFLATE_CODE_SYMBOLS, DEFLATE_CODE_BITLEN);
-		huffman_tree_init(&codetreeD, codetreeD_buffer, NUM_DISTANCE_SYMBOLS, DISTANCE_BITLEN);
-		huffman_tree_init(&codelengthcodetree, codelengthcodetree_buffer, NUM_CODE_LENGTH_CODES, CODE_LENGTH_BITLEN);
-		get_tree_inflate_dynamic(upng, &codetree, &codetreeD, &codelengthcodetree, in, bp, inlength);
+	if (upng->error != UPNG_EOK) {
+		return;
 	}
 
-	while (done == 0) {
-		unsigned code = huffman_decode_symbol(upng, in, bp, &codetree, inlength);
+	for (;;) {
+		unsigned code;
+
+		/* a single refill covers a length symbol with all of its extra bits plus the following distance symbol and its extra bits (15 + 5 + 15 + 13 bits) */
+		uz_refill(s);
+
+		/* error: end of input memory reached without endcode */
+		if (uz_overrun(s)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		code = huffman_decode_symbol(upng, s, codetree);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
 
-		if (code == 256) {
-			/* end code */
-			done = 1;
-		} else if (code <= 255) {
+		if (code <= 255) {
 			/* literal symbol */
-			if ((*pos) >= outsize) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
+			if (s->outpos >= s->outsize && !uz_reserve(upng, s, 1)) {
 				return;
 			}
 
 			/* store output */
-			out[(*pos)++] = (unsigned char)(code);
-		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
-			/* part 1: get length base */
-			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
-			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
-
-			/* part 2: get extra bits and add the value of that to length */
-			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
-
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
-				return;
-			}
-			length += read_bits(bp, in, numextrabits);
+			s->out[s->outpos++] = (unsigned char)(code);
+		} else if (code == 256) {
+			/* end code */
+			return;
+		} else if (code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
+			unsigned long length, distance;
+			unsigned codeD;
+			unsigned char *dest;
+			const unsigned char *src;
 
-			/*part 3: get distance code */
-			codeD = huffman_decode_symbol(upng, in, bp, &codetreeD, inlength);
+			/* part 1: get length base, and add the value of the extra bits to it */
+			length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX] + uz_bits(s, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
+
+			/*part 2: get distance code */
+			codeD = huffman_decode_symbol(upng, s, codetreeD);
 			if (upng->error != UPNG_EOK) {
 				return;
 			}
@@ -520,154 +860,262 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 				return;
 			}
 
-			distance = DISTANCE_BASE[codeD];
-
-			/*part 4: get extra bits from distance */
-			numextrabitsD = DISTANCE_EXTRA[codeD];
+			/*part 3: get distance base, and add the value of the extra bits to it */
+			distance = DISTANCE_BASE[codeD] + uz_bits(s, DISTANCE_EXTRA[codeD]);
 
-			/* error, bit pointer will jump past memory */
-			if (((*bp) >> 3) >= inlength) {
-				SET_ERROR(upng, UPNG_EMALFORMED);
+			if (!uz_reserve(upng, s, length)) {
 				return;
 			}
 
-			distance += read_bits(bp, in, numextrabitsD);
-
-			/*part 5: fill in all the out[n] values based on the length and dist */
-			start = (*pos);
-			backward = start - distance;
-
-			if ((*pos) + length >= outsize) {
+			/* error: distance points before the start of the output */
+			if (distance > s->outpos) {
 				SET_ERROR(upng, UPNG_EMALFORMED);
 				return;
 			}
 
-			for (forward = 0; forward < length; forward++) {
-				out[(*pos)++] = out[backward];
-				backward++;
-
-				if (backward >= start) {
-					backward = start - distance;
+			/*part 4: fill in all the out[n] values based on the length and dist */
+			dest = s->out + s->outpos;
+			src = dest - distance;
+			s->outpos += length;
+			if (distance >= length) {
+				memcpy(dest, src, length);
+			} else {
+				/* overlapping copy: the bytes being written are part of the pattern */
+				while (length--) {
+					*dest++ = *src++;
 				}
 			}
+		} else {
+			/* codes 286 and 287 are never used */
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
 		}
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, uz_stream* s)
 {
-	unsigned long p;
-	unsigned len, nlen, n;
+	unsigned len, nlen;
 
 	/* go to first boundary of byte */
-	while (((*bp) & 0x7) != 0) {
-		(*bp)++;
-	}
-	p = (*bp) / 8;		/*byte position */
+	uz_bits(s, s->bitcount & 0x7);
 
 	/* read len (2 bytes) and nlen (2 bytes) */
-	if (p >= inlength - 4) {
+	len = read_bits(s, 16);
+	nlen = read_bits(s, 16);
+
+	/* error: the stored block header is past the end of the input */
+	if (uz_overrun(s)) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	len = in[p] + 256 * in[p + 1];
-	p += 2;
-	nlen = in[p] + 256 * in[p + 1];
-	p += 2;
-
 	/* check if 16-bit nlen is really the one's complement of len */
 	if (len + nlen != 65535) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	if ((*pos) + len >= outsize) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
+	/* read the literal data: the whole bytes still sitting in the bit buffer come first */
+	while (len > 0 && s->bitcount / 8 > s->overrun) {
+		if (!uz_reserve(upng, s, 1)) {
+			return;
+		}
+		s->out[s->outpos++] = (unsigned char)uz_bits(s, 8);
+		len--;
+	}
+
+	if (len == 0) {
 		return;
 	}
 
-	/* read the literal data: len bytes are now stored in the out buffer */
-	if (p + len > inlength) {
+	/* error: the input ended in the middle of the block */
+	if (s->overrun > 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return;
 	}
 
-	for (n = 0; n < len; n++) {
-		out[(*pos)++] = in[p++];
+	/* the rest is copied straight from the input. the bit buffer may still hold a look-ahead copy of the bytes being skipped over */
+	s->bitbuf = 0;
+	s->bitcount = 0;
+	while (len > 0) {
+		unsigned long n;
+		if (s->inpos == s->insize && !uz_next_input(s)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+		if (!uz_reserve(upng, s, 1)) {
+			return;
+		}
+
+		n = s->outsize - s->outpos;
+		if (n > s->insize - s->inpos) {
+			n = s->insize - s->inpos;
+		}
+		if (n > len) {
+			n = len;
+		}
+		memcpy(s->out + s->outpos, s->in + s->inpos, n);
+		s->outpos += n;
+		s->inpos += n;
+		len -= n;
 	}
+}
 
-	(*bp) = p * 8;
+static void uz_stream_init(uz_stream* s, unsigned char* out, unsigned long outsize, const unsigned char* in, unsigned long insize)
+{
+	s->in = in;
+	s->insize = insize;
+	s->inpos = 0;
+	s->chunk = NULL;
+	s->chunks_end = NULL;
+	s->base = 0;
+	s->stop = 0;
+	s->bitbuf = 0;
+	s->bitcount = 0;
+	s->overrun = 0;
+	s->out = out;
+	s->outsize = outsize;
+	s->outpos = 0;
+	s->verify = 0;
+	s->adler = 1;
+	s->adlerpos = 0;
+	s->flush = NULL;
+	s->user = NULL;
+	s->done = 0;
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
+static upng_error uz_inflate_data(upng_t* upng, uz_stream* s)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
-	unsigned long pos = 0;	/*byte position in the out buffer */
+	unsigned codetree_buffer[DEFLATE_CODE_TABLE_SIZE];
+	unsigned codetreeD_buffer[DISTANCE_TABLE_SIZE];
+	huffman_table codetree;
+	huffman_table codetreeD;
 
 	unsigned done = 0;
 
+	huffman_table_init(&codetree, codetree_buffer, DEFLATE_CODE_TABLE_SIZE, DEFLATE_CODE_ROOT_BITS);
+	huffman_table_init(&codetreeD, codetreeD_buffer, DISTANCE_TABLE_SIZE, DISTANCE_ROOT_BITS);
+
 	while (done == 0) {
 		unsigned btype;
 
 		/* ensure next bit doesn't point past the end of the buffer */
-		if ((bp >> 3) >= insize) {
+		uz_refill(s);
+		if (s->overrun * 8 >= s->bitcount) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
 
 		/* read block control bits */
-		done = read_bit(&bp, &in[inpos]);
-		btype = read_bit(&bp, &in[inpos]) | (read_bit(&bp, &in[inpos]) << 1);
+		done = uz_bits(s, 1);
+		btype = uz_bits(s, 2);
 
 		/* process control type appropriateyly */
 		if (btype == 3) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		} else if (btype == 0) {
-			inflate_uncompressed(upng, out, outsize, &in[inpos], &bp, &pos, insize);	/*no compression */
+			inflate_uncompressed(upng, s);	/*no compression */
 		} else {
-			inflate_huffman(upng, out, outsize, &in[inpos], &bp, &pos, insize, btype);	/*compression, btype 01 or 10 */
+			inflate_huffman(upng, s, &codetree, &codetreeD, btype);	/*compression, btype 01 or 10 */
 		}
 
-		/* stop if an error has occured */
-		if (upng->error != UPNG_EOK) {
+		/* stop if an error has occured, or if the rest of the output is not wanted */
+		if (upng->error != UPNG_EOK || s->done) {
 			return upng->error;
 		}
+
+		/* a segment of a parallel decode ends right where the next one starts, which has to be the start of a block */
+		if (s->stop != 0) {
+			unsigned long long position = uz_bit_position(s);
+			if (done == 0 && position == (unsigned long long)s->stop * 8) {
+				return upng->error;
+			}
+			if (done != 0 || position > (unsigned long long)s->stop * 8) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return upng->error;
+			}
+		}
+	}
+
+	/* error: the final block ran past the end of the input */
+	if (uz_overrun(s)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
 	}
 
 	return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *in, unsigned long insize)
+/* read the adler32 which follows the final block, returns 0 if the data ends before it */
+static int uz_read_trailer(uz_stream* s, unsigned* adler)
 {
-	/* we require two bytes for the zlib data header */
-	if (insize < 2) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return upng->error;
-	}
+	unsigned i;
 
-	/* 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way */
-	if ((in[0] * 256 + in[1]) % 31 != 0) {
-		SET_ERROR(upng, UPNG_EMALFORMED);
-		return upng->error;
+	uz_bits(s, s->bitcount & 0x7);
+	*adler = 0;
+	for (i = 0; i < 4; i++) {
+		*adler = (*adler << 8) | read_bits(s, 8);
 	}
+	return !uz_overrun(s);
+}
 
-	/*error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec */
-	if ((in[0] & 15) != 8 || ((in[0] >> 4) & 15) > 7) {
+/* check the adler32 of the whole output against the trailer */
+static void uz_verify(upng_t* upng, uz_stream* s)
+{
+	unsigned adler;
+
+	if (!s->verify) {
+		return;
+	}
+
+	uz_checksum_output(s);
+	if (!uz_read_trailer(s, &adler)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	} else if (adler != s->adler) {
+		SET_ERROR(upng, UPNG_ECHECKSUM);
+	}
+}
+
+static upng_error uz_inflate(upng_t* upng, uz_stream* s)
+{
+	unsigned cmf, flg;
+
+	/* read the two bytes of the zlib data header, the first chunk does not necessarily hold both */
+	cmf = read_bits(s, 8);
+	flg = read_bits(s, 8);
+
+	/* we require two bytes for the zlib data header */
+	if (uz_overrun(s)) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
+	/* 256 * cmf + flg must be a multiple of 31, the FCHECK value is supposed to be made that way */
+	if ((cmf * 256 + flg) % 31 != 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
+	/*error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec */
+	if ((cmf & 15) != 8 || ((cmf >> 4) & 15) > 7) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
 	/* the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary." */
-	if (((in[1] >> 5) & 1) != 0) {
+	if (((flg >> 5) & 1) != 0) {
 		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
 
-	/* create output buffer */
-	uz_inflate_data(upng, out, outsize, in, insize, 2);
+	uz_inflate_data(upng, s);
+
+	/* a segment of a parallel decode which stopped before the final block has no trailer, nor does a stream cut short */
+	if (upng->error == UPNG_EOK && s->stop == 0 && !s->done) {
+		uz_verify(upng, s);
+	}
 
 	return upng->error;
 }
@@ -688,6 +1136,212 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+#if defined(UPNG_NEON) || defined(UPNG_SSE2)
+
+/*
+   vector unfilter for 3 and 4 byte pixels. Sub, Average and Paeth depend on the pixel to the left, so those go one pixel
+   at a time with its channels in the low lanes of a vector; Up goes 16 bytes at a time.
+   3 byte pixels are loaded and stored a byte at a time, so that they never touch the byte past the end of the scanline.
+   both targets are little endian, the first channel ends up in the first lane
+ */
+
+static inline unsigned pixel_bytes_load(const unsigned char* p, unsigned long bytewidth)
+{
+	unsigned v;
+	if (bytewidth == 4) {
+		memcpy(&v, p, 4);
+		return v;
+	}
+	return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static inline void pixel_bytes_store(unsigned char* p, unsigned v, unsigned long bytewidth)
+{
+	if (bytewidth == 4) {
+		memcpy(p, &v, 4);
+		return;
+	}
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+}
+
+#if defined(UPNG_NEON)
+
+typedef uint8x8_t upng_pixel;
+
+static inline upng_pixel pixel_load(const unsigned char* p, unsigned long bytewidth)
+{
+	return vreinterpret_u8_u32(vdup_n_u32(pixel_bytes_load(p, bytewidth)));
+}
+
+static inline void pixel_store(unsigned char* p, upng_pixel v, unsigned long bytewidth)
+{
+	pixel_bytes_store(p, vget_lane_u32(vreinterpret_u32_u8(v), 0), bytewidth);
+}
+
+static inline upng_pixel pixel_zero(void)
+{
+	return vdup_n_u8(0);
+}
+
+static inline upng_pixel pixel_add(upng_pixel x, upng_pixel y)
+{
+	return vadd_u8(x, y);
+}
+
+/* (a + b) / 2 rounded down, without overflowing */
+static inline upng_pixel pixel_average(upng_pixel a, upng_pixel b)
+{
+	return vhadd_u8(a, b);
+}
+
+/* paeth_predictor on every channel: with p = a + b - c, |p - a| = |b - c|, |p - b| = |a - c| and |p - c| = |a + b - 2c|, computed on 16 bits */
+static inline upng_pixel pixel_paeth(upng_pixel a, upng_pixel b, upng_pixel c)
+{
+	uint16x8_t pa = vabdl_u8(b, c);
+	uint16x8_t pb = vabdl_u8(a, c);
+	uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vshll_n_u8(c, 1));
+	uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+	uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+	return vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+}
+
+static unsigned long unfilter_up_vector(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unsigned long i = 0;
+	for (; i + 16 <= length; i += 16)
+		vst1q_u8(recon + i, vaddq_u8(vld1q_u8(scanline + i), vld1q_u8(precon + i)));
+	return i;
+}
+
+#else
+
+typedef __m128i upng_pixel;
+
+static inline upng_pixel pixel_load(const unsigned char* p, unsigned long bytewidth)
+{
+	return _mm_cvtsi32_si128((int)pixel_bytes_load(p, bytewidth));
+}
+
+static inline void pixel_store(unsigned char* p, upng_pixel v, unsigned long bytewidth)
+{
+	pixel_bytes_store(p, (unsigned)_mm_cvtsi128_si32(v), bytewidth);
+}
+
+static inline upng_pixel pixel_zero(void)
+{
+	return _mm_setzero_si128();
+}
+
+static inline upng_pixel pixel_add(upng_pixel x, upng_pixel y)
+{
+	return _mm_add_epi8(x, y);
+}
+
+/* (a + b) / 2 rounded down: pavgb rounds up, which is one too many when a + b is odd */
+static inline upng_pixel pixel_average(upng_pixel a, upng_pixel b)
+{
+	return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+static inline __m128i abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/* paeth_predictor on every channel: with p = a + b - c, |p - a| = |b - c|, |p - b| = |a - c| and |p - c| = |a + b - 2c|, computed on 16 bits */
+static inline upng_pixel pixel_paeth(upng_pixel a, upng_pixel b, upng_pixel c)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a16 = _mm_unpacklo_epi8(a, zero);
+	__m128i b16 = _mm_unpacklo_epi8(b, zero);
+	__m128i c16 = _mm_unpacklo_epi8(c, zero);
+	__m128i pa = abs_epi16(_mm_sub_epi16(b16, c16));
+	__m128i pb = abs_epi16(_mm_sub_epi16(a16, c16));
+	__m128i pc = abs_epi16(_mm_sub_epi16(_mm_add_epi16(a16, b16), _mm_add_epi16(c16, c16)));
+	__m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	__m128i not_b = _mm_cmpgt_epi16(pb, pc);
+	__m128i b_or_c = _mm_or_si128(_mm_and_si128(not_b, c16), _mm_andnot_si128(not_b, b16));
+	__m128i result = _mm_or_si128(_mm_and_si128(not_a, b_or_c), _mm_andnot_si128(not_a, a16));
+	return _mm_packus_epi16(result, result);
+}
+
+static unsigned long unfilter_up_vector(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long length)
+{
+	unsigned long i = 0;
+	for (; i + 16 <= length; i += 16)
+		_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(scanline + i)), _mm_loadu_si128((const __m128i*)(precon + i))));
+	return i;
+}
+
+#endif
+
+/* called with a constant bytewidth, so that it is inlined once for each pixel size with loads and stores of a known size */
+static inline int unfilter_pixels_vector(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	upng_pixel a, b, c, x;
+	unsigned long i;
+
+	switch (filterType) {
+	case 0:
+		memmove(recon, scanline, length);
+		return 1;
+	case 1:
+		a = pixel_zero();
+		for (i = 0; i < length; i += bytewidth) {
+			a = pixel_add(pixel_load(scanline + i, bytewidth), a);
+			pixel_store(recon + i, a, bytewidth);
+		}
+		return 1;
+	case 2:
+		for (i = unfilter_up_vector(recon, scanline, precon, length); i < length; i++)
+			recon[i] = scanline[i] + precon[i];
+		return 1;
+	case 3:
+		a = pixel_zero();
+		for (i = 0; i < length; i += bytewidth) {
+			b = pixel_load(precon + i, bytewidth);
+			x = pixel_load(scanline + i, bytewidth);
+			a = pixel_add(x, pixel_average(a, b));
+			pixel_store(recon + i, a, bytewidth);
+		}
+		return 1;
+	case 4:
+		a = pixel_zero();
+		c = pixel_zero();
+		for (i = 0; i < length; i += bytewidth) {
+			b = pixel_load(precon + i, bytewidth);
+			x = pixel_load(scanline + i, bytewidth);
+			a = pixel_add(x, pixel_paeth(a, b, c));
+			pixel_store(recon + i, a, bytewidth);
+			c = b;
+		}
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* returns 0 if the scalar code has to do it: pixels of other sizes, the first scanline, unknown filter types */
+static int unfilter_scanline_vector(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	if (precon == NULL) {
+		return 0;
+	}
+
+	switch (bytewidth) {
+	case 3:
+		return unfilter_pixels_vector(recon, scanline, precon, 3, filterType, length);
+	case 4:
+		return unfilter_pixels_vector(recon, scanline, precon, 4, filterType, length);
+	default:
+		return 0;
+	}
+}
+
+#endif
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -699,6 +1353,13 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	 */
 
 	unsigned long i;
+
+#if defined(UPNG_NEON) || defined(UPNG_SSE2)
+	if (unfilter_scanline_vector(recon, scanline, precon, bytewidth, filterType, length)) {
+		return;
+	}
+#endif
+
 	switch (filterType) {
 	case 0:
 		for (i = 0; i < length; i++)
@@ -750,23 +1411,13 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	}
 }
 
-static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp)
+/* unfilter the scanlines y0 to y1 (excluded), the first of which must not depend on the one above it unless it is the first of the image */
+static void unfilter_rows(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned long linebytes, unsigned long bytewidth, unsigned y0, unsigned y1)
 {
-	/*
-	   For PNG filter method 0
-	   this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 it's called 7 times)
-	   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
-	   w and h are image dimensions or dimensions of reduced image, bpp is bpp per pixel
-	   in and out are allowed to be the same memory address!
-	 */
-
 	unsigned y;
 	unsigned char *prevline = 0;
 
-	unsigned long bytewidth = (bpp + 7) / 8;	/*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
-	unsigned long linebytes = (w * bpp + 7) / 8;
-
-	for (y = 0; y < h; y++) {
+	for (y = y0; y < y1; y++) {
 		unsigned long outindex = linebytes * y;
 		unsigned long inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
 		unsigned char filterType = in[inindex];
@@ -780,6 +1431,95 @@ static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in,
 	}
 }
 
+typedef struct unfilter_band {
+	const upng_t*			upng;
+	unsigned char*			out;
+	const unsigned char*	in;
+	unsigned long			linebytes;
+	unsigned long			bytewidth;
+	unsigned				y0;
+	unsigned				y1;
+	upng_error				error;
+	unsigned				error_line;
+} unfilter_band;
+
+static void unfilter_band_task(void* user, unsigned index)
+{
+	unfilter_band* band = (unfilter_band*)user + index;
+
+	/* the bands run at the same time, each reports its errors on its own copy */
+	upng_t upng = *band->upng;
+	upng.error = UPNG_EOK;
+
+	unfilter_rows(&upng, band->out, band->in, band->linebytes, band->bytewidth, band->y0, band->y1);
+	band->error = upng.error;
+	band->error_line = upng.error_line;
+}
+
+/* split the image into bands starting at scanlines filtered with None or Sub, which do not depend on the one above, and unfilter them in parallel. returns 0 if there are not enough such scanlines */
+static int unfilter_parallel(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned long linebytes, unsigned long bytewidth, unsigned h)
+{
+	unfilter_band bands[UPNG_MAX_SEGMENTS];
+	unsigned count = 1, y, i;
+
+	bands[0].y0 = 0;
+	for (y = 1; y < h && count < UPNG_MAX_SEGMENTS; y++) {
+		unsigned char filterType = in[(1 + linebytes) * y];
+		if ((filterType == 0 || filterType == 1) && y >= (unsigned long long)count * h / UPNG_MAX_SEGMENTS) {
+			bands[count++].y0 = y;
+		}
+	}
+
+	if (count < 2) {
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		bands[i].upng = upng;
+		bands[i].out = out;
+		bands[i].in = in;
+		bands[i].linebytes = linebytes;
+		bands[i].bytewidth = bytewidth;
+		bands[i].y1 = i + 1 < count ? bands[i + 1].y0 : h;
+		bands[i].error = UPNG_EOK;
+	}
+
+	upng->parallel_for(upng->parallel_user, count, unfilter_band_task, bands);
+
+	for (i = 0; i < count; i++) {
+		if (bands[i].error != UPNG_EOK) {
+			upng->error = bands[i].error;
+			upng->error_line = bands[i].error_line;
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp)
+{
+	/*
+	   For PNG filter method 0
+	   this function unfilters a single image (e.g. without interlacing this is called once, with Adam7 it's called 7 times)
+	   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
+	   w and h are image dimensions or dimensions of reduced image, bpp is bpp per pixel
+	   in and out are allowed to be the same memory address! out may also start before in, as the passes of an Adam7 image are unfiltered in place
+	 */
+
+	unsigned long bytewidth = (bpp + 7) / 8;	/*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
+	unsigned long linebytes = ((unsigned long)w * bpp + 7) / 8;
+
+	/* in place, a scanline overwrites the input of the ones above it, so those have to be done first */
+	if (upng->parallel_for != NULL && (out + linebytes * h <= in || in + (linebytes + 1) * h <= out) && linebytes * h >= UPNG_PARALLEL_MIN_SIZE) {
+		if (unfilter_parallel(upng, out, in, linebytes, bytewidth, h)) {
+			return;
+		}
+	}
+
+	unfilter_rows(upng, out, in, linebytes, bytewidth, 0, h);
+}
+
 static void remove_padding_bits(unsigned char *out, const unsigned char *in, unsigned long olinebits, unsigned long ilinebits, unsigned h)
 {
 	/*
@@ -807,6 +1547,105 @@ static void remove_padding_bits(unsigned char *out, const unsigned char *in, uns
 	}
 }
 
+/* the reduction which applies to the image, none unless it is interlaced */
+static unsigned upng_shift(const upng_t* upng)
+{
+	return upng->interlace ? upng->reduction : 0;
+}
+
+/* size and place in the inflated data of the passes of an Adam7 image, as many as make up the image at its reduction: 1, 3, 5 or all 7 of them */
+static void adam7_get_passes(const upng_t* upng, adam7_passes* passes)
+{
+	unsigned bpp = upng_get_bpp(upng);
+	unsigned i;
+
+	passes->count = ADAM7_PASSES - 2 * upng_shift(upng);
+	passes->filter_start[0] = 0;
+	passes->padded_start[0] = 0;
+	for (i = 0; i < passes->count; i++) {
+		unsigned long linebytes;
+
+		passes->w[i] = (upng->width + ADAM7_DX[i] - ADAM7_IX[i] - 1) / ADAM7_DX[i];
+		passes->h[i] = (upng->height + ADAM7_DY[i] - ADAM7_IY[i] - 1) / ADAM7_DY[i];
+
+		/* an empty pass has no scanlines at all, not even their filter type bytes */
+		if (passes->w[i] == 0 || passes->h[i] == 0) {
+			passes->w[i] = 0;
+			passes->h[i] = 0;
+		}
+
+		linebytes = ((unsigned long)passes->w[i] * bpp + 7) / 8;
+		passes->filter_start[i + 1] = passes->filter_start[i] + (linebytes + 1) * passes->h[i];
+		passes->padded_start[i + 1] = passes->padded_start[i] + linebytes * passes->h[i];
+	}
+}
+
+/*
+   put the pixels of the unfiltered passes, whose scanlines are padded to whole bytes, in their place in out, whose scanlines are olinebits long
+   with fewer than 7 passes, the pixels they hold are every (1 << shift)-th one of every (1 << shift)-th row, which makes a smaller image of them
+   pixels smaller than a byte are set bit by bit, out must be zeroed for them
+ */
+static void adam7_deinterlace(unsigned char *out, const unsigned char *in, const adam7_passes* passes, unsigned long olinebits, unsigned bpp, unsigned shift)
+{
+	unsigned i;
+
+	for (i = 0; i < passes->count; i++) {
+		unsigned long ilinebits = (((unsigned long)passes->w[i] * bpp + 7) / 8) * 8;
+		unsigned x, y;
+
+		if (bpp >= 8) {
+			unsigned long bytewidth = bpp / 8;
+			unsigned long step = (ADAM7_DX[i] >> shift) * bytewidth;
+
+			for (y = 0; y < passes->h[i]; y++) {
+				const unsigned char* src = in + passes->padded_start[i] + y * (ilinebits / 8);
+				unsigned char* dst = out + ((ADAM7_IY[i] + (unsigned long)y * ADAM7_DY[i]) >> shift) * (olinebits / 8) + (ADAM7_IX[i] >> shift) * bytewidth;
+				for (x = 0; x < passes->w[i]; x++) {
+					unsigned long b;
+					for (b = 0; b < bytewidth; b++) {
+						dst[b] = src[b];
+					}
+					src += bytewidth;
+					dst += step;
+				}
+			}
+		} else {
+			for (y = 0; y < passes->h[i]; y++) {
+				for (x = 0; x < passes->w[i]; x++) {
+					unsigned long ibp = passes->padded_start[i] * 8 + y * ilinebits + (unsigned long)x * bpp;
+					unsigned long obp = ((ADAM7_IY[i] + (unsigned long)y * ADAM7_DY[i]) >> shift) * olinebits + ((ADAM7_IX[i] + (unsigned long)x * ADAM7_DX[i]) >> shift) * bpp;
+					unsigned b;
+					for (b = 0; b < bpp; b++, ibp++, obp++) {
+						unsigned char bit = (unsigned char)((in[ibp >> 3] >> (7 - (ibp & 0x7))) & 1);
+						out[obp >> 3] |= (unsigned char)(bit << (7 - (obp & 0x7)));
+					}
+				}
+			}
+		}
+	}
+}
+
+/* unfilter the passes of an Adam7 image in place, each one to the front of the space it was inflated to, then put them together into out */
+static void adam7_post_process(upng_t* upng, unsigned char *out, unsigned char *in, unsigned long olinebits)
+{
+	unsigned bpp = upng_get_bpp(upng);
+	adam7_passes passes;
+	unsigned i;
+
+	adam7_get_passes(upng, &passes);
+	for (i = 0; i < passes.count; i++) {
+		unfilter(upng, in + passes.padded_start[i], in + passes.filter_start[i], passes.w[i], passes.h[i], bpp);
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+	}
+
+	if (bpp < 8) {
+		memset(out, 0, (olinebits * upng_get_height(upng) + 7) / 8);
+	}
+	adam7_deinterlace(out, in, &passes, olinebits, bpp, upng_shift(upng));
+}
+
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from the IDAT chunks*/
 static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned char *in, const upng_t* info_png)
 {
@@ -819,7 +1658,9 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 		return;
 	}
 
-	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
+	if (info_png->interlace) {
+		adam7_post_process(upng, out, in, (unsigned long)upng_get_width(info_png) * bpp);
+	} else if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
 		unfilter(upng, in, in, w, h, bpp);
 		if (upng->error != UPNG_EOK) {
 			return;
@@ -881,10 +1722,36 @@ static upng_format determine_format(upng_t* upng) {
 	}
 }
 
+static void* upng_default_alloc(void* user, unsigned long size)
+{
+	(void)user;
+	return malloc(size);
+}
+
+static void upng_default_free(void* user, void* ptr)
+{
+	(void)user;
+	free(ptr);
+}
+
+static const upng_allocator upng_default_allocator = { upng_default_alloc, upng_default_free, NULL };
+
+static void* upng_alloc(const upng_allocator* allocator, unsigned long size)
+{
+	return allocator->alloc(allocator->user, size);
+}
+
+static void upng_dealloc(const upng_allocator* allocator, void* ptr)
+{
+	if (ptr != NULL && allocator->free != NULL) {
+		allocator->free(allocator->user, ptr);
+	}
+}
+
 static void upng_free_source(upng_t* upng)
 {
 	if (upng->source.owning != 0) {
-		free((void*)upng->source.buffer);
+		upng_dealloc(&upng->allocator, (void*)upng->source.buffer);
 	}
 
 	upng->source.buffer = NULL;
@@ -925,12 +1792,36 @@ upng_error upng_header(upng_t* upng)
 		return upng->error;
 	}
 
+	/* the header has a fixed size, the chunks after it are found from there */
+	if (upng_chunk_length(upng->source.buffer + 8) != 13) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
+	/* the header is followed by its CRC */
+	if (upng->verify) {
+		if (upng->source.size < 33) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return upng->error;
+		}
+		if (!upng_chunk_crc_ok(upng->source.buffer + 8, upng->source.size - 8)) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+			return upng->error;
+		}
+	}
+
 	/* read the values given in the header */
 	upng->width = MAKE_DWORD_PTR(upng->source.buffer + 16);
 	upng->height = MAKE_DWORD_PTR(upng->source.buffer + 20);
 	upng->color_depth = upng->source.buffer[24];
 	upng->color_type = (upng_color)upng->source.buffer[25];
 
+	/* an image without pixels is not a valid PNG */
+	if (upng->width == 0 || upng->height == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
 	/* determine our color format */
 	upng->format = determine_format(upng);
 	if (upng->format == UPNG_BADFORMAT) {
@@ -950,146 +1841,373 @@ upng_error upng_header(upng_t* upng)
 		return upng->error;
 	}
 
-	/* check that the compression method (byte 27) is 0 (spec allows 1, but uPNG does not support it) */
-	if (upng->source.buffer[28] != 0) {
-		SET_ERROR(upng, UPNG_EUNINTERLACED);
+	/* check that the interlace method (byte 29) is 0 (none) or 1 (Adam7), the only ones in the spec */
+	if (upng->source.buffer[28] > 1) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
 		return upng->error;
 	}
+	upng->interlace = upng->source.buffer[28];
 
 	upng->state = UPNG_HEADER;
 	return upng->error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+/* verify the general well-formed-ness of the chunks, then set the stream up to inflate the data of the IDAT chunks where it lies. returns 0 on error */
+static int uz_stream_init_idat(upng_t* upng, uz_stream* s, unsigned char* out, unsigned long outsize)
 {
 	const unsigned char *chunk;
-	unsigned char* compressed;
-	unsigned char* inflated;
-	unsigned long compressed_size = 0, compressed_index = 0;
-	unsigned long inflated_size;
-	upng_error error;
 
+	/* first byte of the first chunk after the header */
+	chunk = upng->source.buffer + 33;
+
+	while (chunk < upng->source.buffer + upng->source.size) {
+		unsigned long length;
+
+		/* make sure chunk header is not larger than the total compressed */
+		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return 0;
+		}
+
+		/* get length; sanity check it */
+		length = upng_chunk_length(chunk);
+		if (length > INT_MAX) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return 0;
+		}
+
+		/* make sure chunk header+paylaod is not larger than the total compressed */
+		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return 0;
+		}
+
+		/* parse chunks */
+		if (upng_chunk_type(chunk) == CHUNK_IEND) {
+			break;
+		} else if (upng_chunk_type(chunk) != CHUNK_IDAT && upng_chunk_critical(chunk)) {
+			SET_ERROR(upng, UPNG_EUNSUPPORTED);
+			return 0;
+		}
+
+		/* ancillary chunks are skipped, so only the image data needs to be intact */
+		if (upng->verify && upng_chunk_type(chunk) == CHUNK_IDAT && !upng_chunk_crc_ok(chunk, upng->source.size - (unsigned long)(chunk - upng->source.buffer))) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+			return 0;
+		}
+
+		chunk += length + 12;
+	}
+
+	uz_stream_init(s, out, outsize, NULL, 0);
+	s->chunk = upng->source.buffer + 33;
+	s->chunks_end = chunk;
+	s->verify = upng->verify;
+	return 1;
+}
+
+/* parse the header if necessary and release the old result, if any. returns 0 if the image can not be decoded (now) */
+static int prepare_decode(upng_t* upng)
+{
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
-		return upng->error;
+		return 0;
 	}
 
 	/* parse the main header, if necessary */
 	upng_header(upng);
 	if (upng->error != UPNG_EOK) {
-		return upng->error;
+		return 0;
 	}
 
 	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
 	if (upng->state != UPNG_HEADER) {
-		return upng->error;
+		return 0;
 	}
 
 	/* release old result, if any */
 	if (upng->buffer != 0) {
-		free(upng->buffer);
+		upng_dealloc(&upng->allocator, upng->buffer);
 		upng->buffer = 0;
 		upng->size = 0;
 	}
 
-	/* first byte of the first chunk after the header */
-	chunk = upng->source.buffer + 33;
+	return 1;
+}
 
-	/* scan through the chunks, finding the size of all IDAT chunks, and also
-	 * verify general well-formed-ness */
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
+/* find restart points in the deflate stream: the empty stored block of a full flush ends byte aligned, right before a new block.
+   only points spread evenly over the data are kept, starts[0] is the start of the stream. returns the number of segments */
+static unsigned find_segments(const uz_stream* stream, unsigned long* starts, unsigned long* total)
+{
+	uz_stream s = *stream;
+	unsigned long stride;
+	unsigned window = 0xFFFFFFFF;
+	unsigned count = 1;
 
-		/* make sure chunk header is not larger than the total compressed */
-		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+	while (uz_next_input(&s)) {
+	}
+	*total = s.base;
+	stride = *total / UPNG_MAX_SEGMENTS;
+
+	starts[0] = 0;
+	s = *stream;
+	while (uz_next_input(&s)) {
+		unsigned long i;
+		for (i = 0; i < s.insize; i++) {
+			/* LEN = 0 and NLEN = 0xFFFF */
+			window = (window << 8) | s.in[i];
+			if (window == 0x0000FFFF && s.base + i + 1 - starts[count - 1] >= stride && s.base + i + 1 < *total) {
+				starts[count++] = s.base + i + 1;
+				if (count == UPNG_MAX_SEGMENTS) {
+					return count;
+				}
+			}
 		}
+	}
 
-		/* get length; sanity check it */
-		length = upng_chunk_length(chunk);
-		if (length > INT_MAX) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+	return count;
+}
+
+typedef struct uz_segment {
+	upng_t*				upng;
+	const uz_stream*	stream;		/* positioned at the start of the image data */
+	unsigned long		start;
+	unsigned long		end;		/* 0 for the last segment */
+	unsigned long		maxsize;
+	unsigned char*		out;
+	unsigned long		outsize;
+	unsigned long		outpos;
+	upng_error			error;
+	int					has_trailer;	/* the last segment reads the adler32 following the final block, it is checked once the segments are put together */
+	unsigned			trailer;
+} uz_segment;
+
+/* the output of the segments after the first one goes to buffers of their own, grown as needed since their size is not known in advance */
+static void grow_segment(upng_t* upng, uz_stream* s)
+{
+	uz_segment* segment = (uz_segment*)s->user;
+	unsigned long size = s->outsize * 2;
+	unsigned char* out;
+
+	if (s->outsize == segment->maxsize) {
+		return;
+	}
+	if (size > segment->maxsize) {
+		size = segment->maxsize;
+	}
+
+	out = (unsigned char*)upng_alloc(&upng->allocator, size);
+	if (out == NULL) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
+	memcpy(out, s->out, s->outpos);
+	upng_dealloc(&upng->allocator, s->out);
+	s->out = out;
+	s->outsize = size;
+}
+
+static void inflate_segment(void* user, unsigned index)
+{
+	uz_segment* segment = (uz_segment*)user + index;
+	uz_stream s = *segment->stream;
+
+	/* the segments run at the same time, each reports its errors on its own copy */
+	upng_t upng = *segment->upng;
+	upng.error = UPNG_EOK;
+
+	s.out = segment->out;
+	s.outsize = segment->outsize;
+	s.stop = segment->end;
+	s.verify = 0;
+	if (index == 0) {
+		uz_inflate(&upng, &s);
+	} else if (!uz_seek(&s, segment->start)) {
+		SET_ERROR(&upng, UPNG_EMALFORMED);
+	} else {
+		s.flush = grow_segment;
+		s.user = segment;
+		uz_inflate_data(&upng, &s);
+		if (upng.error == UPNG_EOK && segment->end == 0 && segment->stream->verify) {
+			segment->has_trailer = uz_read_trailer(&s, &segment->trailer);
 		}
+	}
 
-		/* make sure chunk header+paylaod is not larger than the total compressed */
-		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
-			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+	segment->out = s.out;
+	segment->outsize = s.outsize;
+	segment->outpos = s.outpos;
+	segment->error = upng.error;
+}
+
+/* inflate the segments of the stream in parallel, the first one straight into out. from the first segment which can't be inflated
+   on its own (a distance into the previous one, a false restart point), the rest is inflated sequentially. 0 if there are no restart points */
+static int uz_inflate_parallel(upng_t* upng, uz_stream* stream)
+{
+	uz_segment segments[UPNG_MAX_SEGMENTS];
+	unsigned long starts[UPNG_MAX_SEGMENTS];
+	unsigned long total, outpos = 0;
+	unsigned count, resume, i;
+
+	count = find_segments(stream, starts, &total);
+	if (count < 2) {
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		segments[i].upng = upng;
+		segments[i].stream = stream;
+		segments[i].start = starts[i];
+		segments[i].end = i + 1 < count ? starts[i + 1] : 0;
+		segments[i].maxsize = stream->outsize;
+		segments[i].out = NULL;
+		segments[i].outpos = 0;
+		segments[i].error = UPNG_EOK;
+		segments[i].has_trailer = 0;
+
+		if (i == 0) {
+			segments[i].out = stream->out;
+			segments[i].outsize = stream->outsize;
+		} else {
+			/* a guess from the compression ratio of the whole stream, a little over so that most segments never grow */
+			unsigned long length = (segments[i].end != 0 ? segments[i].end : total) - segments[i].start;
+			segments[i].outsize = (unsigned long)((unsigned long long)length * stream->outsize / total * 5 / 4) + 4096;
+			if (segments[i].outsize > stream->outsize) {
+				segments[i].outsize = stream->outsize;
+			}
+			segments[i].out = (unsigned char*)upng_alloc(&upng->allocator, segments[i].outsize);
+			if (segments[i].out == NULL) {
+				for (resume = 1; resume < i; resume++) {
+					upng_dealloc(&upng->allocator, segments[resume].out);
+				}
+				return 0;
+			}
 		}
+	}
 
-		/* get pointer to payload */
-		data = chunk + 8;
+	upng->parallel_for(upng->parallel_user, count, inflate_segment, segments);
 
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			compressed_size += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
+	/* put the segments together, up to the first one which failed */
+	for (resume = 0; resume < count; resume++) {
+		if (segments[resume].error != UPNG_EOK) {
 			break;
-		} else if (upng_chunk_critical(chunk)) {
-			SET_ERROR(upng, UPNG_EUNSUPPORTED);
-			return upng->error;
 		}
+		if (resume > 0) {
+			if (segments[resume].outpos > stream->outsize - outpos) {
+				break;
+			}
+			memcpy(stream->out + outpos, segments[resume].out, segments[resume].outpos);
+		}
+		outpos += segments[resume].outpos;
+	}
 
-		chunk += upng_chunk_length(chunk) + 12;
+	for (i = 1; i < count; i++) {
+		upng_dealloc(&upng->allocator, segments[i].out);
 	}
 
-	/* allocate enough space for the (compressed and filtered) image data */
-	compressed = (unsigned char*)malloc(compressed_size);
-	if (compressed == NULL) {
-		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+	/* the rest is inflated sequentially, with the output so far as history */
+	if (resume < count) {
+		if (resume == 0) {
+			uz_inflate(upng, stream);
+		} else if (!uz_seek(stream, starts[resume])) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+		} else {
+			stream->outpos = outpos;
+			if (uz_inflate_data(upng, stream) == UPNG_EOK) {
+				uz_verify(upng, stream);
+			}
+		}
+	} else {
+		stream->outpos = outpos;
+		if (stream->verify && !segments[count - 1].has_trailer) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+		} else if (stream->verify && adler32_update(1, stream->out, outpos) != segments[count - 1].trailer) {
+			SET_ERROR(upng, UPNG_ECHECKSUM);
+		}
 	}
 
-	/* scan through the chunks again, this time copying the values into
-	 * our compressed buffer.  there's no reason to validate anything a second time. */
-	chunk = upng->source.buffer + 33;
-	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
+	return 1;
+}
 
-		length = upng_chunk_length(chunk);
-		data = chunk + 8;
+/* size of the inflated (but still filtered) data which is decoded: every scanline is padded to whole bytes and starts with its filter type */
+static unsigned long inflated_image_size(const upng_t* upng)
+{
+	adam7_passes passes;
 
-		/* parse chunks */
-		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			memcpy(compressed + compressed_index, data, length);
-			compressed_index += length;
-		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
-			break;
-		}
+	if (upng->interlace) {
+		adam7_get_passes(upng, &passes);
+		return passes.filter_start[passes.count];
+	}
+
+	return (((unsigned long)upng->width * upng_get_bpp(upng) + 7) / 8 + 1) * upng->height;
+}
+
+/* the output of a reduced Adam7 image has UZ_MAX_MATCH bytes to spare past the passes it is made of, so it is only full once all of them were inflated */
+static void stop_inflating(upng_t* upng, uz_stream* s)
+{
+	s->done = 1;
+}
 
-		chunk += upng_chunk_length(chunk) + 12;
+/* inflate the image data into a buffer of its own, or only the passes which make up a reduced Adam7 image. returns NULL on error */
+static unsigned char* inflate_image(upng_t* upng, unsigned long inflated_size)
+{
+	unsigned char* inflated;
+	unsigned long outsize = inflated_size;
+	uz_stream stream;
+
+	if (upng_shift(upng) != 0) {
+		outsize += UZ_MAX_MATCH;
 	}
 
-	/* allocate space to store inflated (but still filtered) data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
-	inflated = (unsigned char*)malloc(inflated_size);
+	inflated = (unsigned char*)upng_alloc(&upng->allocator, outsize);
 	if (inflated == NULL) {
-		free(compressed);
 		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+		return NULL;
 	}
 
 	/* decompress image data */
-	error = uz_inflate(upng, inflated, inflated_size, compressed, compressed_size);
-	if (error != UPNG_EOK) {
-		free(compressed);
-		free(inflated);
+	if (!uz_stream_init_idat(upng, &stream, inflated, outsize)) {
+		upng_dealloc(&upng->allocator, inflated);
+		return NULL;
+	}
+	if (upng_shift(upng) != 0) {
+		stream.flush = stop_inflating;
+		uz_inflate(upng, &stream);
+	} else if (upng->parallel_for == NULL || inflated_size < UPNG_PARALLEL_MIN_SIZE || !uz_inflate_parallel(upng, &stream)) {
+		uz_inflate(upng, &stream);
+	}
+
+	/* error: the image data ended before the last scanline */
+	if (upng->error == UPNG_EOK && stream.outpos < inflated_size) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+
+	if (upng->error != UPNG_EOK) {
+		upng_dealloc(&upng->allocator, inflated);
+		return NULL;
+	}
+
+	return inflated;
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode(upng_t* upng)
+{
+	unsigned char* inflated;
+
+	if (!prepare_decode(upng)) {
 		return upng->error;
 	}
 
-	/* free the compressed compressed data */
-	free(compressed);
+	inflated = inflate_image(upng, inflated_image_size(upng));
+	if (inflated == NULL) {
+		return upng->error;
+	}
 
 	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
-	upng->buffer = (unsigned char*)malloc(upng->size);
+	upng->size = ((unsigned long)upng_get_height(upng) * upng_get_width(upng) * upng_get_bpp(upng) + 7) / 8;
+	upng->buffer = (unsigned char*)upng_alloc(&upng->allocator, upng->size);
 	if (upng->buffer == NULL) {
-		free(inflated);
+		upng_dealloc(&upng->allocator, inflated);
 		upng->size = 0;
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng->error;
@@ -1097,10 +2215,10 @@ upng_error upng_decode(upng_t* upng)
 
 	/* unfilter scanlines */
 	post_process_scanlines(upng, upng->buffer, inflated, upng);
-	free(inflated);
+	upng_dealloc(&upng->allocator, inflated);
 
 	if (upng->error != UPNG_EOK) {
-		free(upng->buffer);
+		upng_dealloc(&upng->allocator, upng->buffer);
 		upng->buffer = NULL;
 		upng->size = 0;
 	} else {
@@ -1113,15 +2231,165 @@ upng_error upng_decode(upng_t* upng)
 	return upng->error;
 }
 
-static upng_t* upng_new(void)
+/* unfilter the complete scanlines in the window and hand them to the callback, then drop what no deflate distance can reach */
+static void flush_rows(upng_t* upng, uz_stream* s)
 {
-	upng_t* upng;
+	upng_row_stream* rows = (upng_row_stream*)s->user;
+	unsigned long drop;
 
-	upng = (upng_t*)malloc(sizeof(upng_t));
-	if (upng == NULL) {
-		return NULL;
+	while (rows->y < upng->height && s->outpos - rows->consumed >= rows->linebytes + 1) {
+		const unsigned char* scanline = s->out + rows->consumed;
+		unsigned char* line = rows->lines + (rows->y & 1) * rows->linebytes;
+		const unsigned char* prevline = rows->y > 0 ? rows->lines + ((rows->y - 1) & 1) * rows->linebytes : NULL;
+
+		unfilter_scanline(upng, line, scanline + 1, prevline, rows->bytewidth, scanline[0], rows->linebytes);
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+
+		rows->callback(rows->user, rows->y, line);
+		rows->consumed += rows->linebytes + 1;
+		rows->y++;
+	}
+
+	drop = s->outpos > UZ_WINDOW_SIZE ? s->outpos - UZ_WINDOW_SIZE : 0;
+	if (drop > rows->consumed) {
+		drop = rows->consumed;
+	}
+
+	if (drop > 0) {
+		memmove(s->out, s->out + drop, s->outpos - drop);
+		s->outpos -= drop;
+		rows->consumed -= drop;
+	}
+}
+
+/* Adam7 scanlines are only complete once every pass is: deinterlace first */
+static void decode_passes_rows(upng_t* upng, upng_row_callback callback, void* user)
+{
+	unsigned char* inflated;
+	unsigned char* image;
+	unsigned long linebytes = ((unsigned long)upng_get_width(upng) * upng_get_bpp(upng) + 7) / 8;
+	unsigned height = upng_get_height(upng);
+	unsigned y;
+
+	inflated = inflate_image(upng, inflated_image_size(upng));
+	if (inflated == NULL) {
+		return;
+	}
+
+	image = (unsigned char*)upng_alloc(&upng->allocator, linebytes * height);
+	if (image == NULL) {
+		upng_dealloc(&upng->allocator, inflated);
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return;
+	}
+
+	adam7_post_process(upng, image, inflated, linebytes * 8);
+	upng_dealloc(&upng->allocator, inflated);
+
+	for (y = 0; y < height && upng->error == UPNG_EOK; y++) {
+		callback(user, y, image + linebytes * y);
+	}
+
+	upng_dealloc(&upng->allocator, image);
+}
+
+/*decode a PNG one scanline at a time, never holding the whole image in memory*/
+upng_error upng_decode_rows(upng_t* upng, upng_row_callback callback, void* user)
+{
+	unsigned char* window;
+	unsigned long window_size;
+	unsigned bpp;
+	upng_row_stream rows;
+	uz_stream stream;
+
+	if (!prepare_decode(upng)) {
+		/* the source is released after decoding, so a decoded image can not be streamed again */
+		if (upng->error == UPNG_EOK) {
+			SET_ERROR(upng, UPNG_EPARAM);
+		}
+		return upng->error;
+	}
+
+	if (callback == NULL) {
+		SET_ERROR(upng, UPNG_EPARAM);
+		return upng->error;
+	}
+
+	if (upng->interlace) {
+		decode_passes_rows(upng, callback, user);
+		if (upng->error == UPNG_EOK) {
+			upng->state = UPNG_DECODED;
+		}
+		upng_free_source(upng);
+		return upng->error;
+	}
+
+	bpp = upng_get_bpp(upng);
+	rows.callback = callback;
+	rows.user = user;
+	rows.linebytes = ((unsigned long)upng->width * bpp + 7) / 8;
+	rows.bytewidth = (bpp + 7) / 8;
+	rows.consumed = 0;
+	rows.y = 0;
+
+	/* the window holds the deflate history, the scanline being inflated and room for the output of the next flush; small images simply fit whole */
+	window_size = 2 * UZ_WINDOW_SIZE + rows.linebytes + 1;
+	if (window_size > (rows.linebytes + 1) * upng->height) {
+		window_size = (rows.linebytes + 1) * upng->height;
+	}
+
+	window = (unsigned char*)upng_alloc(&upng->allocator, window_size);
+	rows.lines = (unsigned char*)upng_alloc(&upng->allocator, 2 * rows.linebytes);
+	if (window == NULL || rows.lines == NULL) {
+		upng_dealloc(&upng->allocator, window);
+		upng_dealloc(&upng->allocator, rows.lines);
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return upng->error;
+	}
+
+	if (!uz_stream_init_idat(upng, &stream, window, window_size)) {
+		upng_dealloc(&upng->allocator, window);
+		upng_dealloc(&upng->allocator, rows.lines);
+		return upng->error;
+	}
+	stream.flush = flush_rows;
+	stream.user = &rows;
+	uz_inflate(upng, &stream);
+
+	/* hand out the scanlines left in the window */
+	if (upng->error == UPNG_EOK) {
+		flush_rows(upng, &stream);
+	}
+
+	/* error: the image data ended before the last scanline */
+	if (upng->error == UPNG_EOK && rows.y != upng->height) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
 	}
 
+	upng_dealloc(&upng->allocator, window);
+	upng_dealloc(&upng->allocator, rows.lines);
+
+	if (upng->error == UPNG_EOK) {
+		upng->state = UPNG_DECODED;
+	}
+
+	/* we are done with our input buffer; free it if we own it */
+	upng_free_source(upng);
+
+	return upng->error;
+}
+
+static void upng_init(upng_t* upng, const upng_allocator* allocator)
+{
+	upng->allocator = *allocator;
+	upng->parallel_for = NULL;
+	upng->parallel_user = NULL;
+	upng->verify = 1;
+	upng->interlace = 0;
+	upng->reduction = 0;
+
 	upng->buffer = NULL;
 	upng->size = 0;
 
@@ -1139,13 +2407,34 @@ static upng_t* upng_new(void)
 	upng->source.buffer = NULL;
 	upng->source.size = 0;
 	upng->source.owning = 0;
+}
+
+static upng_t* upng_new(const upng_allocator* allocator)
+{
+	upng_t* upng;
+
+	if (allocator == NULL) {
+		allocator = &upng_default_allocator;
+	}
 
+	upng = (upng_t*)upng_alloc(allocator, sizeof(upng_t));
+	if (upng == NULL) {
+		return NULL;
+	}
+
+	upng_init(upng, allocator);
 	return upng;
 }
 
 upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 {
-	upng_t* upng = upng_new();
+	return upng_new_from_bytes_with_allocator(buffer, size, NULL);
+}
+
+/* a NULL allocator stands for malloc and free */
+upng_t* upng_new_from_bytes_with_allocator(const unsigned char* buffer, unsigned long size, const upng_allocator* allocator)
+{
+	upng_t* upng = upng_new(allocator);
 	if (upng == NULL) {
 		return NULL;
 	}
@@ -1157,6 +2446,26 @@ upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
 	return upng;
 }
 
+/* upng_header on a stack image capped to UPNG_HEADER_SIZE bytes: nothing is allocated nor read past the IHDR chunk */
+upng_error upng_probe(const unsigned char* buffer, unsigned long size, upng_info* info)
+{
+	upng_t upng;
+
+	upng_init(&upng, &upng_default_allocator);
+	upng.source.buffer = buffer;
+	upng.source.size = size < UPNG_HEADER_SIZE ? size : UPNG_HEADER_SIZE;
+
+	if (upng_header(&upng) == UPNG_EOK && info != NULL) {
+		info->width = upng.width;
+		info->height = upng.height;
+		info->bpp = upng_get_bpp(&upng);
+		info->format = upng.format;
+		info->interlaced = upng.interlace;
+	}
+
+	return upng.error;
+}
+
 upng_t* upng_new_from_file(const char *filename)
 {
 	upng_t* upng;
@@ -1164,7 +2473,7 @@ upng_t* upng_new_from_file(const char *filename)
 	FILE *file;
 	long size;
 
-	upng = upng_new();
+	upng = upng_new(NULL);
 	if (upng == NULL) {
 		return NULL;
 	}
@@ -1176,18 +2485,26 @@ upng_t* upng_new_from_file(const char *filename)
 	}
 
 	/* get filesize */
-	fseek(file, 0, SEEK_END);
-	size = ftell(file);
+	if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0) {
+		fclose(file);
+		SET_ERROR(upng, UPNG_ENOTFOUND);
+		return upng;
+	}
 	rewind(file);
 
 	/* read contents of the file into the vector */
-	buffer = (unsigned char *)malloc((unsigned long)size);
+	buffer = (unsigned char *)upng_alloc(&upng->allocator, size > 0 ? (unsigned long)size : 1);
 	if (buffer == NULL) {
 		fclose(file);
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng;
 	}
-	fread(buffer, 1, (unsigned long)size, file);
+	if (fread(buffer, 1, (unsigned long)size, file) != (unsigned long)size) {
+		upng_dealloc(&upng->allocator, buffer);
+		fclose(file);
+		SET_ERROR(upng, UPNG_ENOTFOUND);
+		return upng;
+	}
 	fclose(file);
 
 	/* set the read buffer as our source buffer, with owning flag set */
@@ -1200,16 +2517,32 @@ upng_t* upng_new_from_file(const char *filename)
 
 void upng_free(upng_t* upng)
 {
+	upng_allocator allocator = upng->allocator;
+
 	/* deallocate image buffer */
-	if (upng->buffer != NULL) {
-		free(upng->buffer);
-	}
+	upng_dealloc(&allocator, upng->buffer);
 
 	/* deallocate source buffer, if necessary */
 	upng_free_source(upng);
 
 	/* deallocate struct itself */
-	free(upng);
+	upng_dealloc(&allocator, upng);
+}
+
+void upng_set_verify(upng_t* upng, int verify)
+{
+	upng->verify = verify;
+}
+
+void upng_set_reduction(upng_t* upng, unsigned shift)
+{
+	upng->reduction = shift < ADAM7_MAX_SHIFT ? shift : ADAM7_MAX_SHIFT;
+}
+
+void upng_set_parallel(upng_t* upng, upng_parallel_for parallel_for, void* user)
+{
+	upng->parallel_for = parallel_for;
+	upng->parallel_user = user;
 }
 
 upng_error upng_get_error(const upng_t* upng)
@@ -1222,14 +2555,15 @@ unsigned upng_get_error_line(const upng_t* upng)
 	return upng->error_line;
 }
 
+/* the size of the image as it is decoded, which is smaller than the one in the header for a reduced Adam7 image */
 unsigned upng_get_width(const upng_t* upng)
 {
-	return upng->width;
+	return (upng->width + (1u << upng_shift(upng)) - 1) >> upng_shift(upng);
 }
 
 unsigned upng_get_height(const upng_t* upng)
 {
-	return upng->height;
+	return (upng->height + (1u << upng_shift(upng)) - 1) >> upng_shift(upng);
 }
 
 unsigned upng_get_bpp(const upng_t* upng)